@@ -7,15 +7,38 @@
 
 #include "sd.h"
 
-/* A few public ariables keeping track of the SD's capacity
- * and block length. */
-int sd_high_capacity;
-int sd_block_len;
-int sd_mmc;
-uint8_t sd_csd[SD_CSD_LENGTH];
-uint8_t sd_cid[SD_CID_LENGTH];
+/* Per-card state, and the card the sd_* functions currently talk to */
+SD_Card sd_cards[SD_NUM_CARDS];
+SD_Card *sd_card = &sd_cards[0];
+static int sd_card_index;
+/* Clock the bus was last set to, in Hz */
+static uint32_t sd_bus_clock;
+
+#if SD_NUM_CARDS > 2
+#error "Chip select pins are only defined for two cards, add more SD_CSn_PINs."
+#endif
+#if SD_SPI_BUS != SD_SPI_BUS_PORT
+static const uint32_t sd_cs_pins[2] = { SD_CS_PIN, SD_CS1_PIN };
+#endif
 
-#ifdef SD_DEBUG
+/* Called between polls while the card is busy */
+static void (*sd_idle_hook)(void);
+
+/* Block length used by the transfer paths, and address arithmetic on it */
+#if SD_FIXED_BLOCK_LENGTH
+#if SD_BLOCK_LENGTH != (1 << SD_BLOCK_SHIFT)
+#error "SD_BLOCK_SHIFT doesn't match SD_BLOCK_LENGTH."
+#endif
+#define SD_BLOCK_LEN		SD_BLOCK_LENGTH
+#define SD_BLOCK_MOD(x)		((x) & (SD_BLOCK_LENGTH - 1))
+#define SD_BLOCK_DIV(x)		((x) >> SD_BLOCK_SHIFT)
+#else
+#define SD_BLOCK_LEN		(sd_card->block_len)
+#define SD_BLOCK_MOD(x)		((x) % sd_card->block_len)
+#define SD_BLOCK_DIV(x)		((x) / sd_card->block_len)
+#endif
+
+#if defined(SD_DEBUG) || defined(SD_STATS)
 #include "debug.h"
 #endif
 
@@ -31,7 +54,7 @@ void sd_debug_print_boolean(uint8_t data) {
 void sd_debug_print_data_block(uint8_t *data) {
 	int i;
 
-	for (i = 0; i < sd_block_len; i++) {
+	for (i = 0; i < SD_BLOCK_LEN; i++) {
 		debug_printf("%02X ", data[i]);
 		if (((i+1) % 16) == 0) {
 			debug_printf("\n");
@@ -52,12 +75,12 @@ void sd_debug_print_csd(void) {
 	debug_printf("     *\n");
 	debug_printf("     * Raw CSD Bytes: ");
 	for (i = 0; i < 16; i++)
-		debug_printf("%02X ", sd_csd[i]);
+		debug_printf("%02X ", sd_card->csd[i]);
 	debug_printf("\n");
 
 	debug_printf("     *\n");
 
-	csd_version = (sd_csd[0] & 0xC0) >> 6;
+	csd_version = (sd_card->csd[0] & 0xC0) >> 6;
 
 	if (csd_version == 0)
 		debug_printf("     * VERSION: 1.0\n");
@@ -66,90 +89,90 @@ void sd_debug_print_csd(void) {
 	else
 		debug_printf("     * VERSION: Unknown\n");
 
-	debug_printf("     * TAAC: %X\n", sd_csd[1]);
-	debug_printf("     * NSAC: %X\n", sd_csd[2]);
-	debug_printf("     * TRAN_SPEED: %X\n", sd_csd[3]);
+	debug_printf("     * TAAC: %X\n", sd_card->csd[1]);
+	debug_printf("     * NSAC: %X\n", sd_card->csd[2]);
+	debug_printf("     * TRAN_SPEED: %X\n", sd_card->csd[3]);
 
 	// CCC goes here
 
-	debug_printf("     * READ_BL_LEN: %X\n", (sd_csd[5] & 0x0F));
+	debug_printf("     * READ_BL_LEN: %X\n", (sd_card->csd[5] & 0x0F));
 	debug_printf("     * READ_BL_PARTIAL: ");
-	sd_debug_print_boolean((sd_csd[6] & 0x80)>>7);
+	sd_debug_print_boolean((sd_card->csd[6] & 0x80)>>7);
 	debug_printf("\n");
 
 	debug_printf("     * WRITE_BLK_MISALIGN: ");
-	sd_debug_print_boolean((sd_csd[6] & 0x40)>>6);
+	sd_debug_print_boolean((sd_card->csd[6] & 0x40)>>6);
 	debug_printf("\n");
 
 	debug_printf("     * READ_BLK_MISALIGN: ");
-	sd_debug_print_boolean((sd_csd[6] & 0x20)>>5);
+	sd_debug_print_boolean((sd_card->csd[6] & 0x20)>>5);
 	debug_printf("\n");
 
 	debug_printf("     * DSR_IMP: ");
-	sd_debug_print_boolean((sd_csd[6] & 0x10)>>4);
+	sd_debug_print_boolean((sd_card->csd[6] & 0x10)>>4);
 	debug_printf("\n");
 	
 	if (csd_version != 1) {	
-		temp = (sd_csd[6] & 0x3) << 2;
-		temp |= ((sd_csd[7] & 0xC0) >> 6);
+		temp = (sd_card->csd[6] & 0x3) << 2;
+		temp |= ((sd_card->csd[7] & 0xC0) >> 6);
 		debug_printf("     * C_SIZE: %0X ", temp);
-		temp = (sd_csd[7] & 0x3F) << 2;
-		temp |= ((sd_csd[8] & 0xC0) >> 6);
+		temp = (sd_card->csd[7] & 0x3F) << 2;
+		temp |= ((sd_card->csd[8] & 0xC0) >> 6);
 		debug_printf("%0X\n", temp);
 
-		debug_printf("     * VDD_R_CURR_MIN: %X\n", ((sd_csd[8] & 0x38) >> 3));
-		debug_printf("     * VDD_R_CURR_MAX: %X\n", (sd_csd[8] & 0x7));
-		debug_printf("     * VDD_W_CURR_MIN: %X\n", (sd_csd[9] & 0xE0) >> 5);
-		debug_printf("     * VDD_W_CURR_MAX: %X\n", ((sd_csd[9] & 0x1C) >> 2));
+		debug_printf("     * VDD_R_CURR_MIN: %X\n", ((sd_card->csd[8] & 0x38) >> 3));
+		debug_printf("     * VDD_R_CURR_MAX: %X\n", (sd_card->csd[8] & 0x7));
+		debug_printf("     * VDD_W_CURR_MIN: %X\n", (sd_card->csd[9] & 0xE0) >> 5);
+		debug_printf("     * VDD_W_CURR_MAX: %X\n", ((sd_card->csd[9] & 0x1C) >> 2));
 
-		temp = (sd_csd[9] & 0x3) << 1;
-		temp |= ((sd_csd[10] & 0x80) >> 7);
+		temp = (sd_card->csd[9] & 0x3) << 1;
+		temp |= ((sd_card->csd[10] & 0x80) >> 7);
 		debug_printf("     * C_SIZE_MULT: %X\n", temp);
 	} else {
-		debug_printf("     * C_SIZE: %0X %0X %0X\n", (sd_csd[7] & 0x3F), sd_csd[8], sd_csd[9]);
+		debug_printf("     * C_SIZE: %0X %0X %0X\n", (sd_card->csd[7] & 0x3F), sd_card->csd[8], sd_card->csd[9]);
 	}
 
 	debug_printf("     * ERASE_BLK_EN: ");
-	sd_debug_print_boolean((sd_csd[10] & 0x40) >> 6);
+	sd_debug_print_boolean((sd_card->csd[10] & 0x40) >> 6);
 	debug_printf("\n");
 
-	temp = (sd_csd[10] & 0x3F) << 1;
-	temp |= (sd_csd[11] & 0x80) >> 7;
+	temp = (sd_card->csd[10] & 0x3F) << 1;
+	temp |= (sd_card->csd[11] & 0x80) >> 7;
 	debug_printf("     * SECTOR_SIZE: %0X\n", temp);
 
-	debug_printf("     * WP_GRP_SIZE: %X\n", (sd_csd[11] & 0x7F));
+	debug_printf("     * WP_GRP_SIZE: %X\n", (sd_card->csd[11] & 0x7F));
 
 	debug_printf("     * WP_GRP_ENABLE: ");
-	sd_debug_print_boolean((sd_csd[12] & 0x80) >> 7);
+	sd_debug_print_boolean((sd_card->csd[12] & 0x80) >> 7);
 	debug_printf("\n");
 
-	debug_printf("     * R2W_FACTOR: %X\n", (sd_csd[12] & 0x1C) >> 2);
+	debug_printf("     * R2W_FACTOR: %X\n", (sd_card->csd[12] & 0x1C) >> 2);
 
-	temp = (sd_csd[12] & 0x3) << 2;
-	temp |= ((sd_csd[13] & 0xC0) >> 6);
+	temp = (sd_card->csd[12] & 0x3) << 2;
+	temp |= ((sd_card->csd[13] & 0xC0) >> 6);
 	debug_printf("     * WRITE_BL_LEN: %X\n", temp);
 
 	debug_printf("     * WRITE_BL_PARTIAL: ");
-	sd_debug_print_boolean((sd_csd[13] & 0x20) >> 5);
+	sd_debug_print_boolean((sd_card->csd[13] & 0x20) >> 5);
 	debug_printf("\n");
 
 	debug_printf("     * FILE_FORMAT_GRP: ");
-	sd_debug_print_boolean((sd_csd[14] & 0x80) >> 7);
+	sd_debug_print_boolean((sd_card->csd[14] & 0x80) >> 7);
 	debug_printf("\n");
 
 	debug_printf("     * COPY: ");
-	sd_debug_print_boolean((sd_csd[14] & 0x40) >> 6);
+	sd_debug_print_boolean((sd_card->csd[14] & 0x40) >> 6);
 	debug_printf("\n");
 
 	debug_printf("     * PERM_WRITE_PROTECT: ");
-	sd_debug_print_boolean((sd_csd[14] & 0x20) >> 5);
+	sd_debug_print_boolean((sd_card->csd[14] & 0x20) >> 5);
 	debug_printf("\n");
 
 	debug_printf("     * TMP_WRITE_PROTECT: ");
-	sd_debug_print_boolean((sd_csd[14] & 0x10) >> 4);
+	sd_debug_print_boolean((sd_card->csd[14] & 0x10) >> 4);
 	debug_printf("\n");
 
-	debug_printf("     * FILE_FORMAT: %X\n", (sd_csd[14] & 0x0C) >> 2);
+	debug_printf("     * FILE_FORMAT: %X\n", (sd_card->csd[14] & 0x0C) >> 2);
 	
 	debug_printf("     *\n");
 	debug_printf("     ********************************\n\n");
@@ -164,16 +187,16 @@ void sd_debug_print_cid(void) {
 	debug_printf("     *\n");
 	debug_printf("     * Raw CID Bytes: ");
 	for (i = 0; i < 16; i++)
-		debug_printf("%X ", sd_cid[i]);
+		debug_printf("%X ", sd_card->cid[i]);
 	debug_printf("\n");
 	debug_printf("     *\n");
 
-	debug_printf("     * Manufacturer ID (MID): %X\n", sd_cid[0]);
-	debug_printf("     * OEM/Application ID (OID): %c%c\n", sd_cid[1], sd_cid[2]);
-	debug_printf("     * Product name (PNM): %c%c%c%c%c%c\n", sd_cid[3], sd_cid[4], sd_cid[5], sd_cid[6], sd_cid[7]);
-	debug_printf("     * Product revision (PRV): %X\n", sd_cid[8]);
-	debug_printf("     * Product serial number (PSV): %X%X%X%X\n", sd_cid[9], sd_cid[10], sd_cid[11], sd_cid[12]);
-	debug_printf("     * Manufacturing date (MDT): %X %X\n", (sd_cid[13] & 0x0F), sd_cid[14]);
+	debug_printf("     * Manufacturer ID (MID): %X\n", sd_card->cid[0]);
+	debug_printf("     * OEM/Application ID (OID): %c%c\n", sd_card->cid[1], sd_card->cid[2]);
+	debug_printf("     * Product name (PNM): %c%c%c%c%c%c\n", sd_card->cid[3], sd_card->cid[4], sd_card->cid[5], sd_card->cid[6], sd_card->cid[7]);
+	debug_printf("     * Product revision (PRV): %X\n", sd_card->cid[8]);
+	debug_printf("     * Product serial number (PSV): %X%X%X%X\n", sd_card->cid[9], sd_card->cid[10], sd_card->cid[11], sd_card->cid[12]);
+	debug_printf("     * Manufacturing date (MDT): %X %X\n", (sd_card->cid[13] & 0x0F), sd_card->cid[14]);
 	debug_printf("     *\n");
 	debug_printf("     ********************************\n\n");
 }
@@ -191,52 +214,164 @@ void sd_debug_print(char *message, uint8_t *data, int dataLen) {
 	#endif		
 }
 
+#ifdef SD_STATS
+
+SD_Stats sd_stats;
+/* Start of the operation being timed, per card and histogram, so the
+ * samples of cards working side by side don't overwrite each other */
+static uint32_t sd_stats_start[SD_NUM_CARDS][SD_STATS_HISTS];
+/* Set after a CMD55, so the next command counts as an application command */
+static int sd_stats_app;
+
+static void sd_stats_command(uint8_t command) {
+	if (sd_stats_app)
+		sd_stats.app_commands[command & 0x3F]++;
+	else
+		sd_stats.commands[command & 0x3F]++;
+	sd_stats_app = ((command & 0x3F) == SD_CMD55);
+}
+
+static void sd_stats_end(int hist) {
+	uint32_t cycles;
+	int bin;
+
+	cycles = SD_STATS_CYCLES() - sd_stats_start[sd_card_index][hist];
+
+	if (hist == SD_STATS_BUSY) {
+		sd_stats.busy_waits++;
+		sd_stats.busy_cycles += cycles;
+		if (cycles > sd_stats.busy_max)
+			sd_stats.busy_max = cycles;
+	}
+
+	/* Bin by the position of the highest set bit */
+	for (bin = 0; (cycles >> 1) != 0 && bin < SD_STATS_BINS-1; bin++)
+		cycles >>= 1;
+	sd_stats.latency[hist][bin]++;
+}
+
+void sd_stats_clear(void) {
+	uint8_t *p;
+	unsigned int i;
+
+	p = (uint8_t *)&sd_stats;
+	for (i = 0; i < sizeof(SD_Stats); i++)
+		p[i] = 0;
+}
+
+void sd_debug_print_stats(void) {
+	char *names[SD_STATS_HISTS] = {"CMD17", "CMD18", "CMD24", "CMD25", "CMD38", "busy", "init", "resume"};
+	int i, j;
+
+	debug_printf("SD stats\n");
+	for (i = 0; i < 64; i++) {
+		if (sd_stats.commands[i] != 0)
+			debug_printf("  CMD%d: %u\n", i, sd_stats.commands[i]);
+		if (sd_stats.app_commands[i] != 0)
+			debug_printf("  ACMD%d: %u\n", i, sd_stats.app_commands[i]);
+	}
+	debug_printf("  bytes read: %u, written: %u\n", sd_stats.bytes_read, sd_stats.bytes_written);
+	debug_printf("  retries: %u, CRC errors: %u\n", sd_stats.retries, sd_stats.crc_errors);
+	debug_printf("  busy waits: %u, cycles: %u, max: %u\n", sd_stats.busy_waits, sd_stats.busy_cycles, sd_stats.busy_max);
+	for (i = 0; i < SD_STATS_HISTS; i++) {
+		for (j = 0; j < SD_STATS_BINS; j++) {
+			if (sd_stats.latency[i][j] != 0)
+				debug_printf("  %s 2^%d cycles: %u\n", names[i], j, sd_stats.latency[i][j]);
+		}
+	}
+}
+
+#define SD_STATS_INC(field)		(sd_stats.field++)
+#define SD_STATS_ADD(field, n)		(sd_stats.field += (n))
+#define SD_STATS_COMMAND(command)	sd_stats_command(command)
+#define SD_STATS_BEGIN(hist)		(sd_stats_start[sd_card_index][hist] = SD_STATS_CYCLES())
+#define SD_STATS_END(hist)		sd_stats_end(hist)
+
+#else
+
+#define SD_STATS_INC(field)		do { } while (0)
+#define SD_STATS_ADD(field, n)		do { } while (0)
+#define SD_STATS_COMMAND(command)	do { } while (0)
+#define SD_STATS_BEGIN(hist)		do { } while (0)
+#define SD_STATS_END(hist)		do { } while (0)
+
+#endif
+
+/* Ends the latency sample of an operation whose end the caller saw
+ * itself, a CMD18 closed with sd_read_blocks_stop(), a CMD25 closed with
+ * sd_write_blocks_stop() or an erase begun with sd_erase_blocks_start().
+ * Only for operations that succeeded. Does nothing without SD_STATS. */
+void sd_stats_done(int hist) {
+	(void)hist;
+	SD_STATS_END(hist);
+}
+
 /******************************************************************************
  *** Low-level SPI interface functions                                      ***
  ******************************************************************************/
 
+/* Bus backend primitives, defined with the backends further down */
+static void sd_spi_bus_init(void);
+static uint8_t sd_spi_exchange(uint8_t data);
+
+#if SD_SPI_BUS == SD_SPI_BUS_PORT
+
+void sd_cd_wp_init(void) {
+	/* Taken care of by sd_port_init() */
+}
+
+uint8_t sd_card_detect(void) {
+	return sd_port_card_detect();
+}
+
+uint8_t sd_write_protect(void) {
+	return sd_port_write_protect();
+}
+
+#else
+
 void sd_cd_wp_init(void) {
 	/* Set card detect and write protect pins at inputs */
-	FIO0DIR &= ~((1<<18)|(1<<19));
+	FIO0DIR &= ~(SD_CD_PIN|SD_WP_PIN);
 }
 
 uint8_t sd_card_detect(void) {
 	/* Return the status of the card detect switch */
-	if (FIO0PIN & (1<<18))
+	if (FIO0PIN & SD_CD_PIN)
 		return 1;
 	return 0;
 }
 
 uint8_t sd_write_protect(void) {
 	/* Return the status of the write protect switch */
-	if (FIO0PIN & (1<<19))
+	if (FIO0PIN & SD_WP_PIN)
 		return 1;
 	return 0;
 }
 
+#endif
+
 void sd_spi_init(void) {
 	int i;
 
-	/* Enable SCK0, MISO0, and MOSI0 for SPI0 bus use,
-	 * but declare SSEL0 as a GPIO for now. */
-	PINSEL0 |= ((1<<8)|(1<<10)|(1<<12));
-	PINSEL0 &= ~((1<<9)|(1<<11)|(1<<13)|(1<<15)|(1<<14));
+	/* Hand the pins to the SPI peripheral and configure it */
+	sd_spi_bus_init();
 
-	/* Set the SPI Clock speed to 400KHz for now (initialization)
-	 * PCLK = 60MHz, SPI Rate = 400KHz = 60/150, S0SPCCR = 150 */
-	S0SPCCR = 150;
+	/* Set the SPI Clock speed to 400KHz for now (initialization) */
+	sd_bus_clock = sd_spi_set_clock(SD_SPI_INIT_CLOCK);
 
-	/* Set the SPI Control Register
-	 * 8 bits data, CPOL = 0, CPHA = 0, Master = 1,
-	 * LSBF = 0 (MSB first), SPIE = 0 */
-	S0SPCR = (1<<5);
-	
-	/* Set the SD chip select pin as an output */
-	SD_CS_IODIR |= SD_CS_PIN;
-
-	/* Hold SSEL0 high so the SD card can initialize itself with
-	 * the next 80 clocks on SCK0. */
+#if SD_SPI_BUS != SD_SPI_BUS_PORT
+	/* Set the SD chip select pins as outputs, and hold them all high so
+	 * the SD cards can initialize themselves with the next 80 clocks
+	 * on SCK0. */
+	for (i = 0; i < SD_NUM_CARDS; i++) {
+		sd_cards[i].cs_pin = sd_cs_pins[i];
+		SD_CS_IODIR |= sd_cs_pins[i];
+		SD_CS_IOSET = sd_cs_pins[i];
+	}
+#else
 	sd_spi_deselect();
+#endif
 	
 	/* Clock out at least 74 cycles with no data, so the SD card can 
 	 * initialize itself. */
@@ -245,27 +380,34 @@ void sd_spi_init(void) {
 }
 
 void sd_spi_send(uint8_t data) {
-	volatile uint8_t dummy;
-
-	/* Put the data in the shift register */
-	S0SPDR = data;
-	/* Wait until the transfer complete flag clears */
-	while ((S0SPSR & (1<<7)) != (1<<7))
-		;
-	/* Read S0SPDR to clear the status register */
-	dummy = S0SPDR;
+	sd_spi_exchange(data);
 }
 
 uint8_t sd_spi_receive(void) {
+	uint8_t data;
+
 	sd_spi_select();
 	/* Send a dummy byte */
-	S0SPDR = 0xFF;
-	/* Wait until the transfer complete flag clears */
-	while ((S0SPSR & (1<<7)) != (1<<7))
-		;
+	data = sd_spi_exchange(0xFF);
 	sd_spi_deselect();
-	/* Read the data clocked in */
-	return S0SPDR;
+
+	return data;
+}
+
+/* The burst functions stream bytes back to back and leave the chip
+ * select alone: the caller selects the card once for a whole command/data
+ * phase and deselects it at the end. */
+
+void sd_spi_transfer(const uint8_t *tx, uint8_t *rx, int len) {
+	uint8_t data;
+	int i;
+
+	/* A null tx sends dummy bytes, a null rx discards what comes in */
+	for (i = 0; i < len; i++) {
+		data = sd_spi_exchange((tx != 0) ? tx[i] : 0xFF);
+		if (rx != 0)
+			rx[i] = data;
+	}
 }
 
 void sd_spi_delay_clocks(void) {
@@ -314,17 +456,121 @@ uint16_t sd_crc16_bits(uint8_t data, uint16_t seed) {
 	return seed;
 }
 
-uint16_t sd_crc16_data(const uint8_t *data, int dataLen) {
-	int i;
-	uint16_t seed = 0;
+#if SD_CRC16_MODE != SD_CRC16_BITWISE
+
+/* CRC16-CCITT (x^16 + x^12 + x^5 + 1) of every byte value with a zero
+ * seed, i.e. sd_crc16_bits(i, 0). */
+static const uint16_t sd_crc16_table[256] = {
+	0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+	0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF,
+	0x1231, 0x0210, 0x3273, 0x2252, 0x52B5, 0x4294, 0x72F7, 0x62D6,
+	0x9339, 0x8318, 0xB37B, 0xA35A, 0xD3BD, 0xC39C, 0xF3FF, 0xE3DE,
+	0x2462, 0x3443, 0x0420, 0x1401, 0x64E6, 0x74C7, 0x44A4, 0x5485,
+	0xA56A, 0xB54B, 0x8528, 0x9509, 0xE5EE, 0xF5CF, 0xC5AC, 0xD58D,
+	0x3653, 0x2672, 0x1611, 0x0630, 0x76D7, 0x66F6, 0x5695, 0x46B4,
+	0xB75B, 0xA77A, 0x9719, 0x8738, 0xF7DF, 0xE7FE, 0xD79D, 0xC7BC,
+	0x48C4, 0x58E5, 0x6886, 0x78A7, 0x0840, 0x1861, 0x2802, 0x3823,
+	0xC9CC, 0xD9ED, 0xE98E, 0xF9AF, 0x8948, 0x9969, 0xA90A, 0xB92B,
+	0x5AF5, 0x4AD4, 0x7AB7, 0x6A96, 0x1A71, 0x0A50, 0x3A33, 0x2A12,
+	0xDBFD, 0xCBDC, 0xFBBF, 0xEB9E, 0x9B79, 0x8B58, 0xBB3B, 0xAB1A,
+	0x6CA6, 0x7C87, 0x4CE4, 0x5CC5, 0x2C22, 0x3C03, 0x0C60, 0x1C41,
+	0xEDAE, 0xFD8F, 0xCDEC, 0xDDCD, 0xAD2A, 0xBD0B, 0x8D68, 0x9D49,
+	0x7E97, 0x6EB6, 0x5ED5, 0x4EF4, 0x3E13, 0x2E32, 0x1E51, 0x0E70,
+	0xFF9F, 0xEFBE, 0xDFDD, 0xCFFC, 0xBF1B, 0xAF3A, 0x9F59, 0x8F78,
+	0x9188, 0x81A9, 0xB1CA, 0xA1EB, 0xD10C, 0xC12D, 0xF14E, 0xE16F,
+	0x1080, 0x00A1, 0x30C2, 0x20E3, 0x5004, 0x4025, 0x7046, 0x6067,
+	0x83B9, 0x9398, 0xA3FB, 0xB3DA, 0xC33D, 0xD31C, 0xE37F, 0xF35E,
+	0x02B1, 0x1290, 0x22F3, 0x32D2, 0x4235, 0x5214, 0x6277, 0x7256,
+	0xB5EA, 0xA5CB, 0x95A8, 0x8589, 0xF56E, 0xE54F, 0xD52C, 0xC50D,
+	0x34E2, 0x24C3, 0x14A0, 0x0481, 0x7466, 0x6447, 0x5424, 0x4405,
+	0xA7DB, 0xB7FA, 0x8799, 0x97B8, 0xE75F, 0xF77E, 0xC71D, 0xD73C,
+	0x26D3, 0x36F2, 0x0691, 0x16B0, 0x6657, 0x7676, 0x4615, 0x5634,
+	0xD94C, 0xC96D, 0xF90E, 0xE92F, 0x99C8, 0x89E9, 0xB98A, 0xA9AB,
+	0x5844, 0x4865, 0x7806, 0x6827, 0x18C0, 0x08E1, 0x3882, 0x28A3,
+	0xCB7D, 0xDB5C, 0xEB3F, 0xFB1E, 0x8BF9, 0x9BD8, 0xABBB, 0xBB9A,
+	0x4A75, 0x5A54, 0x6A37, 0x7A16, 0x0AF1, 0x1AD0, 0x2AB3, 0x3A92,
+	0xFD2E, 0xED0F, 0xDD6C, 0xCD4D, 0xBDAA, 0xAD8B, 0x9DE8, 0x8DC9,
+	0x7C26, 0x6C07, 0x5C64, 0x4C45, 0x3CA2, 0x2C83, 0x1CE0, 0x0CC1,
+	0xEF1F, 0xFF3E, 0xCF5D, 0xDF7C, 0xAF9B, 0xBFBA, 0x8FD9, 0x9FF8,
+	0x6E17, 0x7E36, 0x4E55, 0x5E74, 0x2E93, 0x3EB2, 0x0ED1, 0x1EF0
+};
 
-	for (i = 0; i < dataLen; i++) {
+#endif
+
+#if SD_CRC16_MODE == SD_CRC16_SLICE4 || SD_CRC16_MODE == SD_CRC16_SLICE8
+
+/* Slicing tables: sd_crc16_slice[k][i] is the CRC of byte i followed by
+ * k zero bytes. They are derived from sd_crc16_table on first use and
+ * kept in RAM, which has no flash wait states on the LPC21xx. */
+static uint16_t sd_crc16_slice[SD_CRC16_MODE][256];
+static int sd_crc16_slice_ready;
+
+static void sd_crc16_slice_init(void) {
+	int i, k;
+	uint16_t crc;
+
+	for (i = 0; i < 256; i++) {
+		crc = sd_crc16_table[i];
+		sd_crc16_slice[0][i] = crc;
+		for (k = 1; k < SD_CRC16_MODE; k++) {
+			/* Push one more zero byte through the CRC */
+			crc = (crc << 8) ^ sd_crc16_table[crc >> 8];
+			sd_crc16_slice[k][i] = crc;
+		}
+	}
+	sd_crc16_slice_ready = 1;
+}
+
+#endif
+
+uint16_t sd_crc16_update(uint16_t seed, const uint8_t *data, int dataLen) {
+	int i = 0;
+
+#if SD_CRC16_MODE == SD_CRC16_SLICE4 || SD_CRC16_MODE == SD_CRC16_SLICE8
+	if (!sd_crc16_slice_ready)
+		sd_crc16_slice_init();
+
+	/* Fold SD_CRC16_MODE bytes per iteration: the two bytes that overlap
+	 * the seed are XOR'd into it, every byte then indexes the table that
+	 * accounts for the number of bytes still following it. */
+	for (; i + SD_CRC16_MODE <= dataLen; i += SD_CRC16_MODE) {
+		seed ^= (data[i] << 8) | data[i+1];
+	#if SD_CRC16_MODE == SD_CRC16_SLICE8
+		seed = sd_crc16_slice[7][seed >> 8] ^ sd_crc16_slice[6][seed & 0xFF] ^
+			sd_crc16_slice[5][data[i+2]] ^ sd_crc16_slice[4][data[i+3]] ^
+			sd_crc16_slice[3][data[i+4]] ^ sd_crc16_slice[2][data[i+5]] ^
+			sd_crc16_slice[1][data[i+6]] ^ sd_crc16_slice[0][data[i+7]];
+	#else
+		seed = sd_crc16_slice[3][seed >> 8] ^ sd_crc16_slice[2][seed & 0xFF] ^
+			sd_crc16_slice[1][data[i+2]] ^ sd_crc16_slice[0][data[i+3]];
+	#endif
+	}
+#endif
+
+	/* Remaining bytes (or all of them) one at a time */
+	for (; i < dataLen; i++) {
+	#if SD_CRC16_MODE == SD_CRC16_BITWISE
 		seed = sd_crc16_bits(data[i], seed);
+	#else
+		seed = (seed << 8) ^ sd_crc16_table[(seed >> 8) ^ data[i]];
+	#endif
 	}
 
 	return seed;
 }
 
+uint16_t sd_crc16_data(const uint8_t *data, int dataLen) {
+	return sd_crc16_update(0, data, dataLen);
+}
+
+/* Single byte CRC16 step for the fused transfer loops below */
+#if SD_CRC16_MODE == SD_CRC16_BITWISE
+#define sd_crc16_byte(seed, data)	sd_crc16_bits((data), (seed))
+#else
+#define sd_crc16_byte(seed, data)	\
+	((uint16_t)(((seed) << 8) ^ sd_crc16_table[((seed) >> 8) ^ (data)]))
+#endif
+
 uint8_t sd_crc7_bits(uint8_t data, uint8_t seed) {
 	int i, feedback;
 
@@ -360,12 +606,50 @@ uint8_t sd_crc7_bits(uint8_t data, uint8_t seed) {
 	return (seed & 0x7F);
 }
 
+/* CRC7 (x^7 + x^3 + 1) of every byte value with a zero seed, i.e.
+ * sd_crc7_bits(i, 0). The CRC7 of a byte with seed s is
+ * sd_crc7_table[(s << 1) ^ byte]. */
+static const uint8_t sd_crc7_table[256] = {
+	0x00, 0x09, 0x12, 0x1B, 0x24, 0x2D, 0x36, 0x3F,
+	0x48, 0x41, 0x5A, 0x53, 0x6C, 0x65, 0x7E, 0x77,
+	0x19, 0x10, 0x0B, 0x02, 0x3D, 0x34, 0x2F, 0x26,
+	0x51, 0x58, 0x43, 0x4A, 0x75, 0x7C, 0x67, 0x6E,
+	0x32, 0x3B, 0x20, 0x29, 0x16, 0x1F, 0x04, 0x0D,
+	0x7A, 0x73, 0x68, 0x61, 0x5E, 0x57, 0x4C, 0x45,
+	0x2B, 0x22, 0x39, 0x30, 0x0F, 0x06, 0x1D, 0x14,
+	0x63, 0x6A, 0x71, 0x78, 0x47, 0x4E, 0x55, 0x5C,
+	0x64, 0x6D, 0x76, 0x7F, 0x40, 0x49, 0x52, 0x5B,
+	0x2C, 0x25, 0x3E, 0x37, 0x08, 0x01, 0x1A, 0x13,
+	0x7D, 0x74, 0x6F, 0x66, 0x59, 0x50, 0x4B, 0x42,
+	0x35, 0x3C, 0x27, 0x2E, 0x11, 0x18, 0x03, 0x0A,
+	0x56, 0x5F, 0x44, 0x4D, 0x72, 0x7B, 0x60, 0x69,
+	0x1E, 0x17, 0x0C, 0x05, 0x3A, 0x33, 0x28, 0x21,
+	0x4F, 0x46, 0x5D, 0x54, 0x6B, 0x62, 0x79, 0x70,
+	0x07, 0x0E, 0x15, 0x1C, 0x23, 0x2A, 0x31, 0x38,
+	0x41, 0x48, 0x53, 0x5A, 0x65, 0x6C, 0x77, 0x7E,
+	0x09, 0x00, 0x1B, 0x12, 0x2D, 0x24, 0x3F, 0x36,
+	0x58, 0x51, 0x4A, 0x43, 0x7C, 0x75, 0x6E, 0x67,
+	0x10, 0x19, 0x02, 0x0B, 0x34, 0x3D, 0x26, 0x2F,
+	0x73, 0x7A, 0x61, 0x68, 0x57, 0x5E, 0x45, 0x4C,
+	0x3B, 0x32, 0x29, 0x20, 0x1F, 0x16, 0x0D, 0x04,
+	0x6A, 0x63, 0x78, 0x71, 0x4E, 0x47, 0x5C, 0x55,
+	0x22, 0x2B, 0x30, 0x39, 0x06, 0x0F, 0x14, 0x1D,
+	0x25, 0x2C, 0x37, 0x3E, 0x01, 0x08, 0x13, 0x1A,
+	0x6D, 0x64, 0x7F, 0x76, 0x49, 0x40, 0x5B, 0x52,
+	0x3C, 0x35, 0x2E, 0x27, 0x18, 0x11, 0x0A, 0x03,
+	0x74, 0x7D, 0x66, 0x6F, 0x50, 0x59, 0x42, 0x4B,
+	0x17, 0x1E, 0x05, 0x0C, 0x33, 0x3A, 0x21, 0x28,
+	0x5F, 0x56, 0x4D, 0x44, 0x7B, 0x72, 0x69, 0x60,
+	0x0E, 0x07, 0x1C, 0x15, 0x2A, 0x23, 0x38, 0x31,
+	0x46, 0x4F, 0x54, 0x5D, 0x62, 0x6B, 0x70, 0x79
+};
+
 uint8_t sd_crc7_packet(const uint8_t *data, int dataLen) {
 	int i;
 	uint8_t seed = 0;
 
 	for (i = 0; i < dataLen; i++)	
-		seed = sd_crc7_bits(data[i], seed);
+		seed = sd_crc7_table[(uint8_t)(seed << 1) ^ data[i]];
 
 	/* Append the end 1 bit */
 	seed <<= 1;
@@ -374,15 +658,72 @@ uint8_t sd_crc7_packet(const uint8_t *data, int dataLen) {
 	return seed;
 }
 
-void sd_spi_command_send(uint8_t command, uint32_t argument) {
-	uint8_t packet[6];
+/* Complete frames, CRC7 included, for the commands that always go out
+ * with the same argument. These are the ones issued in polling loops
+ * (CMD55/ACMD41 and CMD1 during sd_init(), CMD13, CMD12), so they are
+ * sent as a plain 6-byte burst. The CRC7s were generated with
+ * sd_crc7_packet(). */
+static const uint8_t sd_frame_cmd0[6] =		{0x40, 0x00, 0x00, 0x00, 0x00, 0x95};
+static const uint8_t sd_frame_cmd1[6] =		{0x41, 0x00, 0x00, 0x00, 0x00, 0xF9};
+static const uint8_t sd_frame_cmd1_hcs[6] =	{0x41, 0x40, 0x00, 0x00, 0x00, 0x6B};
+/* Argument is 2.7-3.6V supply voltage | SD_CHECK_PATTERN */
+static const uint8_t sd_frame_cmd8[6] =		{0x48, 0x00, 0x00, 0x01, 0x55, 0x75};
+static const uint8_t sd_frame_cmd12[6] =	{0x4C, 0x00, 0x00, 0x00, 0x00, 0x61};
+static const uint8_t sd_frame_cmd13[6] =	{0x4D, 0x00, 0x00, 0x00, 0x00, 0x0D};
+static const uint8_t sd_frame_cmd38[6] =	{0x66, 0x00, 0x00, 0x00, 0x00, 0xA5};
+static const uint8_t sd_frame_cmd55[6] =	{0x77, 0x00, 0x00, 0x00, 0x00, 0x65};
+static const uint8_t sd_frame_cmd58[6] =	{0x7A, 0x00, 0x00, 0x00, 0x00, 0xFD};
+static const uint8_t sd_frame_cmd59_off[6] =	{0x7B, 0x00, 0x00, 0x00, 0x00, 0x91};
+static const uint8_t sd_frame_cmd59_on[6] =	{0x7B, 0x00, 0x00, 0x00, 0x01, 0x83};
+static const uint8_t sd_frame_acmd41[6] =	{0x69, 0x00, 0x00, 0x00, 0x00, 0xE5};
+static const uint8_t sd_frame_acmd41_hcs[6] =	{0x69, 0x40, 0x00, 0x00, 0x00, 0x77};
+
+#if SD_CHECK_PATTERN != 0x55
+#error "sd_frame_cmd8 needs to be regenerated for the new SD_CHECK_PATTERN."
+#endif
+
+/* Called on error tokens and R1 error flags. With CRC off they may well
+ * be corrupted transfers going unnoticed, so CRC is turned back on: right
+ * away on the host side, and on the card with the next command, since
+ * this may be in the middle of a transfer. */
+static void sd_crc_trouble(void) {
+	if (sd_card->crc_enabled)
+		return;
+
+	sd_debug_print("* SD -- Errors with CRC off, turning CRC back on.", 0, 0);
+	sd_card->crc_enabled = 1;
+	sd_card->crc_restore = 1;
+	sd_card->crc_fallbacks++;
+}
+
+/* Turns the card's CRC checking back on ahead of the command about to be
+ * sent, if sd_crc_trouble() asked for it. Chip select must be low. */
+static void sd_spi_crc_restore(void) {
 	int i;
 
-	sd_spi_select();
+	if (!sd_card->crc_restore)
+		return;
+
+	sd_card->crc_restore = 0;
+	SD_STATS_COMMAND(SD_CMD59);
+	sd_spi_transfer(sd_frame_cmd59_on, 0, 6);
+	for (i = 0; i < SD_SPI_CMD_READ_ATTEMPTS; i++) {
+		if (sd_spi_exchange(0xFF) != 0xFF)
+			break;
+	}
+	sd_spi_exchange(0xFF);
+}
+
+static void sd_spi_command_frame(uint8_t command, uint32_t argument) {
+	uint8_t packet[6];
+
+	sd_spi_crc_restore();
 
 	/* Begin to transmit the 6-byte packet:
 	 * 1 byte command, 4 bytes argument, 1 byte CRC */
 
+	SD_STATS_COMMAND(command);
+
 	/* Encode 01cc cccc, where c is the 6-bit command */
 	packet[0] = 0x40 | (command&0x3F);
 	/* Encode most significant to least significant argument bytes */
@@ -393,26 +734,58 @@ void sd_spi_command_send(uint8_t command, uint32_t argument) {
 	/* Calculate the CRC7 */
 	packet[5] = sd_crc7_packet(packet, 5);
 
-	for (i = 0; i < 6; i++)
-		sd_spi_send(packet[i]);
-	
-	sd_spi_deselect();
+	sd_spi_transfer(packet, 0, 6);
 }
 
-void sd_spi_command_response(uint8_t *response, int responseLength) {
+static void sd_spi_response(uint8_t *response, int responseLength) {
 	int i;
 
 	/* Read the response */
 
 	/* Wait until we start getting some data..*/
 	for (i = 0; i < SD_SPI_CMD_READ_ATTEMPTS; i++) {
-		response[0] = sd_spi_receive();
+		response[0] = sd_spi_exchange(0xFF);
 		if (response[0] != 0xFF)
 			break;
 	}
-	for (i = 0; i < (responseLength-1); i++) {
-		response[i+1] = sd_spi_receive();
+	sd_spi_transfer(0, response+1, responseLength-1);
+
+	/* Illegal command, CRC, erase sequence, address or parameter error.
+	 * No response at all (0xFF) is a card that isn't there or is still
+	 * busy, not a corrupted transfer. */
+	if (response[0] != 0xFF && (response[0] & 0x7C))
+		sd_crc_trouble();
+}
+
+static uint8_t sd_spi_data_token(void) {
+	uint8_t token = 0xFF;
+	int i;
+
+	/* Find the data block start byte */
+	for (i = 0; i < SD_SPI_DATA_READ_ATTEMPTS; i++) {
+		token = sd_spi_exchange(0xFF);
+		/* Check if we get the start of a block or a data read error */
+		if (token == SD_SPI_DATA_BLOCK_START ||
+		   (token & SD_SPI_DATA_ERROR_TOKEN_MASK) == 0x00)
+			break;
 	}
+
+	if ((token & SD_SPI_DATA_ERROR_TOKEN_MASK) == 0x00)
+		sd_crc_trouble();
+
+	return token;
+}
+
+void sd_spi_command_send(uint8_t command, uint32_t argument) {
+	sd_spi_select();
+	sd_spi_command_frame(command, argument);
+	sd_spi_deselect();
+}
+
+void sd_spi_command_response(uint8_t *response, int responseLength) {
+	sd_spi_select();
+	sd_spi_response(response, responseLength);
+	sd_spi_deselect();
 }
 	
 void sd_spi_command(uint8_t command, uint32_t argument, int responseLength, uint8_t *response) {
@@ -421,36 +794,473 @@ void sd_spi_command(uint8_t command, uint32_t argument, int responseLength, uint
 	sd_spi_delay_clocks();
 }
 
+static void sd_spi_command_send_fixed(const uint8_t *frame) {
+	sd_spi_select();
+	/* A CMD12 cuts a transfer short, CMD59 has to wait until after it */
+	if (frame != sd_frame_cmd12)
+		sd_spi_crc_restore();
+	SD_STATS_COMMAND(frame[0]);
+	sd_spi_transfer(frame, 0, 6);
+	sd_spi_deselect();
+}
+
+static void sd_spi_command_fixed(const uint8_t *frame, int responseLength, uint8_t *response) {
+	sd_spi_command_send_fixed(frame);
+	sd_spi_command_response(response, responseLength);
+	sd_spi_delay_clocks();
+}
+
+/* Turns CRC checking on or off, on the card with CMD59 and on the host
+ * for data blocks. Off saves the CRC16 work on every block, at the cost
+ * of corruption going unnoticed; errors seen while off turn it back on. */
+int sd_set_crc(int enable) {
+	uint8_t response[1];
+
+	sd_card->crc_restore = 0;
+	sd_spi_command_fixed(enable ? sd_frame_cmd59_on : sd_frame_cmd59_off, SD_CMD59_RL, response);
+	if (response[0] & 0x7C) {
+		sd_debug_print("* SD -- Failure: CMD59. Error setting CRC option. Response: ", response, SD_CMD59_RL);
+		return SD_ERROR_CRC_OPTION;
+	}
+
+	sd_card->crc_enabled = enable;
+
+	return 0;
+}
+
+int sd_get_crc(void) {
+	return sd_card->crc_enabled;
+}
+
+uint32_t sd_get_crc_fallbacks(void) {
+	return sd_card->crc_fallbacks;
+}
+
+/* Points the sd_* functions at another card on the bus, switching the
+ * SPI clock to the one the card was set up with. No transfer may be left
+ * open on the card selected before. */
+int sd_select_card(int card) {
+	uint32_t hz;
+
+	if (card < 0 || card >= SD_NUM_CARDS)
+		return SD_ERROR_CARD_INDEX;
+
+	/* The driver leaves the card it talks to selected between commands,
+	 * hand that over to the new card */
+	sd_spi_deselect();
+	sd_card_index = card;
+	sd_card = &sd_cards[card];
+	sd_spi_select();
+
+	hz = (sd_card->spi_clock != 0) ? sd_card->spi_clock : SD_SPI_INIT_CLOCK;
+	if (hz != sd_bus_clock)
+		sd_bus_clock = sd_spi_set_clock(hz);
+
+	return 0;
+}
+
+int sd_get_card(void) {
+	return sd_card_index;
+}
+
+void sd_set_idle_hook(void (*hook)(void)) {
+	sd_idle_hook = hook;
+}
+
+int sd_busy_poll(void) {
+	/* One probe, non-zero while the card is still busy */
+	return (sd_spi_receive() != 0xFF);
+}
+
+int sd_busy_wait(uint32_t timeout_ms) {
+	uint32_t probes;
+	int retVal;
+
+	/* The card holds DO low while it is busy programming or erasing and
+	 * releases it once done. Every probe clocks 8 bits, so the deadline
+	 * is counted in probes at the current SPI clock. Time spent in the
+	 * idle hook only makes the real wait longer, never shorter. */
+	probes = ((sd_card->spi_clock != 0) ? sd_card->spi_clock : SD_SPI_INIT_CLOCK) / 8000;
+	probes *= timeout_ms;
+
+	/* The card stays selected for the whole wait, like a burst, and is
+	 * only deselected around the idle hook */
+	SD_STATS_BEGIN(SD_STATS_BUSY);
+	sd_spi_select();
+	for (;;) {
+		if (sd_spi_exchange(0xFF) == 0xFF) {
+			retVal = 0;
+			break;
+		}
+		if (probes-- == 0) {
+			retVal = -1;
+			break;
+		}
+		/* Let the application do something useful in the meantime,
+		 * the card is deselected so the bus is free */
+		if (sd_idle_hook != 0) {
+			sd_spi_deselect();
+			sd_idle_hook();
+			sd_spi_select();
+		}
+	}
+	sd_spi_deselect();
+	SD_STATS_END(SD_STATS_BUSY);
+
+	return retVal;
+}
+
+/******************************************************************************
+ *** SPI bus backends                                                       ***
+ ******************************************************************************/
+
+#if SD_SPI_BUS == SD_SPI_BUS_SSP
+
+/* SSP Status Register bits (SSPSR), see LPC214x 13.6.4 */
+#define SSPSR_TNF	(1<<1)		/* Transmit FIFO Not Full */
+#define SSPSR_RNE	(1<<2)		/* Receive FIFO Not Empty */
+#define SSPSR_BSY	(1<<4)		/* Busy */
+/* SSP Control Register 1 bits (SSPCR1) */
+#define SSPCR1_SSE	(1<<1)		/* SSP Enable */
+/* Depth of the SSP transmit and receive FIFOs, in frames */
+#define SSP_FIFO_DEPTH	8
+
+static void sd_spi_bus_init(void) {
+	volatile uint8_t dummy;
+
+	/* Enable SCK1, MISO1 and MOSI1 on P0.17-P0.19 for SSP use,
+	 * but leave SSEL1 (P0.20) as a GPIO. */
+	PINSEL1 &= ~((3<<2)|(3<<4)|(3<<6));
+	PINSEL1 |= ((2<<2)|(2<<4)|(2<<6));
+
+	/* Disable the SSP while it is being configured */
+	SSPCR1 = 0;
+	/* 8 bits data, SPI frame format, CPOL = 0, CPHA = 0 */
+	SSPCR0 = 0x07;
+	/* No interrupts, we poll the FIFOs */
+	SSPIMSC = 0;
+	/* Enable the SSP as a master */
+	SSPCR1 = SSPCR1_SSE;
+
+	/* Drain anything left in the receive FIFO */
+	while (SSPSR & SSPSR_RNE)
+		dummy = SSPDR;
+}
+
+uint32_t sd_spi_set_clock(uint32_t hz) {
+	uint32_t divider, best, cpsdvsr, scr;
+
+	/* SCK1 = PCLK / (CPSDVSR * (SCR+1)), CPSDVSR even and >= 2. Find the
+	 * smallest total divider that doesn't exceed the requested rate. */
+	divider = (SD_PCLK + hz - 1) / hz;
+	if (divider < 2)
+		divider = 2;
+
+	best = 0;
+	for (cpsdvsr = 2; cpsdvsr <= 254; cpsdvsr += 2) {
+		scr = (divider + cpsdvsr - 1) / cpsdvsr;
+		if (scr > 256)
+			continue;
+		if (best == 0 || cpsdvsr*scr < best) {
+			best = cpsdvsr*scr;
+			SSPCPSR = cpsdvsr;
+			SSPCR0 = (SSPCR0 & 0xFF) | ((scr-1) << 8);
+		}
+		/* Can't do better than an exact match */
+		if (best == divider)
+			break;
+	}
+
+	return SD_PCLK / best;
+}
+
+static uint8_t sd_spi_exchange(uint8_t data) {
+	/* Queue the frame and wait for the one clocked in with it */
+	while (!(SSPSR & SSPSR_TNF))
+		;
+	SSPDR = data;
+	while (!(SSPSR & SSPSR_RNE))
+		;
+	return SSPDR;
+}
+
+/* The block functions keep the transmit FIFO topped up so SCK1 never
+ * idles between frames, but never run more than a FIFO's depth ahead of
+ * the receiver so the receive FIFO can't overrun. */
+
+void sd_spi_receive_block(uint8_t *data, int dataLen) {
+	int tx, rx;
+
+	for (tx = 0, rx = 0; rx < dataLen; ) {
+		while (tx < dataLen && (tx - rx) < SSP_FIFO_DEPTH && (SSPSR & SSPSR_TNF)) {
+			SSPDR = 0xFF;
+			tx++;
+		}
+		while (rx < tx && (SSPSR & SSPSR_RNE))
+			data[rx++] = SSPDR;
+	}
+}
+
+void sd_spi_send_block(const uint8_t *data, int dataLen) {
+	volatile uint8_t dummy;
+	int tx, rx;
+
+	for (tx = 0, rx = 0; rx < dataLen; ) {
+		while (tx < dataLen && (tx - rx) < SSP_FIFO_DEPTH && (SSPSR & SSPSR_TNF))
+			SSPDR = data[tx++];
+		/* Discard the frames clocked in */
+		while (rx < tx && (SSPSR & SSPSR_RNE)) {
+			dummy = SSPDR;
+			rx++;
+		}
+	}
+}
+
+uint16_t sd_spi_send_block_crc16(uint16_t seed, const uint8_t *data, int dataLen) {
+	volatile uint8_t dummy;
+	uint16_t crc16 = seed;
+	int tx, rx;
+
+	for (tx = 0, rx = 0; rx < dataLen; ) {
+		while (tx < dataLen && (tx - rx) < SSP_FIFO_DEPTH && (SSPSR & SSPSR_TNF)) {
+			SSPDR = data[tx];
+			/* CRC the byte while the FIFO shifts it out */
+			crc16 = sd_crc16_byte(crc16, data[tx]);
+			tx++;
+		}
+		/* Discard the frames clocked in */
+		while (rx < tx && (SSPSR & SSPSR_RNE)) {
+			dummy = SSPDR;
+			rx++;
+		}
+	}
+
+	return crc16;
+}
+
+uint16_t sd_spi_receive_block_crc16(uint16_t seed, uint8_t *data, int dataLen) {
+	uint16_t crc16 = seed;
+	int tx, rx;
+
+	for (tx = 0, rx = 0; rx < dataLen; ) {
+		while (tx < dataLen && (tx - rx) < SSP_FIFO_DEPTH && (SSPSR & SSPSR_TNF)) {
+			SSPDR = 0xFF;
+			tx++;
+		}
+		/* CRC what has arrived while the rest is still shifting in */
+		while (rx < tx && (SSPSR & SSPSR_RNE)) {
+			data[rx] = SSPDR;
+			crc16 = sd_crc16_byte(crc16, data[rx]);
+			rx++;
+		}
+	}
+
+	return crc16;
+}
+
+#elif SD_SPI_BUS == SD_SPI_BUS_PORT
+
+/* The application's port does the actual work, one byte at a time */
+
+static void sd_spi_bus_init(void) {
+	sd_port_init();
+}
+
+uint32_t sd_spi_set_clock(uint32_t hz) {
+	return sd_port_set_clock(hz);
+}
+
+static uint8_t sd_spi_exchange(uint8_t data) {
+	return sd_port_exchange(data);
+}
+
+void sd_spi_receive_block(uint8_t *data, int dataLen) {
+	int i;
+
+	for (i = 0; i < dataLen; i++)
+		data[i] = sd_port_exchange(0xFF);
+}
+
+void sd_spi_send_block(const uint8_t *data, int dataLen) {
+	int i;
+
+	for (i = 0; i < dataLen; i++)
+		sd_port_exchange(data[i]);
+}
+
+uint16_t sd_spi_send_block_crc16(uint16_t seed, const uint8_t *data, int dataLen) {
+	uint16_t crc16 = seed;
+	int i;
+
+	for (i = 0; i < dataLen; i++) {
+		sd_port_exchange(data[i]);
+		crc16 = sd_crc16_byte(crc16, data[i]);
+	}
+
+	return crc16;
+}
+
+uint16_t sd_spi_receive_block_crc16(uint16_t seed, uint8_t *data, int dataLen) {
+	uint16_t crc16 = seed;
+	int i;
+
+	for (i = 0; i < dataLen; i++) {
+		data[i] = sd_port_exchange(0xFF);
+		crc16 = sd_crc16_byte(crc16, data[i]);
+	}
+
+	return crc16;
+}
+
+#else
+
+static void sd_spi_bus_init(void) {
+	/* Enable SCK0, MISO0, and MOSI0 for SPI0 bus use,
+	 * but declare SSEL0 as a GPIO for now. */
+	PINSEL0 |= ((1<<8)|(1<<10)|(1<<12));
+	PINSEL0 &= ~((1<<9)|(1<<11)|(1<<13)|(1<<15)|(1<<14));
+
+	/* Set the SPI Control Register
+	 * 8 bits data, CPOL = 0, CPHA = 0, Master = 1,
+	 * LSBF = 0 (MSB first), SPIE = 0 */
+	S0SPCR = (1<<5);
+}
+
+uint32_t sd_spi_set_clock(uint32_t hz) {
+	uint32_t divider;
+
+	/* SCK0 = PCLK / S0SPCCR, S0SPCCR even and >= 8.
+	 * e.g. PCLK = 60MHz, SPI Rate = 400KHz = 60/150, S0SPCCR = 150 */
+	divider = (SD_PCLK + hz - 1) / hz;
+	divider = (divider + 1) & ~1;
+	if (divider < 8)
+		divider = 8;
+	if (divider > 254)
+		divider = 254;
+	S0SPCCR = divider;
+
+	return SD_PCLK / divider;
+}
+
+static uint8_t sd_spi_exchange(uint8_t data) {
+	/* Put the data in the shift register */
+	S0SPDR = data;
+	/* Wait until the transfer complete flag clears */
+	while ((S0SPSR & (1<<7)) != (1<<7))
+		;
+	/* Read the data clocked in */
+	return S0SPDR;
+}
+
+void sd_spi_receive_block(uint8_t *data, int dataLen) {
+	int i;
+
+	if (dataLen <= 0)
+		return;
+
+	/* Send the first dummy byte */
+	S0SPDR = 0xFF;
+	for (i = 0; i < dataLen-1; i++) {
+		/* Wait until the transfer complete flag clears */
+		while ((S0SPSR & (1<<7)) != (1<<7))
+			;
+		/* Read the data clocked in and immediately clock in the next byte */
+		data[i] = S0SPDR;
+		S0SPDR = 0xFF;
+	}
+	while ((S0SPSR & (1<<7)) != (1<<7))
+		;
+	data[i] = S0SPDR;
+}
+
+void sd_spi_send_block(const uint8_t *data, int dataLen) {
+	volatile uint8_t dummy;
+	int i;
+
+	for (i = 0; i < dataLen; i++) {
+		S0SPDR = data[i];
+		/* Wait until the transfer complete flag clears */
+		while ((S0SPSR & (1<<7)) != (1<<7))
+			;
+		/* Read S0SPDR to clear the status register */
+		dummy = S0SPDR;
+	}
+}
+
+uint16_t sd_spi_send_block_crc16(uint16_t seed, const uint8_t *data, int dataLen) {
+	volatile uint8_t dummy;
+	uint16_t crc16 = seed;
+	int i;
+
+	for (i = 0; i < dataLen; i++) {
+		/* Start shifting the byte out... */
+		S0SPDR = data[i];
+		/* ...and CRC it while it is on the wire */
+		crc16 = sd_crc16_byte(crc16, data[i]);
+		/* Wait until the transfer complete flag clears */
+		while ((S0SPSR & (1<<7)) != (1<<7))
+			;
+		/* Read S0SPDR to clear the status register */
+		dummy = S0SPDR;
+	}
+
+	return crc16;
+}
+
+uint16_t sd_spi_receive_block_crc16(uint16_t seed, uint8_t *data, int dataLen) {
+	uint16_t crc16 = seed;
+	int i;
+
+	if (dataLen <= 0)
+		return crc16;
+
+	/* Send the first dummy byte */
+	S0SPDR = 0xFF;
+	for (i = 0; i < dataLen; i++) {
+		/* Wait until the transfer complete flag clears */
+		while ((S0SPSR & (1<<7)) != (1<<7))
+			;
+		/* Read the data clocked in */
+		data[i] = S0SPDR;
+		/* Clock in the next byte, and CRC this one while it shifts */
+		if (i+1 < dataLen)
+			S0SPDR = 0xFF;
+		crc16 = sd_crc16_byte(crc16, data[i]);
+	}
+
+	return crc16;
+}
+
+#endif
+
 /******************************************************************************
  *** Higher-level command interface functions                               ***
  ******************************************************************************/
 
 int sd_read_csd(void) {
-	uint8_t response[1];
+	uint8_t response[1], crc[2];
 	uint16_t crc16;
-	int i;
+
+	/* Hold the card selected for the whole command and data phase */
+	sd_spi_select();
 
 	/* Send the CSD command and receive the R1 response. */
-	sd_spi_command_send(SD_CMD9, 0x00);
-	sd_spi_command_response(response, SD_CMD9_RL);
+	sd_spi_command_frame(SD_CMD9, 0);
+	sd_spi_response(response, SD_CMD9_RL);
 
 	/* We have received R1, next up is the CSD and CRC
 	 * data: */
 
 	/* Find the data block start byte */
-	for (i = 0; i < SD_SPI_DATA_READ_ATTEMPTS; i++) {
-		sd_csd[0] = sd_spi_receive();
-		if (sd_csd[0] == SD_SPI_DATA_BLOCK_START)
-			break;
-	}
+	sd_spi_data_token();
 	/* Receive the 16-byte CSD */
-	for (i = 0; i < SD_CSD_LENGTH; i++)
-		sd_csd[i] = sd_spi_receive();
+	sd_spi_receive_block(sd_card->csd, SD_CSD_LENGTH);
 
 	/* Receive the CRC16 of the CSD */
-	crc16 = (sd_spi_receive() << 8);
-	crc16 |= sd_spi_receive();
-	
+	sd_spi_receive_block(crc, 2);
+	crc16 = (crc[0] << 8) | crc[1];
+
+	sd_spi_deselect();
 	sd_spi_delay_clocks();
 
 	/* Check the R1 response for errors */
@@ -460,8 +1270,9 @@ int sd_read_csd(void) {
 	}
 
 	/* Verify the CSD's data CRC */
-	if (sd_crc16_data(sd_csd, 16) != crc16) {
+	if (sd_crc16_data(sd_card->csd, 16) != crc16) {
 		sd_debug_print("* SD -- Failure: CMD9. CRC16 invalid on CSD data.", 0, 0);
+		SD_STATS_INC(crc_errors);
 		return SD_ERROR_GET_CSD_CRC;
 	}
 	
@@ -470,31 +1281,29 @@ int sd_read_csd(void) {
 }
 
 int sd_read_cid(void) {
-	uint8_t response[1];
+	uint8_t response[1], crc[2];
 	uint16_t crc16;
-	int i;
+
+	/* Hold the card selected for the whole command and data phase */
+	sd_spi_select();
 
 	/* Send the CID command and receive the R1 response. */
-	sd_spi_command_send(SD_CMD10, 0x00);
-	sd_spi_command_response(response, SD_CMD10_RL);
+	sd_spi_command_frame(SD_CMD10, 0);
+	sd_spi_response(response, SD_CMD10_RL);
 
 	/* We have received R1, next up is the CID and CRC
 	 * data: */
 
 	/* Find the data block start byte */
-	for (i = 0; i < SD_SPI_DATA_READ_ATTEMPTS; i++) {
-		sd_cid[0] = sd_spi_receive();
-		if (sd_cid[0] == SD_SPI_DATA_BLOCK_START)
-			break;
-	}
+	sd_spi_data_token();
 	/* Receive the 16-byte CID */
-	for (i = 0; i < SD_CID_LENGTH; i++)
-		sd_cid[i] = sd_spi_receive();
+	sd_spi_receive_block(sd_card->cid, SD_CID_LENGTH);
 
 	/* Receive the CRC16 of the CID */
-	crc16 = (sd_spi_receive() << 8);
-	crc16 |= sd_spi_receive();
-	
+	sd_spi_receive_block(crc, 2);
+	crc16 = (crc[0] << 8) | crc[1];
+
+	sd_spi_deselect();
 	sd_spi_delay_clocks();
 
 	/* Check the R1 response for errors */
@@ -504,8 +1313,9 @@ int sd_read_cid(void) {
 	}
 
 	/* Verify the CID's data CRC */
-	if (sd_crc16_data(sd_cid, 16) != crc16) {
+	if (sd_crc16_data(sd_card->cid, 16) != crc16) {
 		sd_debug_print("* SD -- Failure: CMD10. CRC16 invalid on CID data.", 0, 0);
+		SD_STATS_INC(crc_errors);
 		return SD_ERROR_GET_CID_CRC;
 	}
 
@@ -513,83 +1323,181 @@ int sd_read_cid(void) {
 	return 0;
 }
 
-int sd_erase_blocks(uint32_t address_start, uint32_t address_end) {
+/* Sends CMD55 and an application command that answers with a data block,
+ * and receives the block. Returns 0, -1 if the card rejected the command
+ * or -2 if the block's CRC16 didn't check out. */
+static int sd_read_app_register(uint8_t command, int responseLength, uint8_t *data, int dataLen) {
+	uint8_t response[2], crc[2];
+	uint16_t crc16;
+
+	sd_spi_command_fixed(sd_frame_cmd55, SD_CMD55_RL, response);
+	if (response[0] & 0x7C)
+		return -1;
+
+	/* Hold the card selected for the whole command and data phase */
+	sd_spi_select();
+	sd_spi_command_frame(command, 0);
+	sd_spi_response(response, responseLength);
+	if (response[0] != 0x00) {
+		sd_spi_deselect();
+		sd_spi_delay_clocks();
+		return -1;
+	}
+
+	/* Find the data block start byte, then the data and its CRC16 */
+	sd_spi_data_token();
+	sd_spi_receive_block(data, dataLen);
+	sd_spi_receive_block(crc, 2);
+	crc16 = (crc[0] << 8) | crc[1];
+
+	sd_spi_deselect();
+	sd_spi_delay_clocks();
+
+	if (sd_crc16_data(data, dataLen) != crc16) {
+		SD_STATS_INC(crc_errors);
+		return -2;
+	}
+
+	return 0;
+}
+
+int sd_read_scr(void) {
+	int retVal;
+
+	retVal = sd_read_app_register(SD_ACMD51, SD_ACMD51_RL, sd_card->scr, SD_SCR_LENGTH);
+	if (retVal == -1) {
+		sd_debug_print("* SD -- Failure: ACMD51. Error receiving SCR.", 0, 0);
+		return SD_ERROR_GET_SCR;
+	}
+	if (retVal == -2) {
+		sd_debug_print("* SD -- Failure: ACMD51. CRC16 invalid on SCR data.", 0, 0);
+		return SD_ERROR_GET_SCR_CRC;
+	}
+
+	sd_debug_print("* SD -- Success: ACMD51. Retrieved card SCR: ", sd_card->scr, SD_SCR_LENGTH);
+	return 0;
+}
+
+int sd_read_sd_status(void) {
+	int retVal;
+
+	retVal = sd_read_app_register(SD_ACMD13, SD_ACMD13_RL, sd_card->ssr, SD_SSR_LENGTH);
+	if (retVal == -1) {
+		sd_debug_print("* SD -- Failure: ACMD13. Error receiving SD Status.", 0, 0);
+		return SD_ERROR_GET_SSR;
+	}
+	if (retVal == -2) {
+		sd_debug_print("* SD -- Failure: ACMD13. CRC16 invalid on SD Status data.", 0, 0);
+		return SD_ERROR_GET_SSR_CRC;
+	}
+
+	sd_debug_print("* SD -- Success: ACMD13. Retrieved SD Status.", 0, 0);
+	return 0;
+}
+
+int sd_erase_blocks_start(uint32_t address_start, uint32_t address_end) {
 	uint8_t response[5];
 
+	/* High capacity cards take block addresses, like for reads and writes */
+	if (sd_card->high_capacity) {
+		address_start = SD_BLOCK_DIV(address_start);
+		address_end = SD_BLOCK_DIV(address_end);
+	}
+
 	/* Note: SD uses CMD32 and CMD33 to define the erase region,
 	 * whereas MMC uses CMD35 and CMD36 to define the erase region. */
 
 	/* Send the erase address start command with our start address */
-	if (!sd_mmc) sd_spi_command(SD_CMD32, address_start, SD_CMD32_RL, response);
+	if (!sd_card->mmc) sd_spi_command(SD_CMD32, address_start, SD_CMD32_RL, response);
 		else sd_spi_command(SD_CMD35, address_start, SD_CMD35_RL, response);
 	if (response[0] != 0x00) {
 		if (response[0] & 0x40) {
-			if (!sd_mmc) sd_debug_print("* SD -- Failure: CMD32. Erase start address misaligned. Response: ", response, SD_CMD32_RL);
+			if (!sd_card->mmc) sd_debug_print("* SD -- Failure: CMD32. Erase start address misaligned. Response: ", response, SD_CMD32_RL);
 				else sd_debug_print("* SD -- Failure: CMD35. Erase start address misaligned. Response: ", response, SD_CMD35_RL);
 
 			return SD_ERROR_START_ADDR_MISALIGNED;
 		}
 		if (response[0] & 0x80) {
-			if (!sd_mmc) sd_debug_print("* SD -- Failure: CMD32. Erase start address out of bounds. Response: ", response, SD_CMD32_RL);
+			if (!sd_card->mmc) sd_debug_print("* SD -- Failure: CMD32. Erase start address out of bounds. Response: ", response, SD_CMD32_RL);
 				else sd_debug_print("* SD -- Failure: CMD35. Erase start address out of bounds. Response: ", response, SD_CMD35_RL);
 
 			return SD_ERROR_START_ADDR_OUTBOUNDS;
 		}
-		if (!sd_mmc) sd_debug_print("* SD -- Failure: CMD32. Unknown error setting erase start address. Response: ", response, SD_CMD32_RL);
+		if (!sd_card->mmc) sd_debug_print("* SD -- Failure: CMD32. Unknown error setting erase start address. Response: ", response, SD_CMD32_RL);
 			else sd_debug_print("* SD -- Failure: CMD35. Unknown error setting erase start address. Response: ", response, SD_CMD35_RL);
 		return SD_ERROR_START_ADDR_UNKNOWN;
 	}
-	if (!sd_mmc) sd_debug_print("* SD -- Success: CMD32. Erase start address set.", 0, 0);
+	if (!sd_card->mmc) sd_debug_print("* SD -- Success: CMD32. Erase start address set.", 0, 0);
 		else sd_debug_print("* SD -- Success: CMD35. Erase start address set.", 0, 0);
 	
 	/* Send the erase address end command with our end address */
-	if (!sd_mmc)
+	if (!sd_card->mmc)
 		sd_spi_command(SD_CMD33, address_end, SD_CMD33_RL, response);
 	else
 		sd_spi_command(SD_CMD36, address_end, SD_CMD36_RL, response);
 	if (response[0] != 0x00) {
 		if (response[0] & 0x40) {
-			if (!sd_mmc) sd_debug_print("* SD -- Failure: CMD33. Erase end address misaligned. Response: ", response, SD_CMD33_RL);
+			if (!sd_card->mmc) sd_debug_print("* SD -- Failure: CMD33. Erase end address misaligned. Response: ", response, SD_CMD33_RL);
 				else sd_debug_print("* SD -- Failure: CMD36. Erase end address misaligned. Response: ", response, SD_CMD36_RL);
 			return SD_ERROR_END_ADDR_MISALIGNED;
 		}
 		if (response[0] & 0x80) {
-			if (!sd_mmc) sd_debug_print("* SD -- Failure: CMD33. Erase end address out of bounds. Response: ", response, SD_CMD33_RL);
+			if (!sd_card->mmc) sd_debug_print("* SD -- Failure: CMD33. Erase end address out of bounds. Response: ", response, SD_CMD33_RL);
 				else sd_debug_print("* SD -- Failure: CMD36. Erase end address out of bounds. Response: ", response, SD_CMD36_RL);
 			return SD_ERROR_END_ADDR_OUTBOUNDS;
 		}
-		if (!sd_mmc) sd_debug_print("* SD -- Failure: CMD33. Unknown error setting erase end address. Response: ", response, SD_CMD33_RL);
+		if (!sd_card->mmc) sd_debug_print("* SD -- Failure: CMD33. Unknown error setting erase end address. Response: ", response, SD_CMD33_RL);
 			else sd_debug_print("* SD -- Failure: CMD36. Unknown error setting erase end address. Response: ", response, SD_CMD36_RL);
 		return SD_ERROR_END_ADDR_UNKNOWN;
 	}
-	if (!sd_mmc) sd_debug_print("* SD -- Success: CMD33. Erase end address set.", 0, 0);
+	if (!sd_card->mmc) sd_debug_print("* SD -- Success: CMD33. Erase end address set.", 0, 0);
 		else sd_debug_print("* SD -- Success: CMD36. Erase end address set.", 0, 0);
 
 	/* Send the erase command */
-	sd_spi_command_send(SD_CMD38, 0x00);
+	SD_STATS_BEGIN(SD_STATS_CMD38);
+	sd_spi_command_send_fixed(sd_frame_cmd38);
 	sd_spi_command_response(response, SD_CMD38_RL);
 	if (response[0] != 0x00) {
 		sd_debug_print("* SD -- Failure: CMD38. Error erasing selected blocks. Response: ", response, SD_CMD38_RL);
 		return SD_ERROR_ERASE;
 	}
 
+	/* The card is erasing now and holds DO low until done, see
+	 * sd_busy_poll(). Once done, end the sample with
+	 * sd_stats_done(SD_STATS_CMD38). */
+	return 0;
+}
+
+int sd_erase_blocks(uint32_t address_start, uint32_t address_end) {
+	uint32_t au, num_au;
+	int retVal;
+
+	/* The card's erase time goes by the allocation units the range touches */
+	au = sd_get_au_blocks();
+	num_au = 1;
+	if (au != 0 && address_end >= address_start)
+		num_au = SD_BLOCK_DIV(address_end) / au - SD_BLOCK_DIV(address_start) / au + 1;
+
+	retVal = sd_erase_blocks_start(address_start, address_end);
+	if (retVal < 0)
+		return retVal;
+
 	/* Wait for the busy signal to clear */
-	while (1) {
-		if (sd_spi_receive() != SD_SPI_BUSY)
-			break;
+	if (sd_busy_wait(sd_get_erase_timeout_ms(num_au)) < 0) {
+		sd_debug_print("* SD -- Failure: CMD38. Timed out waiting for erase to finish.", 0, 0);
+		return SD_ERROR_ERASE_TIMEOUT;
 	}
 	
 	sd_spi_delay_clocks();
 
 	sd_debug_print("* SD -- Success: CMD38. Selected blocks erased.", 0, 0);
+	SD_STATS_END(SD_STATS_CMD38);
 
 	return 0;
 }
 
 int sd_stop_block_transmission(void) {
-	uint8_t data;
-	
-	sd_spi_command_send(SD_CMD12, 0x00);
+	sd_spi_command_send_fixed(sd_frame_cmd12);
 	/* Wait for the command to take into effect */
 	sd_spi_delay_clocks();
 	
@@ -600,10 +1508,9 @@ int sd_stop_block_transmission(void) {
 	} */
 
 	/* Now wait for the 0x00 busy signal to clear */
-	for (;;) {
-		data = sd_spi_receive();
-		if (data == 0xFF)
-			break;
+	if (sd_busy_wait(SD_WRITE_TIMEOUT_MS) < 0) {
+		sd_debug_print("* SD -- Failure: CMD12. Timed out waiting for card to stop transmission.", 0, 0);
+		return SD_ERROR_STOP_TIMEOUT;
 	}
 
 	sd_debug_print("* SD -- Success: CMD12. Multiple block transmission stopped.", 0, 0);
@@ -611,24 +1518,43 @@ int sd_stop_block_transmission(void) {
 	return 0;
 }
 
+/* Sends a data block and its CRC16, or a dummy CRC with CRC off */
+static void sd_spi_send_data(const uint8_t *data) {
+	uint16_t crc16;
+
+	if (sd_card->crc_enabled) {
+		/* Send every byte of the data block, computing its CRC16 on the way */
+		crc16 = sd_spi_send_block_crc16(0, data, SD_BLOCK_LEN);
+	} else {
+		sd_spi_send_block(data, SD_BLOCK_LEN);
+		crc16 = 0xFFFF;
+	}
+
+	/* Send the CRC16 of the data block */
+	sd_spi_send((uint8_t)(crc16 >> 8));
+	sd_spi_send((uint8_t)(crc16 & 0xFF));
+
+	SD_STATS_ADD(bytes_written, SD_BLOCK_LEN);
+}
+
 int sd_write_block(uint32_t address, const uint8_t *data) {
 	uint8_t response[5];
-	uint16_t crc16;
 	int i, retVal;
 
 	/* Error out if the address is not aligned by block length */
-	if ((address % sd_block_len) != 0) {
+	if (SD_BLOCK_MOD(address) != 0) {
 		sd_debug_print("* SD -- Failure: CMD24. Address not aligned by block length.", 0, 0);
 		return SD_ERROR_WRITE_ADDR_MISALIGNED;
 	}
 
 	/* If this is a high capacity card, the data is addressed in
 	 * blocks (512 bytes). Adjust the address accordingly. */
-	if (sd_high_capacity) {
-		address /= sd_block_len;
+	if (sd_card->high_capacity) {
+		address = SD_BLOCK_DIV(address);
 	}
 
 	/* Send the write single block command and receive the R1 response */
+	SD_STATS_BEGIN(SD_STATS_CMD24);
 	sd_spi_command(SD_CMD24, address, SD_CMD24_RL, response);
 	
 	if (response[0] != 0x00) {
@@ -644,19 +1570,9 @@ int sd_write_block(uint32_t address, const uint8_t *data) {
 		return SD_ERROR_WRITE_UNKNOWN;
 	}
 
-	/* CRC16 the data we're sending */
-	crc16 = sd_crc16_data(data, sd_block_len);
-
 	/* Send the data block start token and the data block */
 	sd_spi_send(SD_SPI_DATA_BLOCK_START);
-
-	/* Send every byte of the data block */
-	for (i = 0; i < sd_block_len; i++)
-		sd_spi_send(data[i]);
-
-	/* Send the CRC16 of the data block */
-	sd_spi_send((uint8_t)(crc16 >> 8));
-	sd_spi_send((uint8_t)(crc16 & 0xFF));
+	sd_spi_send_data(data);
 
 	/* Wait for the data response token */
 	for (i = 0; i < SD_SPI_DATA_READ_ATTEMPTS; i++) {
@@ -666,12 +1582,15 @@ int sd_write_block(uint32_t address, const uint8_t *data) {
 	}
 
 	/* Check the response token */	
+	if (((response[0] & 0x0E) >> 1) != SD_SPI_WRITE_ACCEPTED)
+		sd_crc_trouble();
 	switch ((response[0] & 0x0E) >> 1) {
 		case SD_SPI_WRITE_ACCEPTED:
 			retVal = 0;
 			break;
 		case SD_SPI_WRITE_ERROR_CRC:
 			sd_debug_print("* SD -- Failure: CMD24. CRC error occured during single block write. Data response token: ", response, 1);
+			SD_STATS_INC(crc_errors);
 			retVal = SD_ERROR_WRITE_BLOCK_CRC;
 			break;
 		case SD_SPI_WRITE_ERROR_WRITE:
@@ -685,43 +1604,38 @@ int sd_write_block(uint32_t address, const uint8_t *data) {
 	}
 
 	/* Wait for the busy signal to clear */
-	while (1) {
-		if (sd_spi_receive() != SD_SPI_BUSY)
-			break;
+	if (sd_busy_wait(SD_WRITE_TIMEOUT_MS) < 0) {
+		sd_debug_print("* SD -- Failure: CMD24. Timed out waiting for single block write to finish.", 0, 0);
+		retVal = SD_ERROR_WRITE_TIMEOUT;
 	}
 
 	sd_spi_delay_clocks();
 
-	if (retVal == 0)
+	if (retVal == 0) {
 		sd_debug_print("* SD -- Success: CMD24. Single data block written.", 0, 0); 
+		SD_STATS_END(SD_STATS_CMD24);
+	}
 
 	return retVal; 
 }
 
-int sd_write_blocks(uint32_t address, const uint8_t *data, int dataLen) {
+int sd_write_blocks_start(uint32_t address) {
 	uint8_t response[5];
-	uint16_t crc16;
-	int i, dataIndex, retVal;
 
 	/* Error out if the address is not aligned by block length */
-	if ((address % sd_block_len) != 0) {
+	if (SD_BLOCK_MOD(address) != 0) {
 		sd_debug_print("* SD -- Failure: CMD25. Address not aligned by block length.", 0, 0);
 		return SD_ERROR_WRITE_ADDR_MISALIGNED;
 	}
-	
-	/* Make sure the data length is in multiples of the block length. */
-	if ((dataLen % sd_block_len) != 0) {
-		sd_debug_print("* SD -- Failure: CMD25. Data length not in block multiples.", 0, 0);
-		return SD_ERROR_WRITE_DATALEN_MULTIPLE;
-	}
 
 	/* If this is a high capacity card, the data is addressed in
 	 * blocks (512 bytes). Adjust the address accordingly. */
-	if (sd_high_capacity) {
-		address /= sd_block_len;
+	if (sd_card->high_capacity) {
+		address = SD_BLOCK_DIV(address);
 	}
 
 	/* Send the write multiple blocks command and receive the R1 response */
+	SD_STATS_BEGIN(SD_STATS_CMD25);
 	sd_spi_command(SD_CMD25, address, SD_CMD25_RL, response);
 	
 	if (response[0] != 0x00) {
@@ -737,51 +1651,80 @@ int sd_write_blocks(uint32_t address, const uint8_t *data, int dataLen) {
 		return SD_ERROR_WRITE_UNKNOWN;
 	}
 
-	for (retVal = 0, dataIndex = 0; dataIndex < dataLen; ) {
-		/* CRC16 the data we're sending */
-		crc16 = sd_crc16_data(data+dataIndex, sd_block_len);
-
-		/* Send the data block start token and the data block */
-		sd_spi_send(SD_SPI_MULTIPLE_DATA_BLOCK_START);
-
-		/* Send every byte of the data block */
-		for (i = 0; i < sd_block_len; i++)
-			sd_spi_send(data[dataIndex++]);
-
-		/* Send the CRC16 of the data block */
-		sd_spi_send((uint8_t)(crc16 >> 8));
-		sd_spi_send((uint8_t)(crc16 & 0xFF));
+	return 0;
+}
 
-		/* Wait for the data response token */
-		for (i = 0; i < SD_SPI_DATA_READ_ATTEMPTS; i++) {
-			response[0] = sd_spi_receive();
-			if (response[0] != 0xFF)
-				break;
-		}
+/* Receives and checks the data response token after a CMD25 data block */
+static int sd_write_blocks_response(void) {
+	uint8_t response[1];
+	int i;
 
-		/* Check the response token */	
-		switch ((response[0] & 0x0E) >> 1) {
-			case SD_SPI_WRITE_ACCEPTED:
-				retVal = 0;
+	/* Wait for the data response token */
+	for (i = 0; i < SD_SPI_DATA_READ_ATTEMPTS; i++) {
+		response[0] = sd_spi_receive();
+		if (response[0] != 0xFF)
 			break;
-			case SD_SPI_WRITE_ERROR_CRC:
+	}
+
+	/* Check the response token */	
+	if (((response[0] & 0x0E) >> 1) != SD_SPI_WRITE_ACCEPTED)
+		sd_crc_trouble();
+	switch ((response[0] & 0x0E) >> 1) {
+		case SD_SPI_WRITE_ACCEPTED:
+			return 0;
+		case SD_SPI_WRITE_ERROR_CRC:
 			sd_debug_print("* SD -- Failure: CMD25. CRC error occured during multiple block write. Data response token: ", response, 1);
-			retVal = SD_ERROR_WRITE_BLOCK_CRC;
-			break;
-			case SD_SPI_WRITE_ERROR_WRITE:
+			SD_STATS_INC(crc_errors);
+			return SD_ERROR_WRITE_BLOCK_CRC;
+		case SD_SPI_WRITE_ERROR_WRITE:
 			sd_debug_print("* SD -- Failure: CMD25. Write error occured during multiple block write. Data response token: ", response, 1);
-			retVal = SD_ERROR_WRITE_BLOCK;
-			break;
-			default:
+			return SD_ERROR_WRITE_BLOCK;
+		default:
 			sd_debug_print("* SD -- Failure: CMD25. Unknown error occured during multiple block write. Data response token: ", response, 1);
-			retVal = SD_ERROR_WRITE_UNKNOWN;
-			break;
-		}
+			return SD_ERROR_WRITE_UNKNOWN;
+	}
+}
+
+/* Sends the next block of an open CMD25 transfer. The card is busy
+ * programming it afterwards, wait for it with sd_busy_wait() or
+ * sd_busy_poll() before sending anything else. */
+int sd_write_blocks_next(const uint8_t *data) {
+	/* Send the data block start token and the data block */
+	sd_spi_send(SD_SPI_MULTIPLE_DATA_BLOCK_START);
+	sd_spi_send_data(data);
+
+	return sd_write_blocks_response();
+}
+
+/* Ends an open CMD25 transfer. The card is busy afterwards, same as
+ * after sd_write_blocks_next(); once that clears on a transfer that
+ * went through, call sd_stats_done(SD_STATS_CMD25). */
+void sd_write_blocks_stop(void) {
+	/* Send Stop Transmission token */
+	sd_spi_send(SD_SPI_MULTIPLE_DATA_BLOCK_END);
+	sd_spi_delay_clocks();
+}
+
+int sd_write_blocks(uint32_t address, const uint8_t *data, int dataLen) {
+	int dataIndex, retVal;
+
+	/* Make sure the data length is in multiples of the block length. */
+	if (SD_BLOCK_MOD(dataLen) != 0) {
+		sd_debug_print("* SD -- Failure: CMD25. Data length not in block multiples.", 0, 0);
+		return SD_ERROR_WRITE_DATALEN_MULTIPLE;
+	}
+
+	retVal = sd_write_blocks_start(address);
+	if (retVal < 0)
+		return retVal;
+
+	for (dataIndex = 0; dataIndex < dataLen; dataIndex += SD_BLOCK_LEN) {
+		retVal = sd_write_blocks_next(data+dataIndex);
 
 		/* Wait for the busy signal to clear */
-		while (1) {
-			if (sd_spi_receive() != SD_SPI_BUSY)
-				break;
+		if (sd_busy_wait(SD_WRITE_TIMEOUT_MS) < 0) {
+			sd_debug_print("* SD -- Failure: CMD25. Timed out waiting for block write to finish.", 0, 0);
+			retVal = SD_ERROR_WRITE_TIMEOUT;
 		}
 
 		sd_spi_delay_clocks();
@@ -791,52 +1734,46 @@ int sd_write_blocks(uint32_t address, const uint8_t *data, int dataLen) {
 			break;
 	}
 
-	/* Send Stop Transmission token */
-	sd_spi_send(SD_SPI_MULTIPLE_DATA_BLOCK_END);
-	sd_spi_delay_clocks();
+	sd_write_blocks_stop();
 		
 	/* Wait for the busy signal to clear */
-	while (1) {
-		if (sd_spi_receive() != SD_SPI_BUSY)
-			break;
+	if (sd_busy_wait(SD_WRITE_TIMEOUT_MS) < 0) {
+		sd_debug_print("* SD -- Failure: CMD25. Timed out waiting for multiple block write to finish.", 0, 0);
+		if (retVal == 0)
+			retVal = SD_ERROR_WRITE_TIMEOUT;
 	}
 
-	sd_debug_print("* SD -- Success: CMD25. Multiple blocks written.", 0, 0);
+	if (retVal == 0) {
+		sd_debug_print("* SD -- Success: CMD25. Multiple blocks written.", 0, 0);
+		SD_STATS_END(SD_STATS_CMD25);
+	}
 
 	sd_spi_delay_clocks();
 	
 	return retVal;
 }
 
-int sd_read_blocks(uint32_t address, uint8_t *data, int dataLen) {
-	uint8_t response[5];
-	uint16_t crc16;
-	int i, dataIndex, retVal;
-
-	/* Align the address with the nearest block length down */
-	//address -= (address % sd_block_len);
+int sd_read_blocks_start(uint32_t address) {
+	uint8_t response[5];
 
 	/* Error out if the address is not aligned by block length */
-	if ((address % sd_block_len) != 0) {
+	if (SD_BLOCK_MOD(address) != 0) {
 		sd_debug_print("* SD -- Failure: CMD18. Address not aligned by block length.", 0, 0);
 		return SD_ERROR_READ_ADDR_MISALIGNED;
 	}
 
-	/* Make sure the data length is in multiples of the block length. */
-	if ((dataLen % sd_block_len) != 0) {
-		sd_debug_print("* SD -- Failure: CMD18. Data length not in block multiples.", 0, 0);
-		return SD_ERROR_READ_DATALEN_MULTIPLE;
-	}
-
 	/* If this is a high capacity card, the data is addressed in
 	 * blocks (512 bytes). Adjust the address accordingly. */
-	if (sd_high_capacity) {
-		address /= sd_block_len;
+	if (sd_card->high_capacity) {
+		address = SD_BLOCK_DIV(address);
 	}
 
 	/* Send the read multiple blocks command and receive the R1 response */
-	sd_spi_command_send(SD_CMD18, address);
-	sd_spi_command_response(response, SD_CMD18_RL);
+	SD_STATS_BEGIN(SD_STATS_CMD18);
+	sd_spi_select();
+	sd_spi_command_frame(SD_CMD18, address);
+	sd_spi_response(response, SD_CMD18_RL);
+	sd_spi_deselect();
 
 	if (response[0] != 0x00) {
 		if (response[0] & 0x40) {
@@ -851,107 +1788,379 @@ int sd_read_blocks(uint32_t address, uint8_t *data, int dataLen) {
 		return SD_ERROR_READ_UNKNOWN;
 	}
 
-	for (retVal = 0, dataIndex = 0; dataIndex < dataLen; ) {
-		/* Find the data block start byte */
-		for (i = 0; i < SD_SPI_DATA_READ_ATTEMPTS; i++) {
-			data[dataIndex] = sd_spi_receive();
-			/* Check if we get the start of a block or a data read error */
-			if (data[dataIndex] == SD_SPI_DATA_BLOCK_START || 
-					(data[dataIndex] & SD_SPI_DATA_ERROR_TOKEN_MASK) == 0x00)
-				break;
-		}
+	return 0;
+}
 
-		if ((data[dataIndex] & SD_SPI_DATA_ERROR_TOKEN_MASK) == 0x00) {
-			if (sd_mmc && (data[0] & 0x10)) {
-				sd_debug_print("* SD -- Failure: CMD18. Read data address misaligned. Error token: ", data, 1);
-				return SD_ERROR_READ_ADDR_MISALIGNED;
-			}
-			if (data[dataIndex] & 0x08) {
-				sd_debug_print("* SD -- Failure: CMD18. Read data address out of range. Error token: ", data, 1);
-				retVal = SD_ERROR_READ_ADDR_OUTBOUNDS;
-				break;
-			}
-			if (data[dataIndex] & 0x04) {
-				sd_debug_print("* SD -- Failure: CMD18. Card ECC failure during read. Error token: ", data, 1);
-				retVal = SD_ERROR_READ_CARD_ECC;
-				break;
-			}
-			if (data[dataIndex] & 0x02) {
-				sd_debug_print("* SD -- Failure: CMD18. Card CC failure during read. Error token: ", data, 1);
-				retVal = SD_ERROR_READ_CARD_CC;
-				break;
-			}
-			sd_debug_print("* SD -- Failure: CMD18. Unknown error with multiple block read. Error token: ", data, 1);
-			return SD_ERROR_READ_UNKNOWN;
+/* Waits for the start of the next block of an open CMD18 transfer and
+ * checks the data token. The card must already be selected. */
+static int sd_read_blocks_token(void) {
+	uint8_t token;
+
+	/* Find the data block start byte */
+	token = sd_spi_data_token();
+
+	if ((token & SD_SPI_DATA_ERROR_TOKEN_MASK) == 0x00) {
+		if (sd_card->mmc && (token & 0x10)) {
+			sd_debug_print("* SD -- Failure: CMD18. Read data address misaligned. Error token: ", &token, 1);
+			return SD_ERROR_READ_ADDR_MISALIGNED;
+		}
+		if (token & 0x08) {
+			sd_debug_print("* SD -- Failure: CMD18. Read data address out of range. Error token: ", &token, 1);
+			return SD_ERROR_READ_ADDR_OUTBOUNDS;
+		}
+		if (token & 0x04) {
+			sd_debug_print("* SD -- Failure: CMD18. Card ECC failure during read. Error token: ", &token, 1);
+			return SD_ERROR_READ_CARD_ECC;
+		}
+		if (token & 0x02) {
+			sd_debug_print("* SD -- Failure: CMD18. Card CC failure during read. Error token: ", &token, 1);
+			return SD_ERROR_READ_CARD_CC;
 		}
+		sd_debug_print("* SD -- Failure: CMD18. Unknown error with multiple block read. Error token: ", &token, 1);
+		return SD_ERROR_READ_UNKNOWN;
+	}
+
+	return 0;
+}
+
+/* Receives the CRC16 that ends a CMD18 data block and checks it against
+ * the one computed over the data. */
+static int sd_read_blocks_crc(uint16_t crc16_data) {
+	uint8_t crc[2];
+	uint16_t crc16;
+
+	/* Read in the CRC16 */
+	sd_spi_receive_block(crc, 2);
+	crc16 = (crc[0] << 8) | crc[1];
+
+	/* Verify the data block's CRC */
+	if (sd_card->crc_enabled && crc16_data != crc16) {
+		sd_debug_print("* SD -- Failure: CMD18. CRC16 invalid on read data block.", 0, 0);
+		SD_STATS_INC(crc_errors);
+		return SD_ERROR_READ_MULTIPLE_CRC;
+	}
+
+	SD_STATS_ADD(bytes_read, SD_BLOCK_LEN);
+
+	return 0;
+}
+
+/* Receives the next block of an open CMD18 transfer. The card must
+ * already be selected. */
+static int sd_read_blocks_data(uint8_t *data) {
+	int retVal;
+
+	retVal = sd_read_blocks_token();
+	if (retVal < 0)
+		return retVal;
+
+	/* Read a block length of data, computing its CRC16 on the way */
+	if (!sd_card->crc_enabled) {
+		sd_spi_receive_block(data, SD_BLOCK_LEN);
+		return sd_read_blocks_crc(0);
+	}
+	return sd_read_blocks_crc(sd_spi_receive_block_crc16(0, data, SD_BLOCK_LEN));
+}
+
+int sd_read_blocks_next(uint8_t *data) {
+	int retVal;
+
+	sd_spi_select();
+	retVal = sd_read_blocks_data(data);
+	sd_spi_deselect();
 
-		/* Read a block length of data */
-		for (i = 0; i < sd_block_len; i++, dataIndex++) {
-			data[dataIndex] = sd_spi_receive();
+	return retVal;
+}
+
+/* Receives the next block of an open CMD18 transfer without keeping its
+ * data, only its CRC16, for checking what is on the card against digests
+ * kept elsewhere. The data streams through a small buffer. With CRC
+ * checking off the CRC16 the card sent is returned as is. */
+int sd_read_blocks_next_crc16(uint16_t *crc16) {
+	uint8_t chunk[16];
+	uint16_t crc16_data;
+	int i, n, retVal;
+
+	sd_spi_select();
+
+	retVal = sd_read_blocks_token();
+	if (retVal == 0) {
+		crc16_data = 0;
+		for (i = 0; i < SD_BLOCK_LEN; i += n) {
+			n = (SD_BLOCK_LEN - i < (int)sizeof(chunk)) ? SD_BLOCK_LEN - i : (int)sizeof(chunk);
+			if (sd_card->crc_enabled)
+				crc16_data = sd_spi_receive_block_crc16(crc16_data, chunk, n);
+			else
+				sd_spi_receive_block(chunk, n);
 		}
 
 		/* Read in the CRC16 */
-		crc16 = (sd_spi_receive() << 8);
-		crc16 |= sd_spi_receive();
+		sd_spi_receive_block(chunk, 2);
+		*crc16 = (chunk[0] << 8) | chunk[1];
 
 		/* Verify the data block's CRC */
-		if (sd_crc16_data(data+(dataIndex-sd_block_len), sd_block_len) != crc16) {
+		if (sd_card->crc_enabled && crc16_data != *crc16) {
 			sd_debug_print("* SD -- Failure: CMD18. CRC16 invalid on read data block.", 0, 0);
+			SD_STATS_INC(crc_errors);
 			retVal = SD_ERROR_READ_MULTIPLE_CRC;
-			break;
+		} else {
+			SD_STATS_ADD(bytes_read, SD_BLOCK_LEN);
 		}
+	}
+
+	sd_spi_deselect();
+
+	return retVal;
+}
+
+/* Ends an open CMD18 transfer. If every block of it came through and
+ * this returns 0, call sd_stats_done(SD_STATS_CMD18). */
+int sd_read_blocks_stop(void) {
+	int retVal;
+
+	/* Stop any further block transmissions */
+	retVal = sd_stop_block_transmission();
+	sd_spi_delay_clocks();
+
+	return retVal;
+}
+
+int sd_read_blocks(uint32_t address, uint8_t *data, int dataLen) {
+	int dataIndex, retVal;
+
+	/* Make sure the data length is in multiples of the block length. */
+	if (SD_BLOCK_MOD(dataLen) != 0) {
+		sd_debug_print("* SD -- Failure: CMD18. Data length not in block multiples.", 0, 0);
+		return SD_ERROR_READ_DATALEN_MULTIPLE;
+	}
+
+	retVal = sd_read_blocks_start(address);
+	if (retVal < 0)
+		return retVal;
+
+	/* Hold the card selected for the whole data phase */
+	sd_spi_select();
+	for (dataIndex = 0; dataIndex < dataLen; dataIndex += SD_BLOCK_LEN) {
+		retVal = sd_read_blocks_data(data+dataIndex);
+		if (retVal < 0)
+			break;
 		sd_debug_print("block ok", 0, 0);
 	}
+	sd_spi_deselect();
 
 	/* Check if we had any block read errors */
 	if (retVal < 0) {
-		sd_stop_block_transmission();
-		sd_spi_delay_clocks();
+		sd_read_blocks_stop();
 		return retVal;
 	}
 	
-	/* Stop any further block transmissions */
-	retVal = sd_stop_block_transmission();
-	sd_spi_delay_clocks();
 	/* Check if stopping block transmission went through smoothly */
+	retVal = sd_read_blocks_stop();
 	if (retVal < 0)
 		return retVal;
+	SD_STATS_END(SD_STATS_CMD18);
 	
 	sd_debug_print("* SD -- Success: CMD18. Retrieved multiple data blocks.", 0, 0);
 	return 0;
 }
 
-int sd_read_block(uint32_t address, uint8_t *data) {
-	uint8_t response[5];
+/* Walks a segment list a number of bytes at a time */
+typedef struct _SD_IOVec_Cursor {
+	const SD_IOVec *iov;
+	int offset;
+} SD_IOVec_Cursor;
+
+static int sd_iov_length(const SD_IOVec *iov, int iovcnt) {
+	int i, len;
+
+	for (i = 0, len = 0; i < iovcnt; i++)
+		len += iov[i].len;
+
+	return len;
+}
+
+/* Sends the next dataLen bytes of the segment list, carrying the CRC16
+ * over from one segment to the next */
+static uint16_t sd_iov_send_crc16(SD_IOVec_Cursor *cursor, int dataLen) {
+	uint16_t crc16 = (sd_card->crc_enabled) ? 0 : 0xFFFF;
+	int n;
+
+	while (dataLen > 0) {
+		n = cursor->iov->len - cursor->offset;
+		if (n > dataLen)
+			n = dataLen;
+		if (sd_card->crc_enabled)
+			crc16 = sd_spi_send_block_crc16(crc16, cursor->iov->base + cursor->offset, n);
+		else
+			sd_spi_send_block(cursor->iov->base + cursor->offset, n);
+		dataLen -= n;
+		cursor->offset += n;
+		if (cursor->offset == cursor->iov->len) {
+			cursor->iov++;
+			cursor->offset = 0;
+		}
+	}
+
+	return crc16;
+}
+
+/* Receives the next dataLen bytes into the segment list, carrying the
+ * CRC16 over from one segment to the next */
+static uint16_t sd_iov_receive_crc16(SD_IOVec_Cursor *cursor, int dataLen) {
+	uint16_t crc16 = 0;
+	int n;
+
+	while (dataLen > 0) {
+		n = cursor->iov->len - cursor->offset;
+		if (n > dataLen)
+			n = dataLen;
+		if (sd_card->crc_enabled)
+			crc16 = sd_spi_receive_block_crc16(crc16, cursor->iov->base + cursor->offset, n);
+		else
+			sd_spi_receive_block(cursor->iov->base + cursor->offset, n);
+		dataLen -= n;
+		cursor->offset += n;
+		if (cursor->offset == cursor->iov->len) {
+			cursor->iov++;
+			cursor->offset = 0;
+		}
+	}
+
+	return crc16;
+}
+
+int sd_writev(uint32_t address, const SD_IOVec *iov, int iovcnt) {
+	SD_IOVec_Cursor cursor;
 	uint16_t crc16;
-	int i;
+	int dataIndex, dataLen, retVal;
+
+	/* The segments together must make up whole blocks */
+	dataLen = sd_iov_length(iov, iovcnt);
+	if (SD_BLOCK_MOD(dataLen) != 0) {
+		sd_debug_print("* SD -- Failure: CMD25. Data length not in block multiples.", 0, 0);
+		return SD_ERROR_WRITE_DATALEN_MULTIPLE;
+	}
+
+	retVal = sd_write_blocks_start(address);
+	if (retVal < 0)
+		return retVal;
+
+	cursor.iov = iov;
+	cursor.offset = 0;
+	for (dataIndex = 0; dataIndex < dataLen; dataIndex += SD_BLOCK_LEN) {
+		/* Send the data block start token and the block, straight out
+		 * of the segments */
+		sd_spi_send(SD_SPI_MULTIPLE_DATA_BLOCK_START);
+		crc16 = sd_iov_send_crc16(&cursor, SD_BLOCK_LEN);
+		sd_spi_send((uint8_t)(crc16 >> 8));
+		sd_spi_send((uint8_t)(crc16 & 0xFF));
+		SD_STATS_ADD(bytes_written, SD_BLOCK_LEN);
+		retVal = sd_write_blocks_response();
+
+		/* Wait for the busy signal to clear */
+		if (sd_busy_wait(SD_WRITE_TIMEOUT_MS) < 0) {
+			sd_debug_print("* SD -- Failure: CMD25. Timed out waiting for block write to finish.", 0, 0);
+			retVal = SD_ERROR_WRITE_TIMEOUT;
+		}
+
+		sd_spi_delay_clocks();
+
+		if (retVal < 0)
+			break;
+	}
+
+	sd_write_blocks_stop();
+
+	/* Wait for the busy signal to clear */
+	if (sd_busy_wait(SD_WRITE_TIMEOUT_MS) < 0) {
+		sd_debug_print("* SD -- Failure: CMD25. Timed out waiting for multiple block write to finish.", 0, 0);
+		if (retVal == 0)
+			retVal = SD_ERROR_WRITE_TIMEOUT;
+	}
+
+	sd_spi_delay_clocks();
+
+	if (retVal == 0)
+		SD_STATS_END(SD_STATS_CMD25);
+
+	return retVal;
+}
+
+int sd_readv(uint32_t address, const SD_IOVec *iov, int iovcnt) {
+	SD_IOVec_Cursor cursor;
+	int dataIndex, dataLen, retVal, stopVal;
+
+	/* The segments together must make up whole blocks */
+	dataLen = sd_iov_length(iov, iovcnt);
+	if (SD_BLOCK_MOD(dataLen) != 0) {
+		sd_debug_print("* SD -- Failure: CMD18. Data length not in block multiples.", 0, 0);
+		return SD_ERROR_READ_DATALEN_MULTIPLE;
+	}
+
+	retVal = sd_read_blocks_start(address);
+	if (retVal < 0)
+		return retVal;
+
+	cursor.iov = iov;
+	cursor.offset = 0;
+
+	/* Hold the card selected for the whole data phase */
+	sd_spi_select();
+	for (dataIndex = 0; dataIndex < dataLen; dataIndex += SD_BLOCK_LEN) {
+		retVal = sd_read_blocks_token();
+		if (retVal < 0)
+			break;
+		/* Receive the block straight into the segments */
+		retVal = sd_read_blocks_crc(sd_iov_receive_crc16(&cursor, SD_BLOCK_LEN));
+		if (retVal < 0)
+			break;
+	}
+	sd_spi_deselect();
+
+	stopVal = sd_read_blocks_stop();
+	if (retVal == 0)
+		retVal = stopVal;
+	if (retVal == 0)
+		SD_STATS_END(SD_STATS_CMD18);
+
+	return retVal;
+}
+
+int sd_read_block(uint32_t address, uint8_t *data) {
+	uint8_t response[5], crc[2], token;
+	uint16_t crc16, crc16_data;
 
 	/* Align the address with the nearest block length down */
-	//address -= (address % sd_block_len);
+	//address -= SD_BLOCK_MOD(address);
 
 	/* Error out if the address is not aligned by block length */
-	if ((address % sd_block_len) != 0) {
+	if (SD_BLOCK_MOD(address) != 0) {
 		sd_debug_print("* SD -- Failure: CMD17. Address not aligned by block length.", 0, 0);
 		return SD_ERROR_READ_ADDR_MISALIGNED;
 	}
 
 	/* If this is a high capacity card, the data is addressed in
 	 * blocks (512 bytes). Adjust the address accordingly. */
-	if (sd_high_capacity) {
-		address /= sd_block_len;
+	if (sd_card->high_capacity) {
+		address = SD_BLOCK_DIV(address);
 	}
 
 	/* Make sure we can hold up to one block 
-	if (dataLen < sd_block_len) {
+	if (dataLen < SD_BLOCK_LEN) {
 		sd_debug_print("* SD -- Failure: CMD17. Insufficient data length to support block size.", 0, 0);
 		return SD_ERROR_READ_DATALEN;
 	} */
 
+	SD_STATS_BEGIN(SD_STATS_CMD17);
+	/* Hold the card selected for the whole command and data phase */
+	sd_spi_select();
+
 	/* Send the read single block command and receive the R1 response */
-	sd_spi_command_send(SD_CMD17, address);
-	sd_spi_command_response(response, SD_CMD17_RL);
+	sd_spi_command_frame(SD_CMD17, address);
+	sd_spi_response(response, SD_CMD17_RL);
 
 	if (response[0] != 0x00) {
+		sd_spi_deselect();
 		if (response[0] & 0x40) {
 			sd_debug_print("* SD -- Failure: CMD17. Read data address misaligned. Response: ", response, SD_CMD17_RL);
 			return SD_ERROR_READ_ADDR_MISALIGNED;
@@ -965,53 +2174,55 @@ int sd_read_block(uint32_t address, uint8_t *data) {
 	}
 	
 	/* Find the data block start byte */
-	for (i = 0; i < SD_SPI_DATA_READ_ATTEMPTS; i++) {
-		data[0] = sd_spi_receive();
-		/* Check if we get the start of a block or a data read error */
-		if (data[0] == SD_SPI_DATA_BLOCK_START || 
-		   (data[0] & SD_SPI_DATA_ERROR_TOKEN_MASK) == 0x00)
-			break;
-	}
+	token = sd_spi_data_token();
 
-	if ((data[0] & SD_SPI_DATA_ERROR_TOKEN_MASK) == 0x00) {
-		if (sd_mmc && (data[0] & 0x10)) {
-			sd_debug_print("* SD -- Failure: CMD17. Read data address misaligned. Error token: ", data, 1);
+	if ((token & SD_SPI_DATA_ERROR_TOKEN_MASK) == 0x00) {
+		sd_spi_deselect();
+		if (sd_card->mmc && (token & 0x10)) {
+			sd_debug_print("* SD -- Failure: CMD17. Read data address misaligned. Error token: ", &token, 1);
 			return SD_ERROR_READ_ADDR_MISALIGNED;
 		}
-		if (data[0] & 0x08) {
-			sd_debug_print("* SD -- Failure: CMD17. Read data address out of range. Error token: ", data, 1);
+		if (token & 0x08) {
+			sd_debug_print("* SD -- Failure: CMD17. Read data address out of range. Error token: ", &token, 1);
 			return SD_ERROR_READ_ADDR_OUTBOUNDS;
 		}
-		if (data[0] & 0x04) {
-			sd_debug_print("* SD -- Failure: CMD17. Card ECC failure during read. Error token: ", data, 1);
+		if (token & 0x04) {
+			sd_debug_print("* SD -- Failure: CMD17. Card ECC failure during read. Error token: ", &token, 1);
 			return SD_ERROR_READ_CARD_ECC;
 		}
-		if (data[0] & 0x02) {
-			sd_debug_print("* SD -- Failure: CMD17. Card CC failure during read. Error token: ", data, 1);
+		if (token & 0x02) {
+			sd_debug_print("* SD -- Failure: CMD17. Card CC failure during read. Error token: ", &token, 1);
 			return SD_ERROR_READ_CARD_CC;
 		}
-		sd_debug_print("* SD -- Failure: CMD17. Unknown error with single block read. Error token: ", data, 1);
+		sd_debug_print("* SD -- Failure: CMD17. Unknown error with single block read. Error token: ", &token, 1);
 		return SD_ERROR_READ_UNKNOWN;
 	}
 
-	/* Read a block length of data */
-	for (i = 0; i < sd_block_len; i++) {
-		data[i] = sd_spi_receive();
+	/* Read a block length of data, computing its CRC16 on the way */
+	if (sd_card->crc_enabled) {
+		crc16_data = sd_spi_receive_block_crc16(0, data, SD_BLOCK_LEN);
+	} else {
+		sd_spi_receive_block(data, SD_BLOCK_LEN);
+		crc16_data = 0;
 	}
 	
 	/* Read in the CRC16 */
-	crc16 = (sd_spi_receive() << 8);
-	crc16 |= sd_spi_receive();
-	
+	sd_spi_receive_block(crc, 2);
+	crc16 = (crc[0] << 8) | crc[1];
+
+	sd_spi_deselect();
 	sd_spi_delay_clocks();
 
 	/* Verify the data block's CRC */
-	if (sd_crc16_data(data, sd_block_len) != crc16) {
+	if (sd_card->crc_enabled && crc16_data != crc16) {
 		sd_debug_print("* SD -- Failure: CMD17. CRC16 invalid on read data block.", 0, 0);
+		SD_STATS_INC(crc_errors);
 		return SD_ERROR_READ_SINGLE_CRC;
 	}
 
 	sd_debug_print("* SD -- Success: CMD17. Retrieved single data block.", 0, 0);
+	SD_STATS_ADD(bytes_read, SD_BLOCK_LEN);
+	SD_STATS_END(SD_STATS_CMD17);
 	return 0;
 }
 
@@ -1019,7 +2230,7 @@ int sd_read_status(uint16_t *sd_status) {
 	uint8_t response[2];
 
 	/* Send the read status command */
-	sd_spi_command(SD_CMD13, 0x00, SD_CMD13_RL, response);
+	sd_spi_command_fixed(sd_frame_cmd13, SD_CMD13_RL, response);
 	
 	/* Copy the status into the 16-bit variable */
 	*sd_status = response[1];
@@ -1041,7 +2252,7 @@ int sd_pre_erase(uint32_t num_blocks) {
 
 	/* Send the pre-erase command with the specified
 	 * number of blocks to be erased before writing. CMD55 + ACMD23 */
-	sd_spi_command(SD_CMD55, 0x00, SD_CMD55_RL, response);
+	sd_spi_command_fixed(sd_frame_cmd55, SD_CMD55_RL, response);
 	if (response[0] != 0x00) {
 		sd_debug_print("* SD -- Failure: ACMD23. Failure with app command. Response: ", response, SD_CMD55_RL);
 		return SD_ERROR_APP_CMD;
@@ -1061,9 +2272,17 @@ int sd_pre_erase(uint32_t num_blocks) {
 int sd_set_block_len(uint32_t block_len) {
 	uint8_t response[5];
 
+#if SD_FIXED_BLOCK_LENGTH
+	/* The transfer paths are built for SD_BLOCK_LENGTH only */
+	if (block_len != SD_BLOCK_LENGTH) {
+		sd_debug_print("* SD -- Failure: CMD16. Block length is fixed at SD_BLOCK_LENGTH.", 0, 0);
+		return SD_ERROR_SET_BLOCKLEN;
+	}
+#endif
+
 	/* SD high capacity blocks have a fixed 512 byte block length */
-	if (sd_high_capacity) {
-		sd_block_len = SD_HCS_BLOCK_LENGTH;
+	if (sd_card->high_capacity) {
+		sd_card->block_len = SD_HCS_BLOCK_LENGTH;
 		sd_debug_print("* SD -- Success: CMD16. Skipped setting block length because card is high capacity.", 0, 0);
 		return 0;
 	}
@@ -1076,22 +2295,125 @@ int sd_set_block_len(uint32_t block_len) {
 		return SD_ERROR_SET_BLOCKLEN;
 	}
 	
-	sd_block_len = block_len;
+	sd_card->block_len = block_len;
 
 	sd_debug_print("* SD -- Success: CMD16. Block length set.", 0, 0);
 	return 0;
 }
 
 int sd_is_mmc(void) {
-	return sd_mmc;
+	return sd_card->mmc;
 }
 
 int sd_get_block_len(void) {
-	return sd_block_len;
+	return sd_card->block_len;
 }
 
 int sd_get_high_capacity(void) {
-	return sd_high_capacity;
+	return sd_card->high_capacity;
+}
+
+uint32_t sd_get_tran_speed(void) {
+	/* TRAN_SPEED time values, times 10 */
+	static const uint8_t time_value[16] = { 0, 10, 12, 13, 15, 20, 25, 30,
+						35, 40, 45, 50, 55, 60, 70, 80 };
+	uint32_t unit;
+	int i;
+
+	/* TRAN_SPEED bits 2:0 are the transfer rate unit, 100kbit/s times
+	 * a power of ten, and bits 6:3 the time value multiplier. 0x32 is
+	 * 25MHz, 0x5A is 50MHz for a card switched to high speed. */
+	unit = 10000;
+	for (i = 0; i < (sd_card->csd[3] & 0x07) && i < 3; i++)
+		unit *= 10;
+
+	return time_value[(sd_card->csd[3] >> 3) & 0x0F] * unit;
+}
+
+uint32_t sd_get_speed(void) {
+	return sd_card->spi_clock;
+}
+
+uint32_t sd_get_au_blocks(void) {
+	uint8_t au_size;
+
+	/* AU_SIZE, SD Status bits 431:428: 16KB doubling up to 4MB at 9,
+	 * then 8, 12, 16, 24, 32 and 64MB. 0 if not defined or not read. */
+	au_size = sd_card->ssr[10] >> 4;
+	if (au_size == 0)
+		return 0;
+	if (au_size <= 9)
+		return (16384 / SD_BLOCK_LENGTH) << (au_size - 1);
+
+	switch (au_size) {
+		case 0xA: return (8UL << 20) / SD_BLOCK_LENGTH;
+		case 0xB: return (12UL << 20) / SD_BLOCK_LENGTH;
+		case 0xC: return (16UL << 20) / SD_BLOCK_LENGTH;
+		case 0xD: return (24UL << 20) / SD_BLOCK_LENGTH;
+		case 0xE: return (32UL << 20) / SD_BLOCK_LENGTH;
+		default:  return (64UL << 20) / SD_BLOCK_LENGTH;
+	}
+}
+
+uint32_t sd_get_erase_timeout_ms(uint32_t num_au) {
+	uint16_t erase_size;
+	uint8_t erase_timeout, erase_offset;
+
+	/* ERASE_SIZE (bits 423:408) AUs take ERASE_TIMEOUT (bits 407:402)
+	 * seconds to erase, plus ERASE_OFFSET (bits 401:400) seconds. */
+	erase_size = (sd_card->ssr[11] << 8) | sd_card->ssr[12];
+	erase_timeout = sd_card->ssr[13] >> 2;
+	erase_offset = sd_card->ssr[13] & 0x03;
+
+	/* Not supported by the card, fall back to the fixed deadline */
+	if (erase_size == 0 || erase_timeout == 0)
+		return SD_ERASE_TIMEOUT_MS;
+
+	return ((erase_timeout * 1000UL * num_au) / erase_size) + (erase_offset * 1000UL);
+}
+
+int sd_get_speed_class(void) {
+	/* SPEED_CLASS, SD Status bits 447:440 */
+	switch (sd_card->ssr[8]) {
+		case 1: return 2;
+		case 2: return 4;
+		case 3: return 6;
+		case 4: return 10;
+		default: return 0;
+	}
+}
+
+int sd_set_speed(uint32_t hz) {
+	int i, retVal;
+
+	/* Never go above what the SPI clock wiring is rated for */
+	if (hz == 0 || hz > SD_SPI_DATA_CLOCK)
+		hz = SD_SPI_DATA_CLOCK;
+
+	for (;;) {
+		sd_card->spi_clock = sd_spi_set_clock(hz);
+		sd_bus_clock = sd_card->spi_clock;
+
+		/* Verify the new clock with a few short CRC protected reads */
+		for (i = 0, retVal = 0; i < SD_SPEED_VERIFY_READS && retVal == 0; i++)
+			retVal = sd_read_csd();
+		if (retVal == 0)
+			break;
+
+		/* Give up once we are back at the initialization speed */
+		if (sd_card->spi_clock <= SD_SPI_INIT_CLOCK) {
+			sd_debug_print("* SD -- Failure: Reads fail even at initialization speed.", 0, 0);
+			return retVal;
+		}
+
+		/* Otherwise step down to the next slower divider */
+		sd_debug_print("* SD -- Reads failed verification, lowering SPI clock.", 0, 0);
+		SD_STATS_INC(retries);
+		hz = sd_card->spi_clock - 1;
+	}
+
+	sd_debug_print("* SD -- Success: SPI clock set and verified.", 0, 0);
+	return 0;
 }
 
 int sd_get_size(void) {
@@ -1105,11 +2427,11 @@ int sd_get_size(void) {
 
 	/* High capacity and standard capacity encode different information
 	 * to describe the size of the card. */
-	if (sd_high_capacity) {
+	if (sd_card->high_capacity) {
 		/* Extract the 22-bit C_SIZE field */
-		csd_c_size = (sd_csd[7] & 0x3F) << 16;
-		csd_c_size |= (sd_csd[8] << 8);
-		csd_c_size |= sd_csd[9];
+		csd_c_size = (sd_card->csd[7] & 0x3F) << 16;
+		csd_c_size |= (sd_card->csd[8] << 8);
+		csd_c_size |= sd_card->csd[9];
 		
 		/* Now compute the size */
 
@@ -1118,16 +2440,16 @@ int sd_get_size(void) {
 		csd_c_size *= 524288;
 	} else {
 		/* Extract the READ_BLOCK_LEN, C_SIZE_MULT fields */
-		csd_read_block_len = sd_csd[5] & 0x0F;
-		csd_c_size_mult = (sd_csd[9] & 0x3) << 1;
-		csd_c_size_mult |= ((sd_csd[10] & 0x80) >> 7);
+		csd_read_block_len = sd_card->csd[5] & 0x0F;
+		csd_c_size_mult = (sd_card->csd[9] & 0x3) << 1;
+		csd_c_size_mult |= ((sd_card->csd[10] & 0x80) >> 7);
 	
 		/* Extract the C_SIZE field */
 		/* Upper byte of the C_SIZE field */
-		csd_c_size = (((sd_csd[6] & 0x3) << 2) | ((sd_csd[7] & 0xC0) >> 6));
+		csd_c_size = (((sd_card->csd[6] & 0x3) << 2) | ((sd_card->csd[7] & 0xC0) >> 6));
 		csd_c_size <<= 8;
 		/* Lower byte of the C_SIZE field */
-		csd_c_size |= (((sd_csd[7] & 0x3F) << 2) | ((sd_csd[8] & 0xC0) >> 6));
+		csd_c_size |= (((sd_card->csd[7] & 0x3F) << 2) | ((sd_card->csd[8] & 0xC0) >> 6));
 
 		/* Now compute the size */
 		/* Capacity = 
@@ -1148,19 +2470,23 @@ int sd_get_size(void) {
 }
 
 int sd_init(void) {
-	int sd_legacy, timeout, retVal;
-	uint32_t argument;
+	int sd_legacy, timeout, retVal, i;
 	uint8_t response[5];
 
+	SD_STATS_BEGIN(SD_STATS_INIT);
+
 	timeout = 0;
-	sd_high_capacity = 0;
-	sd_block_len = 0;
+	sd_card->ready = 0;
+	sd_card->high_capacity = 0;
+	sd_card->crc_enabled = 1;
+	sd_card->crc_restore = 0;
+	sd_card->block_len = 0;
 
 	/* Initialize SPI bus */
 	sd_spi_init();
 
 	/* Send the idle command to put the SD card in idle mode */
-	sd_spi_command(SD_CMD0, 0x00, SD_CMD0_RL, response);
+	sd_spi_command_fixed(sd_frame_cmd0, SD_CMD0_RL, response);
 	if (response[0] != 0x01) {
 		sd_debug_print("* SD -- Failure: CMD0. Card did not enter idle mode. Response: ", response, SD_CMD0_RL);
 		return SD_ERROR_IDLE;
@@ -1171,8 +2497,7 @@ int sd_init(void) {
 
 	/* The lower 0-7 bits are the check pattern, bits 8-11 is the supply voltage information,
 	 * higher 12-31 bits are reserved. Supply voltage: 0001 for 2.7-3.6V. */
-	argument = (1<<8) | SD_CHECK_PATTERN; 
-	sd_spi_command(SD_CMD8, argument, SD_CMD8_RL, response);
+	sd_spi_command_fixed(sd_frame_cmd8, SD_CMD8_RL, response);
 	
 	/* Check if the illegal command bit is set in the R1 portion of the response,
 	 * if it was, remember that this is a legacy SD card. */
@@ -1200,19 +2525,19 @@ int sd_init(void) {
 	}
 	
 	/* Check the voltage range of the card with CMD58 */
-	sd_spi_command(SD_CMD58, 0x00, SD_CMD58_RL, response);
+	sd_spi_command_fixed(sd_frame_cmd58, SD_CMD58_RL, response);
 	
 	/* Check if the command returned illegal */
 	if ((response[0] & (1<<2)) == (1<<2)) {
 		sd_debug_print("* SD -- Failure: CMD58. Illegal command, not an SD card. Response: ", response, SD_CMD58_RL);
-		sd_mmc = 1;
+		sd_card->mmc = 1;
 	} else {
-		sd_mmc = 0;
+		sd_card->mmc = 0;
 	}
 	
 	/* Voltage range 3.2-3.3 is bit 20 of the packet, or bit 4 of the
 	 * 3rd response byte. */
-	if (!sd_mmc && ((response[2] & (1<<4)) != (1<<4))) {
+	if (!sd_card->mmc && ((response[2] & (1<<4)) != (1<<4))) {
 		sd_debug_print("* SD -- Failure: CMD58. Unsupported voltage range. Response: ", response, SD_CMD58_RL);
 		return SD_ERROR_VOLTAGE;
 	}
@@ -1222,17 +2547,17 @@ int sd_init(void) {
 		sd_debug_print("* SD -- Attempting to initialize with high capacity support...", 0, 0);
 
 	/* Attempt ACMD41 initialization if this is not an MMC card */
-	if (!sd_mmc) {
+	if (!sd_card->mmc) {
 		for (timeout = 0; timeout < SD_INIT_TIMEOUT; timeout++) {
-			sd_spi_command(SD_CMD55, 0x00, SD_CMD55_RL, response);
+			sd_spi_command_fixed(sd_frame_cmd55, SD_CMD55_RL, response);
 			//sd_spi_delay_clocks();
 			if (response[0] == 0x01) {
 				/* If high capacity support is enabled, and this is not a legacy SD card,
 				 * turn on the 30th bit of the argument to initialize with high capacity support */
 				if (!sd_legacy && SD_ENABLE_HCS)
-					sd_spi_command(SD_ACMD41, (1<<30), SD_ACMD41_RL, response);
+					sd_spi_command_fixed(sd_frame_acmd41_hcs, SD_ACMD41_RL, response);
 				else
-					sd_spi_command(SD_ACMD41, 0x00, SD_ACMD41_RL, response);
+					sd_spi_command_fixed(sd_frame_acmd41, SD_ACMD41_RL, response);
 
 				if ((response[0] & (1<<0)) == 0x00)
 					break;
@@ -1240,6 +2565,8 @@ int sd_init(void) {
 			}
 		}
 	
+		SD_STATS_ADD(retries, timeout);
+
 		/* Check if the command returned illegal */
 		if ((response[0] & (1<<2)) == (1<<2)) {
 			sd_debug_print("* SD -- Failure: ACMD41. Illegal command, not an SD card. Response: ", response, SD_CMD58_RL);
@@ -1253,19 +2580,20 @@ int sd_init(void) {
 		sd_debug_print("* SD -- Attempting to initialize with CMD1...", 0, 0);
 	}
 
-	if (timeout == SD_INIT_TIMEOUT || sd_mmc) {
+	if (timeout == SD_INIT_TIMEOUT || sd_card->mmc) {
 		/* Attempt CMD1 instead */
 		for (timeout = 0; timeout < SD_INIT_TIMEOUT; timeout++) {
 			/* If high capacity support is enabled, turn on the 30th bit of the argument */
 			if (!sd_legacy && SD_ENABLE_HCS)
-				sd_spi_command(SD_CMD1, (1<<30), SD_ACMD41_RL, response);
+				sd_spi_command_fixed(sd_frame_cmd1_hcs, SD_ACMD41_RL, response);
 			else
-				sd_spi_command(SD_CMD1, 0x00, SD_ACMD41_RL, response);
+				sd_spi_command_fixed(sd_frame_cmd1, SD_ACMD41_RL, response);
 
 			if ((response[0] & (1<<0)) == 0x00)
 				break;
 			//sd_spi_delay_clocks();
 		}
+		SD_STATS_ADD(retries, timeout);
 		/* Check if CMD1 timed out */
 		if (timeout == SD_INIT_TIMEOUT) {
 			sd_debug_print("* SD -- Failure: CMD1. Card initialization timed out. Response: ", response, SD_CMD1_RL);
@@ -1277,32 +2605,113 @@ int sd_init(void) {
 
 	if (!sd_legacy) {	
 		/* Check the voltage range of the card with CMD58 */
-		sd_spi_command(SD_CMD58, 0x00, SD_CMD58_RL, response);
-		/* Check if the card has powered up and its capacity */
-		if ((response[3] & (1<<7)) != 0x00) {
+		sd_spi_command_fixed(sd_frame_cmd58, SD_CMD58_RL, response);
+		/* Check if the card has powered up and its capacity, OCR bits
+		 * 31 and 30 (CCS) are bits 7 and 6 of the 1st OCR byte */
+		if ((response[1] & (1<<7)) != 0x00) {
 			/* Check cards' capacity */
-			if ((response[3] & (1<<6)) != 0x00) {
+			if ((response[1] & (1<<6)) != 0x00) {
 				sd_debug_print("* SD -- Success: CMD58. Card is high capacity.", 0, 0);
-				sd_high_capacity = 1;
+				sd_card->high_capacity = 1;
 			} else {
 				sd_debug_print("* SD -- Success: CMD58. Card is standard capacity.", 0, 0);
-				sd_high_capacity = 0;
+				sd_card->high_capacity = 0;
 			}
 		}
 	} else {
 		/* Legacy SD cards can't be high capacity */
 		sd_debug_print("* SD -- Legacy SD card. Card is standard capacity.", 0, 0);
-		sd_high_capacity = 0;
+		sd_card->high_capacity = 0;
 	}
 
+	/* Have the card check CRCs as well, we always compute them */
+	retVal = sd_set_crc(1);
+	if (retVal < 0)
+		return retVal;
+
 	/* Set our desired block length */
 	retVal = sd_set_block_len(SD_BLOCK_LENGTH);
 	if (retVal < 0)
 		return retVal;
 
-	/* Set the SPI Clock speed to 4MHz for data transfer
-	 * PCLK = 60MHz, SPI Rate = 4MHz = 60/15, S0SPCCR = 15 */
-	S0SPCCR = 15;
+	/* The SCR says which spec version the card follows, the SD Status
+	 * has the allocation unit fields from version 2.00 on. Neither is
+	 * essential, so failures are only noted. */
+	for (i = 0; i < SD_SSR_LENGTH; i++)
+		sd_card->ssr[i] = 0;
+	for (i = 0; i < SD_SCR_LENGTH; i++)
+		sd_card->scr[i] = 0;
+	if (SD_ENABLE_SD_STATUS && !sd_card->mmc && sd_read_scr() == 0) {
+		if ((sd_card->scr[0] & 0x0F) >= 2)
+			sd_read_sd_status();
+	}
+
+	/* Read the CSD at initialization speed to find out how fast the
+	 * card can go */
+	retVal = sd_read_csd();
+	if (retVal < 0)
+		return retVal;
+
+	/* Keep the CID, sd_resume() recognizes the card by it */
+	retVal = sd_read_cid();
+	if (retVal < 0)
+		return retVal;
+
+	/* Switch the SPI clock to data transfer speed */
+	retVal = sd_set_speed(sd_get_tran_speed());
+	if (retVal < 0)
+		return retVal;
+
+	sd_card->ready = 1;
+	SD_STATS_END(SD_STATS_INIT);
+
+	return 0;
+}
+
+/* Brings a card sd_init() has set up before back after a power-save or a
+ * recoverable error, without the identification sequence: the card type,
+ * capacity mode, block length and SPI clock found then are kept, and the
+ * card only has to answer CMD13 out of idle state and return the same CID
+ * at full speed. Falls back to sd_init() otherwise, e.g. when the card
+ * lost power or was swapped. */
+int sd_resume(void) {
+	uint8_t response[2], cid[SD_CID_LENGTH];
+	int i;
+
+	if (!sd_card->ready)
+		return sd_init();
+
+	SD_STATS_BEGIN(SD_STATS_RESUME);
+
+	/* Bring the bus back up at the data transfer clock right away */
+	sd_spi_bus_init();
+	sd_bus_clock = sd_spi_set_clock(sd_card->spi_clock);
+	sd_spi_deselect();
+	sd_spi_delay_clocks();
+
+	/* A card that lost power is back in idle state, or not answering */
+	sd_spi_command_fixed(sd_frame_cmd13, SD_CMD13_RL, response);
+	if (response[0] != 0x00) {
+		sd_debug_print("* SD -- Failure: CMD13. Card not ready for resume, reinitializing. Response: ", response, SD_CMD13_RL);
+		return sd_init();
+	}
+
+	/* Make sure it is still the same card */
+	for (i = 0; i < SD_CID_LENGTH; i++)
+		cid[i] = sd_card->cid[i];
+	if (sd_read_cid() < 0) {
+		sd_debug_print("* SD -- Failure: CMD10. No valid CID on resume, reinitializing.", 0, 0);
+		return sd_init();
+	}
+	for (i = 0; i < SD_CID_LENGTH; i++) {
+		if (sd_card->cid[i] != cid[i]) {
+			sd_debug_print("* SD -- Failure: CMD10. Card was changed, reinitializing.", 0, 0);
+			return sd_init();
+		}
+	}
+
+	sd_debug_print("* SD -- Success: Card resumed.", 0, 0);
+	SD_STATS_END(SD_STATS_RESUME);
 
 	return 0;
 }
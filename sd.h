@@ -5,39 +5,164 @@
  *
  */
 
+#ifndef _SD_H
+#define _SD_H
+
 /* Following features of the SD spec have been omitted:
 	* Set/Clear/Inquire write protection blocks
 	* Lock/Unlock via password
 	* Program CSD
 	* Switch card function (CMD6)
-	* Command CRC on/off (CRC is always computed and encoded)
-	* All application commands except for initialization (ACMD41)
+	* Application commands other than ACMD41 (initialization), ACMD13
+	  (SD Status), ACMD23 (pre-erase) and ACMD51 (SCR)
  */
 
-#include "lpc21xx.h"
 #include "stdint.h"
 
+/* SPI peripheral the card is wired to:
+ *	SD_SPI_BUS_SPI0	- legacy SPI0, no FIFO, SCK0 at most PCLK/8
+ *	SD_SPI_BUS_SSP	- LPC214x SSP (SPI1), 8 frame FIFOs, SCK1 up to PCLK/2
+ *	SD_SPI_BUS_PORT	- provided by the application through the sd_port_*()
+ *			  functions below: another MCU's SPI, a bit-banged
+ *			  port, or a card model when running on a host
+ * Can be set from the compiler command line, see tools/sd_card_sim.h. */
+#define SD_SPI_BUS_SPI0		0
+#define SD_SPI_BUS_SSP		1
+#define SD_SPI_BUS_PORT		2
+#ifndef SD_SPI_BUS
+#define SD_SPI_BUS		SD_SPI_BUS_SPI0
+#endif
+
+#if SD_SPI_BUS == SD_SPI_BUS_SSP
+#include "lpc214x.h"
+#elif SD_SPI_BUS == SD_SPI_BUS_SPI0
+#include "lpc21xx.h"
+#endif
+
+#if SD_SPI_BUS == SD_SPI_BUS_PORT
+/* Bus port: set up the SPI pins/peripheral (mode 0, MSB first), set the
+ * clock as close to hz as possible without exceeding it and return it,
+ * exchange a byte, drive chip select, and read the switches. */
+void sd_port_init(void);
+uint32_t sd_port_set_clock(uint32_t hz);
+uint8_t sd_port_exchange(uint8_t data);
+void sd_port_select(void);
+void sd_port_deselect(void);
+uint8_t sd_port_card_detect(void);
+uint8_t sd_port_write_protect(void);
+#endif
+
+/* Peripheral clock feeding the SPI block, in Hz */
+#define SD_PCLK			60000000
+/* SPI clock during card initialization (at most 400KHz) */
+#define SD_SPI_INIT_CLOCK	400000
+/* Ceiling for the data transfer SPI clock. sd_init() runs the card at its
+ * CSD TRAN_SPEED, capped to this, with the fastest divider the backend
+ * has that doesn't exceed it */
+#define SD_SPI_DATA_CLOCK	25000000
+/* Number of CSD reads used to verify a new SPI clock before trusting it */
+#define SD_SPEED_VERIFY_READS	4
+
 /* Arbitrary SD check pattern data */
 #define SD_CHECK_PATTERN	0x55
 /* Slightly arbitrary initialization timeout count */
 #define SD_INIT_TIMEOUT		900
 /* Enable or disable high capacity support */
 #define SD_ENABLE_HCS		1
+/* Have sd_init() read the SCR and SD Status of SD cards, for the
+ * allocation unit size, erase timing and speed class */
+#define SD_ENABLE_SD_STATUS	1
 /* Desired block length */
 #define SD_BLOCK_LENGTH		512
+/* Fix the block length at SD_BLOCK_LENGTH at compile time, so the block
+ * arithmetic on every transfer turns into masks and shifts. Set to 0 to
+ * keep the block length chosen at runtime with sd_set_block_len(). */
+#define SD_FIXED_BLOCK_LENGTH	1
+/* log2(SD_BLOCK_LENGTH), for SD_FIXED_BLOCK_LENGTH */
+#define SD_BLOCK_SHIFT		9
+/* Blocks the driver can reach: addresses are 32-bit byte addresses, on
+ * SDHC cards too, so only the first 4GB of a card is addressable */
+#define SD_MAX_BLOCKS		(0x100000000ULL / SD_BLOCK_LENGTH)
+
+/* CRC16 engine used for data blocks, CSD and CID:
+ *	SD_CRC16_BITWISE - bit-serial, no tables (smallest, slowest)
+ *	SD_CRC16_TABLE	 - 256-entry table, 512 bytes of flash
+ *	SD_CRC16_SLICE4	 - slicing-by-4, tables built in 2KB of RAM
+ *	SD_CRC16_SLICE8	 - slicing-by-8, tables built in 4KB of RAM
+ * Can be set from the compiler command line, see tools/sd_crc_bench.c. */
+#define SD_CRC16_BITWISE	0
+#define SD_CRC16_TABLE		1
+#define SD_CRC16_SLICE4		4
+#define SD_CRC16_SLICE8		8
+#ifndef SD_CRC16_MODE
+#define SD_CRC16_MODE		SD_CRC16_TABLE
+#endif
+
+/* Deadlines for the card to finish programming (CMD24/CMD25/CMD12) and
+ * erasing (CMD38), in milliseconds. The SD spec allows 250ms per write
+ * (500ms for SDXC) and 250ms per erased allocation unit. Erases use the
+ * card's own figures when it reports them, see sd_get_erase_timeout_ms(). */
+#define SD_WRITE_TIMEOUT_MS	500
+#define SD_ERASE_TIMEOUT_MS	30000
 
 /* Debugging options */
 //#define SD_DEBUG
 
+/* Performance counters (see SD_Stats below), compiled out entirely unless
+ * SD_STATS is defined. Timings are taken from SD_STATS_CYCLES(), any
+ * free-running 32-bit up counter will do; the default is Timer 1, which
+ * the application has to start. */
+//#define SD_STATS
+#ifndef SD_STATS_CYCLES
+#define SD_STATS_CYCLES()	(T1TC)
+#endif
+
 /* SD Chip Select pin defnitions */
 #define SD_CS_IODIR		FIO0DIR
 #define SD_CS_IOSET		FIO0SET
 #define SD_CS_IOCLR		FIO0CLR
 #define SD_CS_PIN		(1<<7)
 
+/* Number of cards on the bus (at most 2). They share the SPI bus and the
+ * card detect and write protect pins, and each has its own chip select:
+ * card 0 SD_CS_PIN, card 1 SD_CS1_PIN. With SD_SPI_BUS_PORT the port can
+ * look at sd_get_card() in sd_port_select() instead. Can be set from the
+ * compiler command line, see tools/sd_stripe_test.c. */
+#ifndef SD_NUM_CARDS
+#define SD_NUM_CARDS		1
+#endif
+#ifndef SD_CS1_PIN
+#define SD_CS1_PIN		(1<<8)
+#endif
+
+/* SD card detect and write protect switch pins on port 0. The defaults
+ * overlap the SSP pins, move them for SD_SPI_BUS_SSP. */
+#ifndef SD_CD_PIN
+#define SD_CD_PIN		(1<<18)
+#endif
+#ifndef SD_WP_PIN
+#define SD_WP_PIN		(1<<19)
+#endif
+
+/* The SSP takes over P0.17-P0.19 for SCK1/MISO1/MOSI1 */
+#if SD_SPI_BUS == SD_SPI_BUS_SSP
+#if ((SD_CD_PIN|SD_WP_PIN|SD_CS_PIN) & ((1<<17)|(1<<18)|(1<<19))) || \
+    (SD_NUM_CARDS > 1 && (SD_CS1_PIN & ((1<<17)|(1<<18)|(1<<19))))
+#error "Error: SD card detect, write protect or chip select pin overlaps the SSP pins P0.17-P0.19. Please move them."
+#endif
+#endif
+
 /* SD Chip Select macros */
+#if SD_SPI_BUS == SD_SPI_BUS_PORT
+#define sd_spi_select()		sd_port_select()
+#define sd_spi_deselect()	sd_port_deselect()
+#elif SD_NUM_CARDS > 1
+#define sd_spi_select()		(SD_CS_IOCLR = sd_card->cs_pin)
+#define sd_spi_deselect()	(SD_CS_IOSET = sd_card->cs_pin)
+#else
 #define sd_spi_select()		(SD_CS_IOCLR = SD_CS_PIN)
 #define sd_spi_deselect()	(SD_CS_IOSET = SD_CS_PIN) 
+#endif
 
 /* Constants associated with the SD SPI protocol */
 #define SD_SPI_CMD_READ_ATTEMPTS		10
@@ -50,6 +175,8 @@
 #define SD_SPI_BUSY				0x00
 #define SD_CSD_LENGTH				16
 #define SD_CID_LENGTH				16
+#define SD_SCR_LENGTH				8
+#define SD_SSR_LENGTH				64
 #define SD_HCS_BLOCK_LENGTH			512
 
 /* SD SPI Commands */
@@ -128,6 +255,9 @@
 /* Turn on/off the CRC option. */
 #define SD_CMD59	59
 #define SD_CMD59_RL	SD_R1
+/* Read the SD Status register. */
+#define SD_ACMD13	13
+#define SD_ACMD13_RL	SD_R2
 /* Set pre-erase write blocks. */
 #define SD_ACMD23	23
 #define SD_ACMD23_RL	SD_R1
@@ -135,6 +265,9 @@
  * card initialization. */
 #define SD_ACMD41	41
 #define SD_ACMD41_RL	SD_R1
+/* Read the SD Configuration Register. */
+#define SD_ACMD51	51
+#define SD_ACMD51_RL	SD_R1
 
 /* Possible SD card initialization and command errors */
 enum SD_ERRORS {
@@ -179,6 +312,31 @@ enum SD_ERRORS {
 
 	SD_ERROR_APP_CMD		 = -34,
 	SD_ERROR_PRE_ERASE		 = -35,
+
+	SD_ERROR_WRITE_TIMEOUT		 = -36,
+	SD_ERROR_ERASE_TIMEOUT		 = -37,
+	SD_ERROR_STOP_TIMEOUT		 = -38,
+	SD_ERROR_QUEUE_FULL		 = -39,
+	SD_ERROR_CRC_OPTION		 = -40,
+	SD_ERROR_GET_SCR		 = -41,
+	SD_ERROR_GET_SCR_CRC		 = -42,
+	SD_ERROR_GET_SSR		 = -43,
+	SD_ERROR_GET_SSR_CRC		 = -44,
+	SD_ERROR_POOL_FULL		 = -45,
+	SD_ERROR_FAT_NO_FS		 = -46,
+	SD_ERROR_FAT_UNSUPPORTED	 = -47,
+	SD_ERROR_FAT_NOT_FOUND		 = -48,
+	SD_ERROR_FAT_NOT_FILE		 = -49,
+	SD_ERROR_FAT_BAD_NAME		 = -50,
+	SD_ERROR_FAT_FULL		 = -51,
+	SD_ERROR_FAT_DIR_FULL		 = -52,
+	SD_ERROR_FAT_CHAIN		 = -53,
+	SD_ERROR_FAT_EOF		 = -54,
+	SD_ERROR_FAT_MODE		 = -55,
+	SD_ERROR_LOG_CONFIG		 = -56,
+	SD_ERROR_CARD_INDEX		 = -57,
+	SD_ERROR_VERIFY			 = -58,
+	SD_ERROR_POOL_OVERLAP		 = -59,
 };
 
 /* SD Status Register error bits */
@@ -200,39 +358,145 @@ enum SD_Status_Errors {
 	SD_STATUS_ERROR_PARAM_ERROR	= (1<<14),
 };
 
+/* Histograms kept in SD_Stats.latency */
+#define SD_STATS_CMD17		0
+#define SD_STATS_CMD18		1
+#define SD_STATS_CMD24		2
+#define SD_STATS_CMD25		3
+#define SD_STATS_CMD38		4
+#define SD_STATS_BUSY		5
+#define SD_STATS_INIT		6
+#define SD_STATS_RESUME		7
+#define SD_STATS_HISTS		8
+/* Bin i counts durations of 2^i to 2^(i+1)-1 cycles, bin 0 also counts 0 */
+#define SD_STATS_BINS		32
+
+typedef struct _SD_Stats {
+	/* Commands issued by index, application commands separately */
+	uint32_t commands[64];
+	uint32_t app_commands[64];
+	/* Data block bytes moved */
+	uint32_t bytes_read;
+	uint32_t bytes_written;
+	/* Repeated ACMD41/CMD1 polls and SPI clock step-downs */
+	uint32_t retries;
+	/* Data, CSD and CID blocks that failed their CRC16 */
+	uint32_t crc_errors;
+	/* Busy waits, and the cycles spent in them */
+	uint32_t busy_waits;
+	uint32_t busy_cycles;
+	uint32_t busy_max;
+	/* Log2 histograms of successful CMD17/18/24/25/38 operations, command
+	 * to last data block or end of erase (CMD18 up to its stop, CMD25 up
+	 * to the end of the busy after it), of busy waits, and of sd_init()
+	 * and sd_resume() up to a ready card */
+	uint32_t latency[SD_STATS_HISTS][SD_STATS_BINS];
+} SD_Stats;
+
+/* Everything the driver knows about one card. sd_card points at the one
+ * the sd_* functions talk to, see sd_select_card(). */
+typedef struct _SD_Card {
+	int high_capacity;
+	int block_len;
+	int mmc;
+	uint8_t csd[SD_CSD_LENGTH];
+	uint8_t cid[SD_CID_LENGTH];
+	uint8_t scr[SD_SCR_LENGTH];
+	uint8_t ssr[SD_SSR_LENGTH];
+	/* Data transfer SPI clock in Hz, 0 until sd_init() sets it */
+	uint32_t spi_clock;
+	/* CRC checking state, see sd_set_crc() */
+	int crc_enabled;
+	uint32_t crc_fallbacks;
+	int crc_restore;
+	uint32_t cs_pin;
+	/* sd_init() completed, sd_resume() can skip identification */
+	int ready;
+} SD_Card;
+
+extern SD_Card *sd_card;
+
+/* One segment of a scattered buffer for sd_readv() / sd_writev() */
+typedef struct _SD_IOVec {
+	uint8_t *base;
+	int len;
+} SD_IOVec;
+
 void sd_cd_wp_init(void);
 uint8_t sd_card_detect(void);
 uint8_t sd_write_protect(void);
 
 void sd_spi_init(void);
+uint32_t sd_spi_set_clock(uint32_t hz);
 void sd_spi_send(uint8_t data);
 uint8_t sd_spi_receive(void);
 void sd_spi_delay_clocks(void);
+void sd_spi_transfer(const uint8_t *tx, uint8_t *rx, int len);
+void sd_spi_send_block(const uint8_t *data, int dataLen);
+void sd_spi_receive_block(uint8_t *data, int dataLen);
 uint8_t sd_crc7_bits(uint8_t data, uint8_t seed);
 uint8_t sd_crc7_packet(const uint8_t *data, int dataLen);
 uint16_t sd_crc16_bits(uint8_t data, uint16_t seed);
+uint16_t sd_crc16_update(uint16_t seed, const uint8_t *data, int dataLen);
 uint16_t sd_crc16_data(const uint8_t *data, int dataLen);
+uint16_t sd_spi_send_block_crc16(uint16_t seed, const uint8_t *data, int dataLen);
+uint16_t sd_spi_receive_block_crc16(uint16_t seed, uint8_t *data, int dataLen);
 void sd_spi_command(uint8_t command, uint32_t argument, int responseLength, uint8_t *response);
+void sd_set_idle_hook(void (*hook)(void));
+int sd_busy_poll(void);
+int sd_busy_wait(uint32_t timeout_ms);
 
 void sd_debug_print_boolean(uint8_t data);
 void sd_debug_print_csd(void);
 void sd_debug_print_cid(void);
 void sd_debug_print_data_block(uint8_t *data);
 void sd_debug_print(char *message, uint8_t *data, int dataLen);
+#ifdef SD_STATS
+extern SD_Stats sd_stats;
+void sd_debug_print_stats(void);
+void sd_stats_clear(void);
+#endif
+void sd_stats_done(int hist);
 
 int sd_read_csd(void);
 int sd_read_cid(void);
+int sd_read_scr(void);
+int sd_read_sd_status(void);
 int sd_write_block(uint32_t address, const uint8_t *data);
 int sd_write_blocks(uint32_t address, const uint8_t *data, int dataLen);
+int sd_write_blocks_start(uint32_t address);
+int sd_write_blocks_next(const uint8_t *data);
+void sd_write_blocks_stop(void);
 int sd_read_block(uint32_t address, uint8_t *data);
 int sd_read_blocks(uint32_t address, uint8_t *data, int dataLen);
+int sd_read_blocks_start(uint32_t address);
+int sd_read_blocks_next(uint8_t *data);
+int sd_read_blocks_next_crc16(uint16_t *crc16);
+int sd_read_blocks_stop(void);
+int sd_writev(uint32_t address, const SD_IOVec *iov, int iovcnt);
+int sd_readv(uint32_t address, const SD_IOVec *iov, int iovcnt);
+int sd_stop_block_transmission(void);
 int sd_pre_erase(uint32_t num_blocks);
 int sd_read_status(uint16_t *sd_status);
 int sd_is_mmc(void);
 int sd_get_block_len(void);
 int sd_get_high_capacity(void);
 int sd_get_size(void);
+uint32_t sd_get_tran_speed(void);
+uint32_t sd_get_speed(void);
+uint32_t sd_get_au_blocks(void);
+uint32_t sd_get_erase_timeout_ms(uint32_t num_au);
+int sd_get_speed_class(void);
+int sd_set_speed(uint32_t hz);
 int sd_set_block_len(uint32_t block_len);
+int sd_set_crc(int enable);
+int sd_get_crc(void);
+uint32_t sd_get_crc_fallbacks(void);
 int sd_init(void);
+int sd_resume(void);
+int sd_select_card(int card);
+int sd_get_card(void);
 int sd_erase_blocks(uint32_t address_start, uint32_t address_end);
+int sd_erase_blocks_start(uint32_t address_start, uint32_t address_end);
 
+#endif
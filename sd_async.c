@@ -0,0 +1,317 @@
+/* Asynchronous request queue for the SD/SPI driver
+ *
+ * Vanya A. Sergeev - <vsergeev@gmail.com> - copyright 2010
+ * please inform author of possible use, licensing is still being decided
+ *
+ */
+
+#include "sd_async.h"
+
+/* Request states */
+#define SD_REQ_FREE		0
+#define SD_REQ_PENDING		1
+#define SD_REQ_ACTIVE		2
+
+/* Engine states */
+#define SD_ASYNC_IDLE		0
+#define SD_ASYNC_READING	1
+#define SD_ASYNC_WRITING	2
+#define SD_ASYNC_WRITE_BUSY	3
+#define SD_ASYNC_STOP_BUSY	4
+
+typedef struct _SD_Request {
+	uint8_t state;
+	uint8_t op;
+	uint32_t lba;
+	uint8_t *buf;
+	int nblocks;
+	SD_Async_Callback cb;
+	/* Submission order */
+	uint32_t seq;
+	/* Next request merged into the same transfer, -1 for none */
+	int next;
+} SD_Request;
+
+static SD_Request sd_async_queue[SD_ASYNC_QUEUE_LENGTH];
+static uint32_t sd_async_seq;
+
+static int sd_async_state = SD_ASYNC_IDLE;
+/* Request being transferred and the block within it */
+static int sd_async_current;
+static int sd_async_block;
+/* Error to report for the current run */
+static int sd_async_result;
+/* Busy probes left before the card is given up on */
+static uint32_t sd_async_probes;
+
+static int sd_async_overlap(SD_Request *a, SD_Request *b) {
+	return (a->lba < b->lba + b->nblocks) && (b->lba < a->lba + a->nblocks);
+}
+
+/* Non-zero if request r can't be carried out yet because an older
+ * pending request touches the same blocks and one of them is a write. */
+static int sd_async_conflicts(int r) {
+	SD_Request *req, *older;
+	int i;
+
+	req = &sd_async_queue[r];
+	for (i = 0; i < SD_ASYNC_QUEUE_LENGTH; i++) {
+		older = &sd_async_queue[i];
+		if (older->state != SD_REQ_PENDING || (int32_t)(older->seq - req->seq) >= 0)
+			continue;
+		if ((older->op == SD_ASYNC_WRITE || req->op == SD_ASYNC_WRITE) &&
+		    sd_async_overlap(older, req))
+			return 1;
+	}
+
+	return 0;
+}
+
+static void sd_async_finish(int r, int result) {
+	SD_Request *req;
+
+	req = &sd_async_queue[r];
+	req->state = SD_REQ_FREE;
+	if (req->cb != 0)
+		req->cb(req->op, req->lba, req->buf, result);
+}
+
+/* Fails the current request and puts the rest of its run back in the
+ * queue, where they will be retried on their own. */
+static void sd_async_abort(int result) {
+	int r, next;
+
+	r = sd_async_current;
+	next = sd_async_queue[r].next;
+	sd_async_finish(r, result);
+
+	for (r = next; r >= 0; r = sd_async_queue[r].next)
+		sd_async_queue[r].state = SD_REQ_PENDING;
+
+	sd_async_state = SD_ASYNC_IDLE;
+}
+
+/* Picks the next run of requests and marks them active. Returns the
+ * total number of blocks in it, 0 if the queue is empty. */
+static int sd_async_pick(void) {
+	SD_Request *req;
+	uint32_t end;
+	int i, r, tail, count;
+
+	/* Reads first, somebody is usually waiting on them, as long as they
+	 * don't overtake a write to the same blocks. Otherwise the oldest
+	 * request, which can't conflict with anything. */
+	r = -1;
+	for (i = 0; i < SD_ASYNC_QUEUE_LENGTH; i++) {
+		req = &sd_async_queue[i];
+		if (req->state != SD_REQ_PENDING || req->op != SD_ASYNC_READ)
+			continue;
+		if ((r < 0 || (int32_t)(req->seq - sd_async_queue[r].seq) < 0) && !sd_async_conflicts(i))
+			r = i;
+	}
+	if (r < 0) {
+		for (i = 0; i < SD_ASYNC_QUEUE_LENGTH; i++) {
+			req = &sd_async_queue[i];
+			if (req->state != SD_REQ_PENDING)
+				continue;
+			if (r < 0 || (int32_t)(req->seq - sd_async_queue[r].seq) < 0)
+				r = i;
+		}
+	}
+	if (r < 0)
+		return 0;
+
+	sd_async_current = r;
+	sd_async_queue[r].state = SD_REQ_ACTIVE;
+	sd_async_queue[r].next = -1;
+	count = sd_async_queue[r].nblocks;
+	end = sd_async_queue[r].lba + count;
+
+	/* Merge in requests of the same kind that continue where the run
+	 * ends, for as long as that is safe */
+	for (tail = r, i = 0; i < SD_ASYNC_QUEUE_LENGTH; ) {
+		req = &sd_async_queue[i];
+		if (req->state == SD_REQ_PENDING && req->op == sd_async_queue[r].op &&
+		    req->lba == end && !sd_async_conflicts(i)) {
+			req->state = SD_REQ_ACTIVE;
+			req->next = -1;
+			sd_async_queue[tail].next = i;
+			tail = i;
+			count += req->nblocks;
+			end += req->nblocks;
+			/* Start over, an earlier slot may continue the new end */
+			i = 0;
+			continue;
+		}
+		i++;
+	}
+
+	return count;
+}
+
+static void sd_async_start(void) {
+	SD_Request *req;
+	int count, retVal;
+
+	count = sd_async_pick();
+	if (count == 0)
+		return;
+
+	req = &sd_async_queue[sd_async_current];
+	sd_async_block = 0;
+	sd_async_result = 0;
+
+	if (req->op == SD_ASYNC_READ) {
+		retVal = sd_read_blocks_start(req->lba*SD_BLOCK_LENGTH);
+		sd_async_state = SD_ASYNC_READING;
+	} else {
+		/* Let an SD card erase the whole run up front */
+		if (count > 1 && !sd_is_mmc())
+			sd_pre_erase(count);
+		retVal = sd_write_blocks_start(req->lba*SD_BLOCK_LENGTH);
+		sd_async_state = SD_ASYNC_WRITING;
+	}
+
+	if (retVal < 0)
+		sd_async_abort(retVal);
+}
+
+/* Moves on to the next block of the run, completing the current request
+ * if that was its last block. Returns 0 once the run is complete. */
+static int sd_async_advance(void) {
+	int r;
+
+	if (++sd_async_block < sd_async_queue[sd_async_current].nblocks)
+		return 1;
+
+	r = sd_async_current;
+	sd_async_current = sd_async_queue[r].next;
+	sd_async_block = 0;
+	sd_async_finish(r, 0);
+
+	return (sd_async_current >= 0);
+}
+
+int sd_submit(uint8_t op, uint32_t lba, uint8_t *buf, int nblocks, SD_Async_Callback cb) {
+	SD_Request *req;
+	int i;
+
+	if (nblocks <= 0)
+		return (op == SD_ASYNC_READ) ? SD_ERROR_READ_DATALEN_MULTIPLE : SD_ERROR_WRITE_DATALEN_MULTIPLE;
+	/* The byte address of the last block has to fit in 32 bits */
+	if (lba >= SD_MAX_BLOCKS || (uint32_t)nblocks > SD_MAX_BLOCKS - lba)
+		return (op == SD_ASYNC_READ) ? SD_ERROR_READ_ADDR_OUTBOUNDS : SD_ERROR_WRITE_ADDR_OUTBOUNDS;
+
+	for (i = 0; i < SD_ASYNC_QUEUE_LENGTH; i++) {
+		req = &sd_async_queue[i];
+		if (req->state != SD_REQ_FREE)
+			continue;
+
+		req->op = op;
+		req->lba = lba;
+		req->buf = buf;
+		req->nblocks = nblocks;
+		req->cb = cb;
+		req->seq = sd_async_seq++;
+		req->next = -1;
+		req->state = SD_REQ_PENDING;
+		return 0;
+	}
+
+	return SD_ERROR_QUEUE_FULL;
+}
+
+int sd_async_poll(void) {
+	SD_Request *req;
+	int retVal;
+
+	switch (sd_async_state) {
+		case SD_ASYNC_IDLE:
+			sd_async_start();
+			break;
+
+		case SD_ASYNC_READING:
+			req = &sd_async_queue[sd_async_current];
+			retVal = sd_read_blocks_next(req->buf + sd_async_block*SD_BLOCK_LENGTH);
+			if (retVal < 0) {
+				sd_read_blocks_stop();
+				sd_async_abort(retVal);
+				break;
+			}
+			if (!sd_async_advance()) {
+				if (sd_read_blocks_stop() == 0)
+					sd_stats_done(SD_STATS_CMD18);
+				sd_async_state = SD_ASYNC_IDLE;
+			}
+			break;
+
+		case SD_ASYNC_WRITING:
+			req = &sd_async_queue[sd_async_current];
+			sd_async_result = sd_write_blocks_next(req->buf + sd_async_block*SD_BLOCK_LENGTH);
+			sd_async_probes = (sd_get_speed() / 8000) * SD_WRITE_TIMEOUT_MS;
+			sd_async_state = SD_ASYNC_WRITE_BUSY;
+			break;
+
+		case SD_ASYNC_WRITE_BUSY:
+			/* Check on the card once and come back later if it's busy */
+			if (sd_busy_poll()) {
+				if (sd_async_probes-- != 0)
+					break;
+				sd_async_result = SD_ERROR_WRITE_TIMEOUT;
+			}
+			sd_spi_delay_clocks();
+
+			/* End the transfer after a rejected block or the last one.
+			 * The run's last request stays current, it only completes
+			 * once the card has taken the stop. */
+			req = &sd_async_queue[sd_async_current];
+			if (sd_async_result < 0 || (sd_async_block+1 == req->nblocks && req->next < 0)) {
+				sd_write_blocks_stop();
+				sd_async_probes = (sd_get_speed() / 8000) * SD_WRITE_TIMEOUT_MS;
+				sd_async_state = SD_ASYNC_STOP_BUSY;
+			} else {
+				sd_async_advance();
+				sd_async_state = SD_ASYNC_WRITING;
+			}
+			break;
+
+		case SD_ASYNC_STOP_BUSY:
+			if (sd_busy_poll()) {
+				if (sd_async_probes-- == 0) {
+					if (sd_async_result == 0)
+						sd_async_result = SD_ERROR_WRITE_TIMEOUT;
+				} else {
+					break;
+				}
+			} else {
+				sd_spi_delay_clocks();
+			}
+
+			if (sd_async_result < 0) {
+				sd_async_abort(sd_async_result);
+			} else {
+				sd_stats_done(SD_STATS_CMD25);
+				sd_async_finish(sd_async_current, 0);
+			}
+			sd_async_state = SD_ASYNC_IDLE;
+			break;
+	}
+
+	return sd_async_pending();
+}
+
+int sd_async_pending(void) {
+	int i, count;
+
+	for (i = 0, count = 0; i < SD_ASYNC_QUEUE_LENGTH; i++) {
+		if (sd_async_queue[i].state != SD_REQ_FREE)
+			count++;
+	}
+
+	return count;
+}
+
+void sd_async_flush(void) {
+	while (sd_async_poll() > 0)
+		;
+}
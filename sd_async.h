@@ -0,0 +1,45 @@
+/* Asynchronous request queue for the SD/SPI driver
+ *
+ * Vanya A. Sergeev - <vsergeev@gmail.com> - copyright 2010
+ * please inform author of possible use, licensing is still being decided
+ *
+ */
+
+/* sd_submit() queues a block read or write and returns right away. The
+ * transfers are carried out by sd_async_poll(), which does at most one
+ * block transfer or one busy probe per call and is meant to be called
+ * from the main loop (or a timer interrupt). A request's callback fires
+ * once its data has been received, or once the card has finished
+ * programming it. The last write of a CMD25 transfer completes after the
+ * card has also taken the stop, so an error there reaches its callback.
+ *
+ * Queued requests may be reordered and merged: a read may overtake older
+ * writes to other blocks, and requests of the same kind to contiguous
+ * blocks share a single CMD18 or ACMD23 + CMD25 transfer. Requests
+ * touching the same blocks are always carried out in submission order,
+ * unless they are all reads.
+ *
+ * Block numbers are in units of SD_BLOCK_LENGTH, requests reaching past
+ * SD_MAX_BLOCKS are refused. Callbacks may submit new requests, but no
+ * other sd_* function may be used while requests are outstanding. */
+
+#ifndef _SD_ASYNC_H
+#define _SD_ASYNC_H
+
+#include "sd.h"
+
+/* Maximum number of outstanding requests */
+#define SD_ASYNC_QUEUE_LENGTH	8
+
+/* Request operations */
+#define SD_ASYNC_READ		0
+#define SD_ASYNC_WRITE		1
+
+typedef void (*SD_Async_Callback)(uint8_t op, uint32_t lba, uint8_t *buf, int result);
+
+int sd_submit(uint8_t op, uint32_t lba, uint8_t *buf, int nblocks, SD_Async_Callback cb);
+int sd_async_poll(void);
+int sd_async_pending(void);
+void sd_async_flush(void);
+
+#endif
@@ -0,0 +1,72 @@
+/* Allocation unit aware writes for the SD/SPI driver
+ *
+ * Vanya A. Sergeev - <vsergeev@gmail.com> - copyright 2010
+ * please inform author of possible use, licensing is still being decided
+ *
+ */
+
+#include "sd_au.h"
+
+static uint32_t sd_au_blocks(void) {
+	uint32_t au;
+
+	au = sd_get_au_blocks();
+	if (au == 0)
+		au = SD_AU_DEFAULT_BLOCKS;
+
+	return au;
+}
+
+/* Number of blocks of the first burst of a write: up to the next AU
+ * boundary at most */
+uint32_t sd_au_burst(uint32_t lba, uint32_t nblocks) {
+	uint32_t au, left;
+
+	au = sd_au_blocks();
+	if (au == 0)
+		return nblocks;
+
+	left = au - (lba % au);
+
+	return (nblocks < left) ? nblocks : left;
+}
+
+int sd_au_write(uint32_t lba, const uint8_t *data, uint32_t nblocks) {
+	uint32_t au, n;
+	int retVal;
+
+	/* The byte address of the last block has to fit in 32 bits */
+	if (lba >= SD_MAX_BLOCKS || nblocks > SD_MAX_BLOCKS - lba)
+		return SD_ERROR_WRITE_ADDR_OUTBOUNDS;
+
+	au = sd_au_blocks();
+
+	while (nblocks > 0) {
+		n = sd_au_burst(lba, nblocks);
+
+		if (!sd_is_mmc()) {
+			if (au != 0 && (lba % au) == 0 && n < au) {
+				/* Entering a fresh AU that this burst won't fill,
+				 * erase all of it up front */
+				retVal = sd_erase_blocks(lba*SD_BLOCK_LENGTH, (lba + au - 1)*SD_BLOCK_LENGTH);
+				if (retVal < 0)
+					return retVal;
+			}
+
+			/* Pre-erase the burst (a whole AU if it fills one) */
+			retVal = sd_pre_erase(n);
+			if (retVal < 0)
+				return retVal;
+		}
+
+		retVal = sd_write_blocks(lba*SD_BLOCK_LENGTH, data, n*SD_BLOCK_LENGTH);
+		if (retVal < 0)
+			return retVal;
+
+		lba += n;
+		data += n*SD_BLOCK_LENGTH;
+		nblocks -= n;
+	}
+
+	return 0;
+}
@@ -0,0 +1,37 @@
+/* Allocation unit aware writes for the SD/SPI driver
+ *
+ * Vanya A. Sergeev - <vsergeev@gmail.com> - copyright 2010
+ * please inform author of possible use, licensing is still being decided
+ *
+ */
+
+/* SD cards manage their flash in allocation units (AUs) of 16KB to 64MB,
+ * reported in the SD Status (see sd_get_au_blocks()). A card writes
+ * fastest, and its speed class is only guaranteed, when recording into
+ * erased AUs; bursts that straddle an AU boundary or land in a partly
+ * used AU can stall for the card's internal copying.
+ *
+ * sd_au_write() is meant for sequential recorders (video, telemetry). It
+ * splits a write into bursts that never cross an AU boundary, each sent
+ * as ACMD23 + CMD25. Whenever a burst starts at the beginning of an AU
+ * the whole AU is erased first (or pre-erased with ACMD23 if the burst
+ * fills it), so the rest of the AU is written into erased blocks.
+ * Anything stored in the remainder of such an AU is lost.
+ *
+ * Block numbers are in units of SD_BLOCK_LENGTH, writes reaching past
+ * SD_MAX_BLOCKS are refused. Without an AU size from the card (MMC,
+ * SD 1.x, or SD_ENABLE_SD_STATUS off) SD_AU_DEFAULT_BLOCKS is used; 0
+ * there writes everything as a single burst instead. */
+
+#ifndef _SD_AU_H
+#define _SD_AU_H
+
+#include "sd.h"
+
+/* AU size assumed when the card doesn't report one, in blocks */
+#define SD_AU_DEFAULT_BLOCKS	0
+
+uint32_t sd_au_burst(uint32_t lba, uint32_t nblocks);
+int sd_au_write(uint32_t lba, const uint8_t *data, uint32_t nblocks);
+
+#endif
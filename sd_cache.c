@@ -0,0 +1,175 @@
+/* Write-back block cache for the SD/SPI driver
+ *
+ * Vanya A. Sergeev - <vsergeev@gmail.com> - copyright 2010
+ * please inform author of possible use, licensing is still being decided
+ *
+ */
+
+#include "sd_cache.h"
+
+/* Line state flags */
+#define SD_CACHE_VALID		(1<<0)
+#define SD_CACHE_DIRTY		(1<<1)
+
+typedef struct _SD_Cache_Line {
+	uint32_t address;
+	/* Value of sd_cache_clock when the line was last used */
+	uint32_t last_use;
+	uint8_t flags;
+	uint8_t data[SD_BLOCK_LENGTH];
+} SD_Cache_Line;
+
+static SD_Cache_Line sd_cache_lines[SD_CACHE_LINES];
+/* Use counter for the LRU ordering */
+static uint32_t sd_cache_clock;
+
+SD_Cache_Stats sd_cache_stats;
+
+static void sd_cache_copy(uint8_t *dest, const uint8_t *src) {
+	int i;
+
+	for (i = 0; i < SD_BLOCK_LENGTH; i++)
+		dest[i] = src[i];
+}
+
+static SD_Cache_Line *sd_cache_find(uint32_t address) {
+	int i;
+
+	for (i = 0; i < SD_CACHE_LINES; i++) {
+		if ((sd_cache_lines[i].flags & SD_CACHE_VALID) &&
+		    sd_cache_lines[i].address == address)
+			return &sd_cache_lines[i];
+	}
+
+	return 0;
+}
+
+static int sd_cache_writeback(SD_Cache_Line *line) {
+	int retVal;
+
+	if ((line->flags & (SD_CACHE_VALID|SD_CACHE_DIRTY)) != (SD_CACHE_VALID|SD_CACHE_DIRTY))
+		return 0;
+
+	retVal = sd_write_block(line->address, line->data);
+	if (retVal < 0)
+		return retVal;
+
+	line->flags &= ~SD_CACHE_DIRTY;
+	sd_cache_stats.writebacks++;
+
+	return 0;
+}
+
+static int sd_cache_evict(SD_Cache_Line **victim) {
+	SD_Cache_Line *line;
+	int i, retVal;
+
+	/* Prefer an empty line, otherwise take the least recently used one */
+	line = &sd_cache_lines[0];
+	for (i = 0; i < SD_CACHE_LINES; i++) {
+		if (!(sd_cache_lines[i].flags & SD_CACHE_VALID)) {
+			line = &sd_cache_lines[i];
+			break;
+		}
+		if ((sd_cache_clock - sd_cache_lines[i].last_use) > (sd_cache_clock - line->last_use))
+			line = &sd_cache_lines[i];
+	}
+
+	/* Write the old contents back before reusing the line */
+	retVal = sd_cache_writeback(line);
+	if (retVal < 0)
+		return retVal;
+
+	line->flags = 0;
+	*victim = line;
+
+	return 0;
+}
+
+int sd_cache_read_block(uint32_t address, uint8_t *data) {
+	SD_Cache_Line *line;
+	int retVal;
+
+	line = sd_cache_find(address);
+	if (line != 0) {
+		sd_cache_stats.hits++;
+		sd_cache_stats.bytes_saved += SD_BLOCK_LENGTH;
+	} else {
+		sd_cache_stats.misses++;
+
+		retVal = sd_cache_evict(&line);
+		if (retVal < 0)
+			return retVal;
+
+		retVal = sd_read_block(address, line->data);
+		if (retVal < 0)
+			return retVal;
+
+		line->address = address;
+		line->flags = SD_CACHE_VALID;
+	}
+
+	line->last_use = sd_cache_clock++;
+	sd_cache_copy(data, line->data);
+
+	return 0;
+}
+
+int sd_cache_write_block(uint32_t address, const uint8_t *data) {
+	SD_Cache_Line *line;
+	int retVal;
+
+	/* Validate the address now rather than when the line is written back */
+	if ((address % SD_BLOCK_LENGTH) != 0)
+		return SD_ERROR_WRITE_ADDR_MISALIGNED;
+
+	line = sd_cache_find(address);
+	if (line != 0) {
+		sd_cache_stats.hits++;
+		/* The previous contents were never written to the card */
+		if (line->flags & SD_CACHE_DIRTY)
+			sd_cache_stats.bytes_saved += SD_BLOCK_LENGTH;
+	} else {
+		/* The whole block is overwritten, so there is nothing to read in */
+		sd_cache_stats.misses++;
+
+		retVal = sd_cache_evict(&line);
+		if (retVal < 0)
+			return retVal;
+
+		line->address = address;
+	}
+
+	sd_cache_copy(line->data, data);
+	line->flags = SD_CACHE_VALID|SD_CACHE_DIRTY;
+	line->last_use = sd_cache_clock++;
+
+	return 0;
+}
+
+int sd_cache_flush(void) {
+	int i, retVal;
+
+	for (i = 0; i < SD_CACHE_LINES; i++) {
+		retVal = sd_cache_writeback(&sd_cache_lines[i]);
+		if (retVal < 0)
+			return retVal;
+	}
+
+	return 0;
+}
+
+void sd_cache_invalidate(void) {
+	int i;
+
+	/* Note: dirty lines are dropped, flush first to keep them */
+	for (i = 0; i < SD_CACHE_LINES; i++)
+		sd_cache_lines[i].flags = 0;
+}
+
+void sd_cache_clear_stats(void) {
+	sd_cache_stats.hits = 0;
+	sd_cache_stats.misses = 0;
+	sd_cache_stats.writebacks = 0;
+	sd_cache_stats.bytes_saved = 0;
+}
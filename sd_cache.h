@@ -0,0 +1,46 @@
+/* Write-back block cache for the SD/SPI driver
+ *
+ * Vanya A. Sergeev - <vsergeev@gmail.com> - copyright 2010
+ * please inform author of possible use, licensing is still being decided
+ *
+ */
+
+/* Keeps SD_CACHE_LINES blocks in RAM in front of sd_read_block() and
+ * sd_write_block(). Lines are evicted least recently used first, and
+ * written blocks stay dirty in RAM until they are evicted or
+ * sd_cache_flush() is called.
+ *
+ * All accesses to cached blocks must go through the cache: call
+ * sd_cache_flush() and sd_cache_invalidate() before touching the card
+ * directly with the sd_* block functions. */
+
+#ifndef _SD_CACHE_H
+#define _SD_CACHE_H
+
+#include "sd.h"
+
+/* Number of SD_BLOCK_LENGTH byte lines kept in RAM. Can be set from the
+ * compiler command line, see tools/sd_cache_trace.c. */
+#ifndef SD_CACHE_LINES
+#define SD_CACHE_LINES		4
+#endif
+
+/* Cache statistics */
+typedef struct _SD_Cache_Stats {
+	uint32_t hits;
+	uint32_t misses;
+	uint32_t writebacks;
+	/* Block data bytes kept off the bus: read hits, and writes over a
+	 * dirty line that never reached the card */
+	uint32_t bytes_saved;
+} SD_Cache_Stats;
+
+extern SD_Cache_Stats sd_cache_stats;
+
+int sd_cache_read_block(uint32_t address, uint8_t *data);
+int sd_cache_write_block(uint32_t address, const uint8_t *data);
+int sd_cache_flush(void);
+void sd_cache_invalidate(void);
+void sd_cache_clear_stats(void);
+
+#endif
@@ -0,0 +1,182 @@
+/* Discard tracking for the SD/SPI driver
+ *
+ * Vanya A. Sergeev - <vsergeev@gmail.com> - copyright 2010
+ * please inform author of possible use, licensing is still being decided
+ *
+ */
+
+#include "sd_discard.h"
+
+typedef struct _SD_Range {
+	uint32_t start;
+	/* One past the last block */
+	uint32_t end;
+} SD_Range;
+
+/* Sorted by start, never overlapping or touching */
+static SD_Range sd_discard_ranges[SD_DISCARD_RANGES];
+static int sd_discard_count;
+
+static void sd_discard_remove(int r) {
+	int i;
+
+	for (i = r; i < sd_discard_count - 1; i++)
+		sd_discard_ranges[i] = sd_discard_ranges[i+1];
+	sd_discard_count--;
+}
+
+/* Erases range r and drops it from the set */
+static int sd_discard_erase(int r) {
+	SD_Range *range;
+	int retVal;
+
+	range = &sd_discard_ranges[r];
+	retVal = sd_erase_blocks(range->start*SD_BLOCK_LENGTH, (range->end - 1)*SD_BLOCK_LENGTH);
+
+	/* Forgetting a range is always safe, so it goes even on failure */
+	sd_discard_remove(r);
+
+	return retVal;
+}
+
+static int sd_discard_largest(void) {
+	int i, largest;
+
+	for (i = 1, largest = 0; i < sd_discard_count; i++) {
+		if (sd_discard_ranges[i].end - sd_discard_ranges[i].start >
+		    sd_discard_ranges[largest].end - sd_discard_ranges[largest].start)
+			largest = i;
+	}
+
+	return largest;
+}
+
+int sd_discard(uint32_t lba, uint32_t count) {
+	SD_Range *range;
+	uint32_t end;
+	int i, j, retVal;
+
+	if (count == 0)
+		return 0;
+	/* The erase takes byte addresses, which have to fit in 32 bits.
+	 * Wrapped, they would erase the start of the card. */
+	if (lba >= SD_MAX_BLOCKS)
+		return SD_ERROR_START_ADDR_OUTBOUNDS;
+	if (count > SD_MAX_BLOCKS - lba)
+		return SD_ERROR_END_ADDR_OUTBOUNDS;
+	end = lba + count;
+
+	/* First range that ends at or after our start, which is the only
+	 * place the new one can go or join in */
+	for (i = 0; i < sd_discard_count; i++) {
+		if (sd_discard_ranges[i].end >= lba)
+			break;
+	}
+
+	if (i == sd_discard_count || sd_discard_ranges[i].start > end) {
+		/* Nothing to join, make room if the set is full */
+		if (sd_discard_count == SD_DISCARD_RANGES) {
+			j = sd_discard_largest();
+			retVal = sd_discard_erase(j);
+			if (retVal < 0)
+				return retVal;
+			if (j < i)
+				i--;
+		}
+		for (j = sd_discard_count; j > i; j--)
+			sd_discard_ranges[j] = sd_discard_ranges[j-1];
+		sd_discard_ranges[i].start = lba;
+		sd_discard_ranges[i].end = end;
+		sd_discard_count++;
+	} else {
+		range = &sd_discard_ranges[i];
+		if (lba < range->start)
+			range->start = lba;
+		if (end > range->end)
+			range->end = end;
+		/* Swallow the following ranges we now reach */
+		while (i + 1 < sd_discard_count && sd_discard_ranges[i+1].start <= range->end) {
+			if (sd_discard_ranges[i+1].end > range->end)
+				range->end = sd_discard_ranges[i+1].end;
+			sd_discard_remove(i + 1);
+		}
+	}
+
+	if (sd_discard_ranges[i].end - sd_discard_ranges[i].start >= SD_DISCARD_BATCH_BLOCKS)
+		return sd_discard_erase(i);
+
+	return 0;
+}
+
+void sd_discard_cancel(uint32_t lba, uint32_t count) {
+	SD_Range *range;
+	uint32_t end;
+	int i, j;
+
+	/* No range reaches past SD_MAX_BLOCKS, and end mustn't wrap */
+	if (lba >= SD_MAX_BLOCKS)
+		return;
+	end = (count > SD_MAX_BLOCKS - lba) ? SD_MAX_BLOCKS : lba + count;
+
+	for (i = 0; i < sd_discard_count; ) {
+		range = &sd_discard_ranges[i];
+		if (range->end <= lba || range->start >= end) {
+			i++;
+			continue;
+		}
+
+		if (range->start < lba && range->end > end) {
+			/* Cut out of the middle. Without room for the second
+			 * half, drop the smaller half instead. */
+			if (sd_discard_count < SD_DISCARD_RANGES) {
+				for (j = sd_discard_count; j > i + 1; j--)
+					sd_discard_ranges[j] = sd_discard_ranges[j-1];
+				sd_discard_ranges[i+1].start = end;
+				sd_discard_ranges[i+1].end = range->end;
+				sd_discard_count++;
+				range->end = lba;
+			} else if (lba - range->start >= range->end - end) {
+				range->end = lba;
+			} else {
+				range->start = end;
+			}
+			return;
+		}
+
+		if (range->start >= lba && range->end <= end) {
+			sd_discard_remove(i);
+			continue;
+		}
+
+		if (range->start < lba)
+			range->end = lba;
+		else
+			range->start = end;
+		i++;
+	}
+}
+
+/* Erases all ranges still pending */
+int sd_discard_flush(void) {
+	int retVal, result;
+
+	result = 0;
+	while (sd_discard_count > 0) {
+		retVal = sd_discard_erase(0);
+		if (retVal < 0)
+			result = retVal;
+	}
+
+	return result;
+}
+
+/* Number of blocks discarded but not erased yet */
+uint32_t sd_discard_pending(void) {
+	uint32_t count;
+	int i;
+
+	for (i = 0, count = 0; i < sd_discard_count; i++)
+		count += sd_discard_ranges[i].end - sd_discard_ranges[i].start;
+
+	return count;
+}
@@ -0,0 +1,36 @@
+/* Discard tracking for the SD/SPI driver
+ *
+ * Vanya A. Sergeev - <vsergeev@gmail.com> - copyright 2010
+ * please inform author of possible use, licensing is still being decided
+ *
+ */
+
+/* sd_discard() tells the driver that a range of blocks no longer holds
+ * anything of value. Ranges are kept in a small sorted set, where
+ * overlapping and adjacent ones are joined, and are only erased once
+ * they have grown to SD_DISCARD_BATCH_BLOCKS, so the card sees a few
+ * large CMD32/33/38 (CMD35/36/38 on MMC) erases instead of many small
+ * ones. sd_discard_flush() erases whatever is left, e.g. before the
+ * application goes idle for a while.
+ *
+ * Blocks that are reused before they have been erased must be taken out
+ * of the set with sd_discard_cancel() first, or their new contents will
+ * be erased later on. Block numbers are in units of SD_BLOCK_LENGTH,
+ * sd_discard() refuses ranges reaching past SD_MAX_BLOCKS. */
+
+#ifndef _SD_DISCARD_H
+#define _SD_DISCARD_H
+
+#include "sd.h"
+
+/* Maximum number of separate ranges kept */
+#define SD_DISCARD_RANGES		16
+/* Ranges are erased as soon as they reach this many blocks */
+#define SD_DISCARD_BATCH_BLOCKS		1024
+
+int sd_discard(uint32_t lba, uint32_t count);
+void sd_discard_cancel(uint32_t lba, uint32_t count);
+int sd_discard_flush(void);
+uint32_t sd_discard_pending(void);
+
+#endif
@@ -0,0 +1,1089 @@
+/* FAT16/FAT32 filesystem for the SD/SPI driver
+ *
+ * Vanya A. Sergeev - <vsergeev@gmail.com> - copyright 2010
+ * please inform author of possible use, licensing is still being decided
+ *
+ */
+
+#include "sd_fat.h"
+
+#define SD_FAT_SECTOR_LENGTH	512
+#define SD_FAT_SECTOR_SHIFT	9
+#define SD_FAT_DIR_ENTRY_LENGTH	32
+#define SD_FAT_NO_SECTOR	0xFFFFFFFF
+/* Sectors the driver's 32-bit byte addresses reach, 4GB */
+#define SD_FAT_MAX_SECTORS	0x800000
+
+/* Directory entry attributes */
+#define SD_FAT_ATTR_VOLUME_ID	0x08
+#define SD_FAT_ATTR_DIRECTORY	0x10
+#define SD_FAT_ATTR_ARCHIVE	0x20
+#define SD_FAT_ATTR_LONG_NAME	0x0F
+
+#if SD_BLOCK_LENGTH != SD_FAT_SECTOR_LENGTH
+#error "sd_fat needs SD_BLOCK_LENGTH to be 512."
+#endif
+
+typedef struct _SD_FAT_Cache {
+	uint32_t sector;
+	uint8_t dirty;
+	uint32_t used;
+	uint8_t data[SD_FAT_SECTOR_LENGTH];
+} SD_FAT_Cache;
+
+/* Position while going through a directory */
+typedef struct _SD_FAT_Dir {
+	/* Current cluster, 0 for the FAT16 root directory */
+	uint32_t cluster;
+	uint32_t sector;
+	/* Sectors left in the cluster (or the FAT16 root directory) */
+	uint32_t left;
+} SD_FAT_Dir;
+
+/* Volume layout, in sectors from the start of the card */
+static uint8_t sd_fat_type;
+static uint32_t sd_fat_start;
+static uint32_t sd_fat_sectors;
+static uint8_t sd_fat_copies;
+static uint32_t sd_fat_root_start;
+static uint32_t sd_fat_root_sectors;
+static uint32_t sd_fat_root_cluster;
+static uint32_t sd_fat_data_start;
+static uint32_t sd_fat_fsinfo;
+static uint32_t sd_fat_clusters;
+static uint8_t sd_fat_cluster_sectors;
+static uint8_t sd_fat_cluster_shift;
+/* Where to start looking for free clusters */
+static uint32_t sd_fat_free_hint;
+/* Set once the FSInfo free cluster count has been marked unknown */
+static uint8_t sd_fat_fsinfo_stale;
+
+static SD_FAT_Cache sd_fat_cache[SD_FAT_CACHE_SECTORS];
+static uint32_t sd_fat_cache_clock;
+
+/* Sector buffer for directories and partial sectors of files */
+static uint8_t sd_fat_buf[SD_FAT_SECTOR_LENGTH];
+static uint32_t sd_fat_buf_sector = SD_FAT_NO_SECTOR;
+static uint8_t sd_fat_buf_dirty;
+
+static uint16_t sd_fat_get16(const uint8_t *p) {
+	return p[0] | (p[1] << 8);
+}
+
+static uint32_t sd_fat_get32(const uint8_t *p) {
+	return p[0] | (p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void sd_fat_put16(uint8_t *p, uint16_t value) {
+	p[0] = value;
+	p[1] = value >> 8;
+}
+
+static void sd_fat_put32(uint8_t *p, uint32_t value) {
+	p[0] = value;
+	p[1] = value >> 8;
+	p[2] = value >> 16;
+	p[3] = value >> 24;
+}
+
+static uint32_t sd_fat_cluster_sector(uint32_t cluster) {
+	return sd_fat_data_start + ((cluster - 2) << sd_fat_cluster_shift);
+}
+
+static int sd_fat_valid_cluster(uint32_t cluster) {
+	return (cluster >= 2 && cluster < sd_fat_clusters + 2);
+}
+
+static int sd_fat_end_of_chain(uint32_t value) {
+	if (sd_fat_type == 32)
+		return (value >= 0x0FFFFFF8);
+	return (value >= 0xFFF8);
+}
+
+/******************************************************************************/
+/* Sector buffer */
+/******************************************************************************/
+
+static int sd_fat_buf_flush(void) {
+	int retVal;
+
+	if (!sd_fat_buf_dirty)
+		return 0;
+
+	retVal = sd_write_block(sd_fat_buf_sector*SD_FAT_SECTOR_LENGTH, sd_fat_buf);
+	if (retVal < 0)
+		return retVal;
+	sd_fat_buf_dirty = 0;
+
+	return 0;
+}
+
+static int sd_fat_buf_load(uint32_t sector) {
+	int retVal;
+
+	if (sector == sd_fat_buf_sector)
+		return 0;
+
+	retVal = sd_fat_buf_flush();
+	if (retVal < 0)
+		return retVal;
+
+	sd_fat_buf_sector = SD_FAT_NO_SECTOR;
+	retVal = sd_read_block(sector*SD_FAT_SECTOR_LENGTH, sd_fat_buf);
+	if (retVal < 0)
+		return retVal;
+	sd_fat_buf_sector = sector;
+
+	return 0;
+}
+
+/* Takes over a sector that is going to be overwritten anyway */
+static int sd_fat_buf_zero(uint32_t sector) {
+	int retVal, i;
+
+	if (sector != sd_fat_buf_sector) {
+		retVal = sd_fat_buf_flush();
+		if (retVal < 0)
+			return retVal;
+	}
+
+	for (i = 0; i < SD_FAT_SECTOR_LENGTH; i++)
+		sd_fat_buf[i] = 0;
+	sd_fat_buf_sector = sector;
+	sd_fat_buf_dirty = 1;
+
+	return 0;
+}
+
+/* Keeps the buffer coherent around a multiple sector transfer. Its
+ * pending data is written out before the card is read, and thrown away
+ * when the card is written over it. */
+static int sd_fat_buf_bypass(uint32_t sector, uint32_t count, int writing) {
+	if (sd_fat_buf_sector < sector || sd_fat_buf_sector >= sector + count)
+		return 0;
+
+	if (writing) {
+		sd_fat_buf_sector = SD_FAT_NO_SECTOR;
+		sd_fat_buf_dirty = 0;
+		return 0;
+	}
+
+	return sd_fat_buf_flush();
+}
+
+/******************************************************************************/
+/* FAT access */
+/******************************************************************************/
+
+static int sd_fat_cache_flush(SD_FAT_Cache *cache) {
+	uint8_t i;
+	int retVal;
+
+	if (!cache->dirty)
+		return 0;
+
+	for (i = 0; i < sd_fat_copies; i++) {
+		retVal = sd_write_block((sd_fat_start + i*sd_fat_sectors + cache->sector)*SD_FAT_SECTOR_LENGTH, cache->data);
+		if (retVal < 0)
+			return retVal;
+	}
+	cache->dirty = 0;
+
+	return 0;
+}
+
+/* Returns the cached copy of FAT sector number sector, or 0 on error */
+static uint8_t *sd_fat_cache_get(uint32_t sector, int *retVal) {
+	SD_FAT_Cache *cache, *victim;
+	int i;
+
+	victim = &sd_fat_cache[0];
+	for (i = 0; i < SD_FAT_CACHE_SECTORS; i++) {
+		cache = &sd_fat_cache[i];
+		if (cache->sector == sector) {
+			cache->used = ++sd_fat_cache_clock;
+			return cache->data;
+		}
+		if (cache->used < victim->used)
+			victim = cache;
+	}
+
+	*retVal = sd_fat_cache_flush(victim);
+	if (*retVal < 0)
+		return 0;
+
+	victim->sector = SD_FAT_NO_SECTOR;
+	*retVal = sd_read_block((sd_fat_start + sector)*SD_FAT_SECTOR_LENGTH, victim->data);
+	if (*retVal < 0)
+		return 0;
+	victim->sector = sector;
+	victim->used = ++sd_fat_cache_clock;
+
+	return victim->data;
+}
+
+static int sd_fat_cache_sync(void) {
+	int i, retVal;
+
+	for (i = 0; i < SD_FAT_CACHE_SECTORS; i++) {
+		retVal = sd_fat_cache_flush(&sd_fat_cache[i]);
+		if (retVal < 0)
+			return retVal;
+	}
+
+	return 0;
+}
+
+static int sd_fat_get(uint32_t cluster, uint32_t *value) {
+	uint32_t offset;
+	uint8_t *data;
+	int retVal;
+
+	offset = (sd_fat_type == 32) ? cluster*4 : cluster*2;
+	data = sd_fat_cache_get(offset >> SD_FAT_SECTOR_SHIFT, &retVal);
+	if (data == 0)
+		return retVal;
+	data += offset & (SD_FAT_SECTOR_LENGTH - 1);
+
+	if (sd_fat_type == 32)
+		*value = sd_fat_get32(data) & 0x0FFFFFFF;
+	else
+		*value = sd_fat_get16(data);
+
+	return 0;
+}
+
+/* The FSInfo free cluster count is only a hint, and it is simply marked
+ * unknown before the FAT is first changed instead of being kept up to
+ * date. */
+static int sd_fat_fsinfo_invalidate(void) {
+	int retVal;
+
+	if (sd_fat_fsinfo_stale || sd_fat_fsinfo == 0)
+		return 0;
+
+	retVal = sd_fat_buf_load(sd_fat_fsinfo);
+	if (retVal < 0)
+		return retVal;
+	if (sd_fat_get32(sd_fat_buf) == 0x41615252)
+		sd_fat_put32(sd_fat_buf + 488, 0xFFFFFFFF);
+	sd_fat_buf_dirty = 1;
+	sd_fat_fsinfo_stale = 1;
+
+	return 0;
+}
+
+static int sd_fat_set(uint32_t cluster, uint32_t value) {
+	uint32_t offset;
+	uint8_t *data;
+	int i, retVal;
+
+	retVal = sd_fat_fsinfo_invalidate();
+	if (retVal < 0)
+		return retVal;
+
+	offset = (sd_fat_type == 32) ? cluster*4 : cluster*2;
+	data = sd_fat_cache_get(offset >> SD_FAT_SECTOR_SHIFT, &retVal);
+	if (data == 0)
+		return retVal;
+	data += offset & (SD_FAT_SECTOR_LENGTH - 1);
+
+	/* The top 4 bits of FAT32 entries are reserved and kept as they are */
+	if (sd_fat_type == 32)
+		sd_fat_put32(data, (sd_fat_get32(data) & 0xF0000000) | (value & 0x0FFFFFFF));
+	else
+		sd_fat_put16(data, value);
+
+	for (i = 0; i < SD_FAT_CACHE_SECTORS; i++) {
+		if (sd_fat_cache[i].sector == (offset >> SD_FAT_SECTOR_SHIFT))
+			sd_fat_cache[i].dirty = 1;
+	}
+
+	return 0;
+}
+
+static uint32_t sd_fat_eoc(void) {
+	return (sd_fat_type == 32) ? 0x0FFFFFFF : 0xFFFF;
+}
+
+/* Allocates and chains up to want free clusters, right after tail if
+ * possible, and links them to tail unless it is 0. Returns the first
+ * cluster and the number allocated. */
+static int sd_fat_alloc(uint32_t tail, uint32_t want, uint32_t *first, uint32_t *count) {
+	uint32_t cluster, start, run, best, best_run, scanned, value;
+	int retVal;
+
+	start = 0;
+	run = 0;
+
+	/* Right after the tail keeps the file contiguous */
+	if (tail != 0 && sd_fat_valid_cluster(tail + 1)) {
+		for (cluster = tail + 1; run < want && sd_fat_valid_cluster(cluster); cluster++, run++) {
+			retVal = sd_fat_get(cluster, &value);
+			if (retVal < 0)
+				return retVal;
+			if (value != 0)
+				break;
+		}
+		start = tail + 1;
+	}
+
+	/* Otherwise the first free run that holds the whole request, or
+	 * the longest one there is */
+	if (run == 0) {
+		best = 0;
+		best_run = 0;
+		cluster = sd_fat_free_hint;
+		for (scanned = 0; scanned < sd_fat_clusters && best_run < want; scanned++) {
+			if (!sd_fat_valid_cluster(cluster)) {
+				/* Runs don't wrap around the end of the FAT */
+				cluster = 2;
+				run = 0;
+			}
+			retVal = sd_fat_get(cluster, &value);
+			if (retVal < 0)
+				return retVal;
+			if (value == 0) {
+				if (run == 0)
+					start = cluster;
+				run++;
+				if (run > best_run) {
+					best = start;
+					best_run = run;
+				}
+			} else {
+				run = 0;
+			}
+			cluster++;
+		}
+		start = best;
+		run = best_run;
+	}
+
+	if (run == 0)
+		return SD_ERROR_FAT_FULL;
+
+	/* Chain the run, last cluster first so a failure leaves no loose
+	 * links behind */
+	retVal = sd_fat_set(start + run - 1, sd_fat_eoc());
+	if (retVal < 0)
+		return retVal;
+	for (cluster = start + run - 1; cluster > start; cluster--) {
+		retVal = sd_fat_set(cluster - 1, cluster);
+		if (retVal < 0)
+			return retVal;
+	}
+	if (tail != 0) {
+		retVal = sd_fat_set(tail, start);
+		if (retVal < 0)
+			return retVal;
+	}
+
+	sd_fat_free_hint = start + run;
+	if (!sd_fat_valid_cluster(sd_fat_free_hint))
+		sd_fat_free_hint = 2;
+
+	*first = start;
+	*count = run;
+
+	return 0;
+}
+
+static int sd_fat_free_chain(uint32_t cluster) {
+	uint32_t next;
+	int retVal;
+
+	while (sd_fat_valid_cluster(cluster)) {
+		retVal = sd_fat_get(cluster, &next);
+		if (retVal < 0)
+			return retVal;
+		retVal = sd_fat_set(cluster, 0);
+		if (retVal < 0)
+			return retVal;
+		if (cluster < sd_fat_free_hint)
+			sd_fat_free_hint = cluster;
+		cluster = next;
+	}
+
+	return 0;
+}
+
+/******************************************************************************/
+/* Mounting */
+/******************************************************************************/
+
+static int sd_fat_is_boot_sector(const uint8_t *sector) {
+	return ((sector[0] == 0xEB || sector[0] == 0xE9) &&
+		sd_fat_get16(sector + 11) == SD_FAT_SECTOR_LENGTH);
+}
+
+int sd_fat_mount(void) {
+	uint32_t volume, total_sectors, data_sectors;
+	uint16_t reserved_sectors, root_entries;
+	uint8_t cluster_sectors;
+	int i, retVal;
+
+	sd_fat_type = 0;
+	sd_fat_buf_sector = SD_FAT_NO_SECTOR;
+	sd_fat_buf_dirty = 0;
+	for (i = 0; i < SD_FAT_CACHE_SECTORS; i++) {
+		sd_fat_cache[i].sector = SD_FAT_NO_SECTOR;
+		sd_fat_cache[i].dirty = 0;
+		sd_fat_cache[i].used = 0;
+	}
+
+	/* Either a boot sector of a card without partitions, or an MBR
+	 * whose first used partition holds the volume */
+	retVal = sd_fat_buf_load(0);
+	if (retVal < 0)
+		return retVal;
+	if (sd_fat_buf[510] != 0x55 || sd_fat_buf[511] != 0xAA)
+		return SD_ERROR_FAT_NO_FS;
+
+	volume = 0;
+	if (!sd_fat_is_boot_sector(sd_fat_buf)) {
+		for (i = 0; i < 4; i++) {
+			if (sd_fat_buf[446 + i*16 + 4] != 0)
+				break;
+		}
+		if (i == 4)
+			return SD_ERROR_FAT_NO_FS;
+		volume = sd_fat_get32(sd_fat_buf + 446 + i*16 + 8);
+		if (volume >= SD_FAT_MAX_SECTORS)
+			return SD_ERROR_FAT_UNSUPPORTED;
+
+		retVal = sd_fat_buf_load(volume);
+		if (retVal < 0)
+			return retVal;
+		if (!sd_fat_is_boot_sector(sd_fat_buf))
+			return SD_ERROR_FAT_NO_FS;
+	}
+
+	/* BIOS parameter block */
+	cluster_sectors = sd_fat_buf[13];
+	reserved_sectors = sd_fat_get16(sd_fat_buf + 14);
+	sd_fat_copies = sd_fat_buf[16];
+	root_entries = sd_fat_get16(sd_fat_buf + 17);
+	total_sectors = sd_fat_get16(sd_fat_buf + 19);
+	if (total_sectors == 0)
+		total_sectors = sd_fat_get32(sd_fat_buf + 32);
+	sd_fat_sectors = sd_fat_get16(sd_fat_buf + 22);
+	if (sd_fat_sectors == 0)
+		sd_fat_sectors = sd_fat_get32(sd_fat_buf + 36);
+
+	/* Every sector of the volume has to be addressable */
+	if (total_sectors > SD_FAT_MAX_SECTORS - volume)
+		return SD_ERROR_FAT_UNSUPPORTED;
+
+	if (cluster_sectors == 0 || (cluster_sectors & (cluster_sectors - 1)) != 0 ||
+	    sd_fat_copies == 0 || sd_fat_sectors == 0)
+		return SD_ERROR_FAT_NO_FS;
+	sd_fat_cluster_sectors = cluster_sectors;
+	for (sd_fat_cluster_shift = 0; (1 << sd_fat_cluster_shift) < cluster_sectors; sd_fat_cluster_shift++)
+		;
+
+	sd_fat_start = volume + reserved_sectors;
+	sd_fat_root_start = sd_fat_start + sd_fat_copies*sd_fat_sectors;
+	sd_fat_root_sectors = (root_entries*SD_FAT_DIR_ENTRY_LENGTH + SD_FAT_SECTOR_LENGTH - 1) / SD_FAT_SECTOR_LENGTH;
+	sd_fat_data_start = sd_fat_root_start + sd_fat_root_sectors;
+
+	data_sectors = total_sectors - (sd_fat_data_start - volume);
+	sd_fat_clusters = data_sectors >> sd_fat_cluster_shift;
+
+	/* The FAT type follows from the cluster count alone */
+	if (sd_fat_clusters < 4085)
+		return SD_ERROR_FAT_UNSUPPORTED;
+	if (sd_fat_clusters < 65525) {
+		sd_fat_type = 16;
+		sd_fat_root_cluster = 0;
+		sd_fat_fsinfo = 0;
+	} else {
+		sd_fat_type = 32;
+		sd_fat_root_cluster = sd_fat_get32(sd_fat_buf + 44);
+		sd_fat_fsinfo = sd_fat_get16(sd_fat_buf + 48);
+		if (sd_fat_fsinfo != 0 && sd_fat_fsinfo != 0xFFFF)
+			sd_fat_fsinfo += volume;
+		else
+			sd_fat_fsinfo = 0;
+	}
+
+	/* The FAT may not be large enough for all clusters */
+	if (sd_fat_clusters + 2 > (sd_fat_sectors*SD_FAT_SECTOR_LENGTH) / (sd_fat_type / 8))
+		sd_fat_clusters = (sd_fat_sectors*SD_FAT_SECTOR_LENGTH) / (sd_fat_type / 8) - 2;
+
+	sd_fat_free_hint = 2;
+	sd_fat_fsinfo_stale = 0;
+
+	return 0;
+}
+
+int sd_fat_unmount(void) {
+	int retVal;
+
+	retVal = sd_fat_cache_sync();
+	if (retVal < 0)
+		return retVal;
+	retVal = sd_fat_buf_flush();
+	if (retVal < 0)
+		return retVal;
+
+	sd_fat_type = 0;
+
+	return 0;
+}
+
+/******************************************************************************/
+/* Directories */
+/******************************************************************************/
+
+static void sd_fat_dir_begin(SD_FAT_Dir *dir, uint32_t cluster) {
+	dir->cluster = cluster;
+	if (cluster == 0) {
+		dir->sector = sd_fat_root_start;
+		dir->left = sd_fat_root_sectors;
+	} else {
+		dir->sector = sd_fat_cluster_sector(cluster);
+		dir->left = sd_fat_cluster_sectors;
+	}
+}
+
+/* Moves on to the next sector of a directory. Returns 1 at the end. */
+static int sd_fat_dir_next(SD_FAT_Dir *dir) {
+	uint32_t next;
+	int retVal;
+
+	if (--dir->left > 0) {
+		dir->sector++;
+		return 0;
+	}
+	if (dir->cluster == 0)
+		return 1;
+
+	retVal = sd_fat_get(dir->cluster, &next);
+	if (retVal < 0)
+		return retVal;
+	if (sd_fat_end_of_chain(next))
+		return 1;
+	if (!sd_fat_valid_cluster(next))
+		return SD_ERROR_FAT_CHAIN;
+	sd_fat_dir_begin(dir, next);
+
+	return 0;
+}
+
+/* Turns the next component of path into a padded 8.3 name, and moves
+ * path past it and its separator. */
+static int sd_fat_name(const char **path, uint8_t *name) {
+	const char *p;
+	int i, len, ext;
+	char c;
+
+	for (i = 0; i < 11; i++)
+		name[i] = ' ';
+
+	p = *path;
+	len = 0;
+	ext = 0;
+	if (p[0] == '.' && (p[1] == '\0' || p[1] == '/' || (p[1] == '.' && (p[2] == '\0' || p[2] == '/')))) {
+		/* "." and ".." are stored as they are */
+		for (; *p == '.'; p++)
+			name[len++] = '.';
+	}
+	for (; *p != '\0' && *p != '/'; p++) {
+		c = *p;
+		if (c == '.' && !ext && len > 0) {
+			ext = 1;
+			len = 0;
+			continue;
+		}
+		if ((uint8_t)c < 0x20 || c == '.' || c == '"' || c == '*' || c == '+' ||
+		    c == ',' || c == ':' || c == ';' || c == '<' || c == '=' ||
+		    c == '>' || c == '?' || c == '[' || c == '\\' || c == ']' || c == '|')
+			return SD_ERROR_FAT_BAD_NAME;
+		if (len == (ext ? 3 : 8))
+			return SD_ERROR_FAT_BAD_NAME;
+		if (c >= 'a' && c <= 'z')
+			c -= 'a' - 'A';
+		name[(ext ? 8 : 0) + len++] = c;
+	}
+	if (name[0] == ' ' || (ext && len == 0))
+		return SD_ERROR_FAT_BAD_NAME;
+	/* 0xE5 marks deleted entries and is stored as 0x05 */
+	if (name[0] == 0xE5)
+		name[0] = 0x05;
+
+	while (*p == '/')
+		p++;
+	*path = p;
+
+	return 0;
+}
+
+/* Looks name up in the directory starting at cluster (0 for the FAT16
+ * root). On success the entry is in the sector buffer at *offset. If it
+ * isn't there, *sector and *offset point at a free entry, with *sector
+ * SD_FAT_NO_SECTOR if there is none, and *last is the directory's last
+ * cluster. */
+static int sd_fat_dir_find(uint32_t cluster, const uint8_t *name, uint32_t *sector, uint16_t *offset, uint32_t *last) {
+	SD_FAT_Dir dir;
+	uint8_t *entry;
+	uint16_t i;
+	int j, retVal;
+
+	*sector = SD_FAT_NO_SECTOR;
+	sd_fat_dir_begin(&dir, cluster);
+	for (;;) {
+		*last = dir.cluster;
+		retVal = sd_fat_buf_load(dir.sector);
+		if (retVal < 0)
+			return retVal;
+
+		for (i = 0; i < SD_FAT_SECTOR_LENGTH; i += SD_FAT_DIR_ENTRY_LENGTH) {
+			entry = sd_fat_buf + i;
+			if (entry[0] == 0x00 || entry[0] == 0xE5) {
+				if (*sector == SD_FAT_NO_SECTOR) {
+					*sector = dir.sector;
+					*offset = i;
+				}
+				/* Nothing is in use past an entry starting with 0 */
+				if (entry[0] == 0x00)
+					return SD_ERROR_FAT_NOT_FOUND;
+				continue;
+			}
+			if (entry[11] == SD_FAT_ATTR_LONG_NAME || (entry[11] & SD_FAT_ATTR_VOLUME_ID))
+				continue;
+			for (j = 0; j < 11 && entry[j] == name[j]; j++)
+				;
+			if (j == 11) {
+				*sector = dir.sector;
+				*offset = i;
+				return 0;
+			}
+		}
+
+		retVal = sd_fat_dir_next(&dir);
+		if (retVal < 0)
+			return retVal;
+		if (retVal == 1)
+			return SD_ERROR_FAT_NOT_FOUND;
+	}
+}
+
+/* Adds a cleared cluster to a directory and returns its first sector */
+static int sd_fat_dir_extend(uint32_t last, uint32_t *sector) {
+	uint32_t cluster, count;
+	uint8_t i;
+	int retVal;
+
+	/* The FAT16 root directory can't grow */
+	if (last == 0)
+		return SD_ERROR_FAT_DIR_FULL;
+
+	retVal = sd_fat_alloc(last, 1, &cluster, &count);
+	if (retVal < 0)
+		return retVal;
+
+	*sector = sd_fat_cluster_sector(cluster);
+	for (i = 0; i < sd_fat_cluster_sectors; i++) {
+		retVal = sd_fat_buf_zero(*sector + i);
+		if (retVal < 0)
+			return retVal;
+	}
+
+	return 0;
+}
+
+static uint32_t sd_fat_entry_cluster(const uint8_t *entry) {
+	uint32_t cluster;
+
+	cluster = sd_fat_get16(entry + 26);
+	if (sd_fat_type == 32)
+		cluster |= (uint32_t)sd_fat_get16(entry + 20) << 16;
+
+	return cluster;
+}
+
+/******************************************************************************/
+/* Files */
+/******************************************************************************/
+
+/* Finds the card cluster holding cluster number index of a file, and how
+ * many clusters follow it contiguously. Returns SD_ERROR_FAT_EOF, with
+ * the tail of the chain noted in the file, if the chain is shorter. */
+static int sd_fat_map(SD_FAT_File *file, uint32_t index, uint32_t *cluster, uint32_t *run) {
+	SD_FAT_Extent *extent;
+	uint32_t ri, rc, rn, next;
+	int i, stored, retVal;
+
+	if (file->first_cluster == 0) {
+		file->tail = 0;
+		return SD_ERROR_FAT_EOF;
+	}
+
+	for (i = 0; i < file->num_extents; i++) {
+		extent = &file->extents[i];
+		if (index >= extent->index && index < extent->index + extent->count) {
+			*cluster = extent->cluster + (index - extent->index);
+			*run = extent->count - (index - extent->index);
+			return 0;
+		}
+	}
+
+	/* Follow the chain on from the last extent known, remembering new
+	 * extents for as long as there is room */
+	if (file->num_extents == 0) {
+		file->extents[0].index = 0;
+		file->extents[0].cluster = file->first_cluster;
+		file->extents[0].count = 1;
+		file->num_extents = 1;
+	}
+	extent = &file->extents[file->num_extents - 1];
+	ri = extent->index;
+	rc = extent->cluster;
+	rn = extent->count;
+	stored = 1;
+
+	for (;;) {
+		retVal = sd_fat_get(rc + rn - 1, &next);
+		if (retVal < 0)
+			return retVal;
+
+		if (sd_fat_end_of_chain(next)) {
+			file->tail = rc + rn - 1;
+			file->tail_index = ri + rn - 1;
+			if (index < ri + rn)
+				break;
+			return SD_ERROR_FAT_EOF;
+		}
+		if (!sd_fat_valid_cluster(next))
+			return SD_ERROR_FAT_CHAIN;
+
+		if (next == rc + rn) {
+			rn++;
+			if (stored)
+				extent->count++;
+			continue;
+		}
+
+		/* The run ends here, and so does the search if it got there */
+		if (index < ri + rn)
+			break;
+		ri += rn;
+		rc = next;
+		rn = 1;
+		stored = (file->num_extents < SD_FAT_EXTENTS);
+		if (stored) {
+			extent = &file->extents[file->num_extents++];
+			extent->index = ri;
+			extent->cluster = rc;
+			extent->count = 1;
+		}
+	}
+
+	*cluster = rc + (index - ri);
+	*run = rn - (index - ri);
+
+	return 0;
+}
+
+/* Grows a file's chain so it covers cluster number index */
+static int sd_fat_grow(SD_FAT_File *file, uint32_t index) {
+	SD_FAT_Extent *extent;
+	uint32_t have, first, count;
+	int retVal;
+
+	have = (file->first_cluster == 0) ? 0 : file->tail_index + 1;
+	retVal = sd_fat_alloc(file->tail, index + 1 - have, &first, &count);
+	if (retVal < 0)
+		return retVal;
+
+	if (file->first_cluster == 0) {
+		file->first_cluster = first;
+		file->num_extents = 0;
+		file->dirty = 1;
+	}
+
+	/* Extents cover a prefix of the chain, so the new clusters can only
+	 * be added if the last extent reaches the old tail */
+	if (file->num_extents == 0) {
+		extent = &file->extents[0];
+		extent->index = 0;
+		extent->cluster = first;
+		extent->count = count;
+		file->num_extents = 1;
+	} else {
+		extent = &file->extents[file->num_extents - 1];
+		if (extent->index + extent->count != have) {
+			/* Not known that far, sd_fat_map() will get there */
+		} else if (extent->cluster + extent->count == first) {
+			extent->count += count;
+		} else if (file->num_extents < SD_FAT_EXTENTS) {
+			extent = &file->extents[file->num_extents++];
+			extent->index = have;
+			extent->cluster = first;
+			extent->count = count;
+		}
+	}
+
+	file->tail = first + count - 1;
+	file->tail_index = have + count - 1;
+
+	return 0;
+}
+
+int sd_fat_open(SD_FAT_File *file, const char *path, uint8_t mode) {
+	uint8_t name[11];
+	uint8_t *entry;
+	uint32_t dir, sector, last;
+	uint16_t offset;
+	int i, retVal;
+
+	if (sd_fat_type == 0)
+		return SD_ERROR_FAT_NO_FS;
+
+	while (*path == '/')
+		path++;
+
+	/* Walk down the directories */
+	dir = sd_fat_root_cluster;
+	for (;;) {
+		retVal = sd_fat_name(&path, name);
+		if (retVal < 0)
+			return retVal;
+
+		retVal = sd_fat_dir_find(dir, name, &sector, &offset, &last);
+		if (*path == '\0')
+			break;
+		if (retVal < 0)
+			return retVal;
+
+		entry = sd_fat_buf + offset;
+		if (!(entry[11] & SD_FAT_ATTR_DIRECTORY))
+			return SD_ERROR_FAT_NOT_FILE;
+		dir = sd_fat_entry_cluster(entry);
+		/* ".." back to the root is stored as cluster 0 */
+		if (dir == 0)
+			dir = sd_fat_root_cluster;
+	}
+
+	if (retVal == SD_ERROR_FAT_NOT_FOUND && (mode & SD_FAT_CREATE)) {
+		if (sector == SD_FAT_NO_SECTOR) {
+			retVal = sd_fat_dir_extend(last, &sector);
+			if (retVal < 0)
+				return retVal;
+			offset = 0;
+		}
+		retVal = sd_fat_buf_load(sector);
+		if (retVal < 0)
+			return retVal;
+
+		entry = sd_fat_buf + offset;
+		for (i = 0; i < SD_FAT_DIR_ENTRY_LENGTH; i++)
+			entry[i] = 0;
+		for (i = 0; i < 11; i++)
+			entry[i] = name[i];
+		entry[11] = SD_FAT_ATTR_ARCHIVE;
+		sd_fat_buf_dirty = 1;
+	} else if (retVal < 0) {
+		return retVal;
+	}
+
+	entry = sd_fat_buf + offset;
+	if (entry[11] & SD_FAT_ATTR_DIRECTORY)
+		return SD_ERROR_FAT_NOT_FILE;
+
+	file->mode = mode;
+	file->dirty = 0;
+	file->first_cluster = sd_fat_entry_cluster(entry);
+	file->size = sd_fat_get32(entry + 28);
+	file->pos = 0;
+	file->dir_sector = sector;
+	file->dir_offset = offset;
+	file->tail = 0;
+	file->tail_index = 0;
+	file->num_extents = 0;
+
+	if ((mode & SD_FAT_TRUNCATE) && (mode & SD_FAT_WRITE)) {
+		retVal = sd_fat_free_chain(file->first_cluster);
+		if (retVal < 0)
+			return retVal;
+		file->first_cluster = 0;
+		file->size = 0;
+		file->dirty = 1;
+	}
+
+	return 0;
+}
+
+int sd_fat_read(SD_FAT_File *file, uint8_t *data, int dataLen) {
+	uint32_t cluster, run, sector, offset, count;
+	int done, n, i, retVal;
+
+	if (!(file->mode & SD_FAT_READ))
+		return SD_ERROR_FAT_MODE;
+
+	if (file->pos >= file->size)
+		return 0;
+	if ((uint32_t)dataLen > file->size - file->pos)
+		dataLen = file->size - file->pos;
+
+	for (done = 0; done < dataLen; ) {
+		retVal = sd_fat_map(file, file->pos >> (sd_fat_cluster_shift + SD_FAT_SECTOR_SHIFT), &cluster, &run);
+		if (retVal == SD_ERROR_FAT_EOF)
+			return SD_ERROR_FAT_CHAIN;
+		if (retVal < 0)
+			return retVal;
+
+		offset = (file->pos >> SD_FAT_SECTOR_SHIFT) & (sd_fat_cluster_sectors - 1);
+		sector = sd_fat_cluster_sector(cluster) + offset;
+		offset = file->pos & (SD_FAT_SECTOR_LENGTH - 1);
+
+		if (offset == 0 && dataLen - done >= SD_FAT_SECTOR_LENGTH) {
+			/* Whole sectors, as far as the extent goes */
+			count = (run << sd_fat_cluster_shift) - ((file->pos >> SD_FAT_SECTOR_SHIFT) & (sd_fat_cluster_sectors - 1));
+			if (count > (uint32_t)(dataLen - done) >> SD_FAT_SECTOR_SHIFT)
+				count = (uint32_t)(dataLen - done) >> SD_FAT_SECTOR_SHIFT;
+
+			retVal = sd_fat_buf_bypass(sector, count, 0);
+			if (retVal < 0)
+				return retVal;
+			retVal = sd_read_blocks(sector*SD_FAT_SECTOR_LENGTH, data + done, count*SD_FAT_SECTOR_LENGTH);
+			if (retVal < 0)
+				return retVal;
+			n = count*SD_FAT_SECTOR_LENGTH;
+		} else {
+			retVal = sd_fat_buf_load(sector);
+			if (retVal < 0)
+				return retVal;
+			n = SD_FAT_SECTOR_LENGTH - offset;
+			if (n > dataLen - done)
+				n = dataLen - done;
+			for (i = 0; i < n; i++)
+				data[done + i] = sd_fat_buf[offset + i];
+		}
+
+		done += n;
+		file->pos += n;
+	}
+
+	return done;
+}
+
+int sd_fat_write(SD_FAT_File *file, const uint8_t *data, int dataLen) {
+	uint32_t cluster, run, sector, offset, count;
+	int done, n, i, retVal;
+
+	if (!(file->mode & SD_FAT_WRITE))
+		return SD_ERROR_FAT_MODE;
+
+	for (done = 0; done < dataLen; ) {
+		retVal = sd_fat_map(file, file->pos >> (sd_fat_cluster_shift + SD_FAT_SECTOR_SHIFT), &cluster, &run);
+		if (retVal == SD_ERROR_FAT_EOF) {
+			/* Allocate for the rest of the write at once, so it
+			 * can get a single run */
+			retVal = sd_fat_grow(file, (file->pos + (dataLen - done) - 1) >> (sd_fat_cluster_shift + SD_FAT_SECTOR_SHIFT));
+			if (retVal < 0)
+				break;
+			continue;
+		}
+		if (retVal < 0)
+			break;
+
+		offset = (file->pos >> SD_FAT_SECTOR_SHIFT) & (sd_fat_cluster_sectors - 1);
+		sector = sd_fat_cluster_sector(cluster) + offset;
+		offset = file->pos & (SD_FAT_SECTOR_LENGTH - 1);
+
+		if (offset == 0 && dataLen - done >= SD_FAT_SECTOR_LENGTH) {
+			count = (run << sd_fat_cluster_shift) - ((file->pos >> SD_FAT_SECTOR_SHIFT) & (sd_fat_cluster_sectors - 1));
+			if (count > (uint32_t)(dataLen - done) >> SD_FAT_SECTOR_SHIFT)
+				count = (uint32_t)(dataLen - done) >> SD_FAT_SECTOR_SHIFT;
+
+			retVal = sd_fat_buf_bypass(sector, count, 1);
+			if (retVal < 0)
+				break;
+			retVal = sd_write_blocks(sector*SD_FAT_SECTOR_LENGTH, data + done, count*SD_FAT_SECTOR_LENGTH);
+			if (retVal < 0)
+				break;
+			n = count*SD_FAT_SECTOR_LENGTH;
+		} else {
+			/* Sectors past the end of the file needn't be read */
+			if ((file->pos & ~(SD_FAT_SECTOR_LENGTH - 1)) >= file->size)
+				retVal = sd_fat_buf_zero(sector);
+			else
+				retVal = sd_fat_buf_load(sector);
+			if (retVal < 0)
+				break;
+			n = SD_FAT_SECTOR_LENGTH - offset;
+			if (n > dataLen - done)
+				n = dataLen - done;
+			for (i = 0; i < n; i++)
+				sd_fat_buf[offset + i] = data[done + i];
+			sd_fat_buf_dirty = 1;
+		}
+
+		done += n;
+		file->pos += n;
+		if (file->pos > file->size) {
+			file->size = file->pos;
+			file->dirty = 1;
+		}
+	}
+
+	/* Report what made it before an error, if anything did */
+	if (done == 0 && dataLen > 0)
+		return retVal;
+
+	return done;
+}
+
+int sd_fat_seek(SD_FAT_File *file, uint32_t pos) {
+	file->pos = pos;
+	return 0;
+}
+
+uint32_t sd_fat_size(SD_FAT_File *file) {
+	return file->size;
+}
+
+int sd_fat_sync(SD_FAT_File *file) {
+	uint8_t *entry;
+	int retVal;
+
+	retVal = sd_fat_buf_flush();
+	if (retVal < 0)
+		return retVal;
+	retVal = sd_fat_cache_sync();
+	if (retVal < 0)
+		return retVal;
+
+	if (!file->dirty)
+		return 0;
+
+	retVal = sd_fat_buf_load(file->dir_sector);
+	if (retVal < 0)
+		return retVal;
+	entry = sd_fat_buf + file->dir_offset;
+	sd_fat_put16(entry + 20, file->first_cluster >> 16);
+	sd_fat_put16(entry + 26, file->first_cluster);
+	sd_fat_put32(entry + 28, file->size);
+	entry[11] |= SD_FAT_ATTR_ARCHIVE;
+	sd_fat_buf_dirty = 1;
+
+	retVal = sd_fat_buf_flush();
+	if (retVal < 0)
+		return retVal;
+	file->dirty = 0;
+
+	return 0;
+}
+
+int sd_fat_close(SD_FAT_File *file) {
+	int retVal;
+
+	retVal = 0;
+	if (file->mode & SD_FAT_WRITE)
+		retVal = sd_fat_sync(file);
+	file->mode = 0;
+
+	return retVal;
+}
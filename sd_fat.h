@@ -0,0 +1,82 @@
+/* FAT16/FAT32 filesystem for the SD/SPI driver
+ *
+ * Vanya A. Sergeev - <vsergeev@gmail.com> - copyright 2010
+ * please inform author of possible use, licensing is still being decided
+ *
+ */
+
+/* sd_fat_mount() looks for a FAT16 or FAT32 volume on the card, either
+ * in the first partition of an MBR or on the whole card, and files are
+ * then opened by path, e.g. "LOGS/RUN1.TXT". Only 8.3 names are
+ * supported; long name entries are skipped when looking names up.
+ *
+ * FAT sectors are kept in a small write-back cache of SD_FAT_CACHE_SECTORS
+ * sectors, written to all FAT copies when evicted or synced. Every open
+ * file remembers where its cluster chain runs, as up to SD_FAT_EXTENTS
+ * contiguous extents, so seeks and reads don't walk the FAT over again.
+ * Writers that grow a file get clusters right after the file's last one
+ * if they are free, or else the first free run large enough for the
+ * write, so whole sectors of a large write go out in sd_write_blocks()
+ * bursts and reads in sd_read_blocks() bursts.
+ *
+ * One volume is mounted at a time. Data, the FAT and directory entries
+ * only reach the card on sd_fat_sync(), sd_fat_close() or
+ * sd_fat_unmount(). The driver addresses the card in bytes with 32 bits,
+ * so only the first 4GB of the card can be used; sd_fat_mount() refuses
+ * volumes that reach past it with SD_ERROR_FAT_UNSUPPORTED. */
+
+#ifndef _SD_FAT_H
+#define _SD_FAT_H
+
+#include "sd.h"
+
+/* FAT sectors cached */
+#define SD_FAT_CACHE_SECTORS	2
+/* Contiguous extents of a cluster chain remembered per open file */
+#define SD_FAT_EXTENTS		8
+
+/* Open modes */
+#define SD_FAT_READ		(1<<0)
+#define SD_FAT_WRITE		(1<<1)
+/* Create the file if it doesn't exist */
+#define SD_FAT_CREATE		(1<<2)
+/* Empty the file on opening */
+#define SD_FAT_TRUNCATE		(1<<3)
+
+typedef struct _SD_FAT_Extent {
+	/* Cluster number within the file, first cluster on the card, and
+	 * number of clusters */
+	uint32_t index;
+	uint32_t cluster;
+	uint32_t count;
+} SD_FAT_Extent;
+
+typedef struct _SD_FAT_File {
+	uint8_t mode;
+	/* Directory entry needs updating */
+	uint8_t dirty;
+	uint32_t first_cluster;
+	uint32_t size;
+	uint32_t pos;
+	/* Where the directory entry lives */
+	uint32_t dir_sector;
+	uint16_t dir_offset;
+	/* Last cluster of the chain and its number within the file, valid
+	 * once the chain has been followed to its end */
+	uint32_t tail;
+	uint32_t tail_index;
+	SD_FAT_Extent extents[SD_FAT_EXTENTS];
+	int num_extents;
+} SD_FAT_File;
+
+int sd_fat_mount(void);
+int sd_fat_unmount(void);
+int sd_fat_open(SD_FAT_File *file, const char *path, uint8_t mode);
+int sd_fat_read(SD_FAT_File *file, uint8_t *data, int dataLen);
+int sd_fat_write(SD_FAT_File *file, const uint8_t *data, int dataLen);
+int sd_fat_seek(SD_FAT_File *file, uint32_t pos);
+int sd_fat_sync(SD_FAT_File *file);
+int sd_fat_close(SD_FAT_File *file);
+uint32_t sd_fat_size(SD_FAT_File *file);
+
+#endif
@@ -0,0 +1,109 @@
+/* Write gathering for the SD/SPI driver
+ *
+ * Vanya A. Sergeev - <vsergeev@gmail.com> - copyright 2010
+ * please inform author of possible use, licensing is still being decided
+ *
+ */
+
+#include "sd_gather.h"
+
+/* Queued blocks, contiguous on the card starting at sd_gather_address */
+static uint8_t sd_gather_buffer[SD_GATHER_BLOCKS*SD_BLOCK_LENGTH];
+static uint32_t sd_gather_address;
+static int sd_gather_count;
+/* Ticks since the last queued write */
+static int sd_gather_age;
+
+static void sd_gather_copy(uint8_t *dest, const uint8_t *src) {
+	int i;
+
+	for (i = 0; i < SD_BLOCK_LENGTH; i++)
+		dest[i] = src[i];
+}
+
+int sd_gather_flush(void) {
+	int retVal;
+
+	if (sd_gather_count == 0)
+		return 0;
+	sd_gather_age = 0;
+
+	/* A lone block goes out as a plain single block write */
+	if (sd_gather_count == 1) {
+		retVal = sd_write_block(sd_gather_address, sd_gather_buffer);
+	} else {
+		/* Let an SD card erase the whole run up front. This is only a
+		 * performance hint, so the write goes ahead even if it fails. */
+		if (!sd_is_mmc())
+			sd_pre_erase(sd_gather_count);
+
+		retVal = sd_write_blocks(sd_gather_address, sd_gather_buffer, sd_gather_count*SD_BLOCK_LENGTH);
+	}
+
+	/* A failed write keeps the queue, the next flush sends it again */
+	if (retVal < 0)
+		return retVal;
+	sd_gather_count = 0;
+
+	return 0;
+}
+
+int sd_gather_write_block(uint32_t address, const uint8_t *data) {
+	int retVal;
+
+	/* Validate the address now rather than when the queue goes out */
+	if ((address % SD_BLOCK_LENGTH) != 0)
+		return SD_ERROR_WRITE_ADDR_MISALIGNED;
+
+	/* Rewriting a queued block just replaces it */
+	if (sd_gather_count > 0 && address >= sd_gather_address &&
+	    address < sd_gather_address + sd_gather_count*SD_BLOCK_LENGTH) {
+		sd_gather_copy(sd_gather_buffer + (address - sd_gather_address), data);
+		sd_gather_age = 0;
+		return 0;
+	}
+
+	/* A write that doesn't extend the run, or a full queue a failed
+	 * flush left behind, sends the queue out first */
+	if (sd_gather_count == SD_GATHER_BLOCKS ||
+	    (sd_gather_count > 0 && address != sd_gather_address + sd_gather_count*SD_BLOCK_LENGTH)) {
+		retVal = sd_gather_flush();
+		if (retVal < 0)
+			return retVal;
+	}
+
+	if (sd_gather_count == 0)
+		sd_gather_address = address;
+
+	sd_gather_copy(sd_gather_buffer + sd_gather_count*SD_BLOCK_LENGTH, data);
+	sd_gather_count++;
+	sd_gather_age = 0;
+
+	/* Send a full queue right away */
+	if (sd_gather_count == SD_GATHER_BLOCKS)
+		return sd_gather_flush();
+
+	return 0;
+}
+
+int sd_gather_read_block(uint32_t address, uint8_t *data) {
+	/* Serve queued blocks from RAM, the card doesn't have them yet */
+	if (sd_gather_count > 0 && address >= sd_gather_address &&
+	    address < sd_gather_address + sd_gather_count*SD_BLOCK_LENGTH &&
+	    ((address - sd_gather_address) % SD_BLOCK_LENGTH) == 0) {
+		sd_gather_copy(data, sd_gather_buffer + (address - sd_gather_address));
+		return 0;
+	}
+
+	return sd_read_block(address, data);
+}
+
+int sd_gather_tick(void) {
+	if (SD_GATHER_TIMEOUT_TICKS == 0 || sd_gather_count == 0)
+		return 0;
+
+	if (++sd_gather_age < SD_GATHER_TIMEOUT_TICKS)
+		return 0;
+
+	return sd_gather_flush();
+}
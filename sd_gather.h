@@ -0,0 +1,38 @@
+/* Write gathering for the SD/SPI driver
+ *
+ * Vanya A. Sergeev - <vsergeev@gmail.com> - copyright 2010
+ * please inform author of possible use, licensing is still being decided
+ *
+ */
+
+/* Collects contiguous single block writes in RAM and sends them to the
+ * card as one pre-erased multiple block write (ACMD23 + CMD25), which
+ * costs the card far less programming time than a CMD24 per block.
+ *
+ * The queue goes out when SD_GATHER_BLOCKS blocks have been collected,
+ * when a write isn't contiguous with the queued ones, when
+ * sd_gather_tick() has been called SD_GATHER_TIMEOUT_TICKS times since
+ * the last write, or on an explicit sd_gather_flush(). If the write
+ * fails the blocks stay queued and the next flush tries them again.
+ *
+ * Reads of queued blocks must go through sd_gather_read_block(), and
+ * sd_gather_flush() must be called before using the sd_* write functions
+ * directly. */
+
+#ifndef _SD_GATHER_H
+#define _SD_GATHER_H
+
+#include "sd.h"
+
+/* Maximum number of SD_BLOCK_LENGTH byte blocks gathered per burst */
+#define SD_GATHER_BLOCKS	8
+/* Number of sd_gather_tick() calls without a write before the queue is
+ * flushed, 0 disables the timeout */
+#define SD_GATHER_TIMEOUT_TICKS	10
+
+int sd_gather_write_block(uint32_t address, const uint8_t *data);
+int sd_gather_read_block(uint32_t address, uint8_t *data);
+int sd_gather_flush(void);
+int sd_gather_tick(void);
+
+#endif
@@ -0,0 +1,315 @@
+/* Append-only record log for the SD/SPI driver
+ *
+ * Vanya A. Sergeev - <vsergeev@gmail.com> - copyright 2010
+ * please inform author of possible use, licensing is still being decided
+ *
+ */
+
+#include "sd_log.h"
+
+#define SD_LOG_PAGE_HEADER	8
+#define SD_LOG_CRC_OFFSET	(SD_BLOCK_LENGTH - 2)
+/* Blocks the driver's 32-bit byte addresses reach, 4GB */
+#define SD_LOG_MAX_BLOCKS	(0x100000000ULL / SD_BLOCK_LENGTH)
+
+/* Log region and layout */
+static uint32_t sd_log_start;
+static uint32_t sd_log_segments;
+static uint32_t sd_log_segment_blocks;
+static uint16_t sd_log_record_len;
+static uint16_t sd_log_per_page;
+
+/* Append point: segment, its sequence number, block within it, and the
+ * page being filled */
+static uint32_t sd_log_segment;
+static uint32_t sd_log_segment_seq;
+static uint32_t sd_log_block;
+static uint32_t sd_log_page_seq;
+static uint16_t sd_log_count;
+static uint8_t sd_log_page[SD_BLOCK_LENGTH];
+/* A CMD25 transfer is open */
+static uint8_t sd_log_burst;
+
+static uint32_t sd_log_get32(const uint8_t *p) {
+	return p[0] | (p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void sd_log_put32(uint8_t *p, uint32_t value) {
+	p[0] = value;
+	p[1] = value >> 8;
+	p[2] = value >> 16;
+	p[3] = value >> 24;
+}
+
+static void sd_log_seal(uint8_t *block) {
+	uint16_t crc16;
+
+	crc16 = sd_crc16_data(block, SD_LOG_CRC_OFFSET);
+	block[SD_LOG_CRC_OFFSET] = crc16 >> 8;
+	block[SD_LOG_CRC_OFFSET+1] = crc16;
+}
+
+static int sd_log_sealed(const uint8_t *block) {
+	return (sd_crc16_data(block, SD_LOG_CRC_OFFSET) ==
+		((block[SD_LOG_CRC_OFFSET] << 8) | block[SD_LOG_CRC_OFFSET+1]));
+}
+
+static uint32_t sd_log_address(uint32_t segment, uint32_t block) {
+	return (sd_log_start + segment*sd_log_segment_blocks + block)*SD_BLOCK_LENGTH;
+}
+
+/* Sends one block of the open transfer and waits for it to program */
+static int sd_log_send(const uint8_t *block) {
+	int retVal;
+
+	retVal = sd_write_blocks_next(block);
+	if (sd_busy_wait(SD_WRITE_TIMEOUT_MS) < 0)
+		retVal = SD_ERROR_WRITE_TIMEOUT;
+	sd_spi_delay_clocks();
+
+	return retVal;
+}
+
+static int sd_log_end_burst(void) {
+	int retVal;
+
+	if (!sd_log_burst)
+		return 0;
+	sd_log_burst = 0;
+
+	retVal = 0;
+	sd_write_blocks_stop();
+	if (sd_busy_wait(SD_WRITE_TIMEOUT_MS) < 0)
+		retVal = SD_ERROR_WRITE_TIMEOUT;
+	sd_spi_delay_clocks();
+	if (retVal == 0)
+		sd_stats_done(SD_STATS_CMD25);
+
+	return retVal;
+}
+
+/* Opens a transfer at the append point, pre-erasing the rest of the
+ * segment, and starts a new segment with its header */
+static int sd_log_begin_burst(void) {
+	uint8_t header[SD_BLOCK_LENGTH];
+	int i, retVal;
+
+	if (sd_log_burst)
+		return 0;
+
+	if (!sd_is_mmc()) {
+		retVal = sd_pre_erase(sd_log_segment_blocks - sd_log_block);
+		if (retVal < 0)
+			return retVal;
+	}
+
+	retVal = sd_write_blocks_start(sd_log_address(sd_log_segment, sd_log_block));
+	if (retVal < 0)
+		return retVal;
+	sd_log_burst = 1;
+
+	if (sd_log_block == 0) {
+		for (i = 0; i < SD_BLOCK_LENGTH; i++)
+			header[i] = 0;
+		sd_log_put32(header, SD_LOG_MAGIC);
+		sd_log_put32(header + 4, sd_log_segment_seq);
+		sd_log_put32(header + 8, sd_log_page_seq);
+		header[12] = sd_log_record_len;
+		header[13] = sd_log_record_len >> 8;
+		sd_log_put32(header + 14, sd_log_segment_blocks);
+		sd_log_seal(header);
+
+		retVal = sd_log_send(header);
+		if (retVal < 0) {
+			sd_log_end_burst();
+			return retVal;
+		}
+		sd_log_block = 1;
+	}
+
+	return 0;
+}
+
+/* Writes the page being filled at the append point */
+static int sd_log_write_page(void) {
+	int retVal;
+
+	sd_log_put32(sd_log_page, sd_log_page_seq);
+	sd_log_page[4] = sd_log_count;
+	sd_log_page[5] = sd_log_count >> 8;
+	sd_log_page[6] = sd_log_record_len;
+	sd_log_page[7] = sd_log_record_len >> 8;
+	sd_log_seal(sd_log_page);
+
+	retVal = sd_log_begin_burst();
+	if (retVal < 0)
+		return retVal;
+
+	retVal = sd_log_send(sd_log_page);
+	if (retVal < 0) {
+		sd_log_end_burst();
+		return retVal;
+	}
+
+	return 0;
+}
+
+/* Checks a block read back at mount. Returns 1 for a page of this log
+ * with sequence number seq. */
+static int sd_log_valid_page(const uint8_t *page, uint32_t seq) {
+	uint16_t count;
+
+	count = page[4] | (page[5] << 8);
+	return (sd_log_sealed(page) && sd_log_get32(page) == seq &&
+		(page[6] | (page[7] << 8)) == sd_log_record_len &&
+		count > 0 && count <= sd_log_per_page);
+}
+
+int sd_log_mount(uint32_t lba, uint32_t nblocks, uint16_t record_len) {
+	uint8_t block[SD_BLOCK_LENGTH];
+	uint32_t segment, seq, first_page, low, high, mid;
+	int found, retVal;
+
+	sd_log_burst = 0;
+
+	/* The whole region has to be addressable */
+	if (lba >= SD_LOG_MAX_BLOCKS || nblocks > SD_LOG_MAX_BLOCKS - lba)
+		return SD_ERROR_LOG_CONFIG;
+	if (record_len == 0 || record_len > SD_LOG_CRC_OFFSET - SD_LOG_PAGE_HEADER)
+		return SD_ERROR_LOG_CONFIG;
+	sd_log_record_len = record_len;
+	sd_log_per_page = (SD_LOG_CRC_OFFSET - SD_LOG_PAGE_HEADER) / record_len;
+
+	sd_log_segment_blocks = sd_get_au_blocks();
+	if (sd_log_segment_blocks == 0)
+		sd_log_segment_blocks = SD_LOG_SEGMENT_BLOCKS;
+	/* Segments start on AU boundaries */
+	if (lba % sd_log_segment_blocks != 0) {
+		seq = sd_log_segment_blocks - (lba % sd_log_segment_blocks);
+		if (nblocks < seq)
+			return SD_ERROR_LOG_CONFIG;
+		nblocks -= seq;
+		lba += seq;
+	}
+	sd_log_start = lba;
+	sd_log_segments = nblocks / sd_log_segment_blocks;
+	if (sd_log_segments < 2)
+		return SD_ERROR_LOG_CONFIG;
+
+	/* The newest segment holds the append point */
+	found = 0;
+	first_page = 0;
+	for (segment = 0; segment < sd_log_segments; segment++) {
+		retVal = sd_read_block(sd_log_address(segment, 0), block);
+		if (retVal < 0)
+			return retVal;
+
+		if (!sd_log_sealed(block) || sd_log_get32(block) != SD_LOG_MAGIC ||
+		    (block[12] | (block[13] << 8)) != record_len ||
+		    sd_log_get32(block + 14) != sd_log_segment_blocks)
+			continue;
+
+		seq = sd_log_get32(block + 4);
+		if (!found || (int32_t)(seq - sd_log_segment_seq) > 0) {
+			found = 1;
+			sd_log_segment = segment;
+			sd_log_segment_seq = seq;
+			first_page = sd_log_get32(block + 8);
+		}
+	}
+
+	sd_log_count = 0;
+	if (!found) {
+		sd_log_segment = 0;
+		sd_log_segment_seq = 1;
+		sd_log_block = 0;
+		sd_log_page_seq = 0;
+		return 0;
+	}
+
+	/* Pages are written in order, so the valid ones are a prefix of the
+	 * segment and its end can be found by bisection. Leftovers of an
+	 * earlier pass through the ring carry older sequence numbers. */
+	low = 1;
+	high = sd_log_segment_blocks;
+	while (low < high) {
+		mid = low + (high - low) / 2;
+		retVal = sd_read_block(sd_log_address(sd_log_segment, mid), block);
+		if (retVal < 0)
+			return retVal;
+		if (sd_log_valid_page(block, first_page + mid - 1))
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	sd_log_block = low;
+	sd_log_page_seq = first_page + low - 1;
+
+	/* Carry on in the next segment if this one is full */
+	if (sd_log_block == sd_log_segment_blocks) {
+		sd_log_segment = (sd_log_segment + 1) % sd_log_segments;
+		sd_log_segment_seq++;
+		sd_log_block = 0;
+	}
+
+	return 0;
+}
+
+int sd_log_append(const uint8_t *record) {
+	uint8_t *p;
+	uint16_t i;
+	int retVal;
+
+	if (sd_log_per_page == 0)
+		return SD_ERROR_LOG_CONFIG;
+
+	p = sd_log_page + SD_LOG_PAGE_HEADER + sd_log_count*sd_log_record_len;
+	for (i = 0; i < sd_log_record_len; i++)
+		p[i] = record[i];
+	sd_log_count++;
+
+	if (sd_log_count < sd_log_per_page)
+		return 0;
+
+	/* The page is full, send it */
+	retVal = sd_log_write_page();
+	if (retVal < 0) {
+		/* Drop the record so it can be appended again, the page goes
+		 * out once it fills up next time */
+		sd_log_count--;
+		return retVal;
+	}
+
+	sd_log_count = 0;
+	sd_log_page_seq++;
+	sd_log_block++;
+	for (i = 0; i < SD_LOG_CRC_OFFSET; i++)
+		sd_log_page[i] = 0;
+
+	if (sd_log_block == sd_log_segment_blocks) {
+		retVal = sd_log_end_burst();
+		sd_log_segment = (sd_log_segment + 1) % sd_log_segments;
+		sd_log_segment_seq++;
+		sd_log_block = 0;
+		return retVal;
+	}
+
+	return 0;
+}
+
+int sd_log_sync(void) {
+	int retVal;
+
+	if (sd_log_count > 0) {
+		retVal = sd_log_write_page();
+		if (retVal < 0)
+			return retVal;
+	}
+
+	return sd_log_end_burst();
+}
+
+/* Sequence number the next record appended will get */
+uint32_t sd_log_records(void) {
+	return sd_log_page_seq*sd_log_per_page + sd_log_count;
+}
@@ -0,0 +1,60 @@
+/* Append-only record log for the SD/SPI driver
+ *
+ * Vanya A. Sergeev - <vsergeev@gmail.com> - copyright 2010
+ * please inform author of possible use, licensing is still being decided
+ *
+ */
+
+/* sd_log keeps fixed-size records (GPS fixes, sensor samples) in a ring
+ * of segments on a raw region of the card, without a filesystem.
+ *
+ * A segment is one allocation unit long (SD_LOG_SEGMENT_BLOCKS without an
+ * AU size from the card). Its first block is a header with the segment's
+ * sequence number, and every following block is a page of records:
+ *
+ *	page:	 0 sequence number of the page (32 bits, little endian)
+ *		 4 records in the page (16 bits)
+ *		 6 record length (16 bits)
+ *		 8 records
+ *	       510 CRC16 of bytes 0-509 (big endian)
+ *
+ *	header:	 0 SD_LOG_MAGIC (32 bits)
+ *		 4 sequence number of the segment (32 bits)
+ *		 8 sequence number of its first page (32 bits)
+ *		12 record length (16 bits)
+ *		14 segment length in blocks (32 bits)
+ *	       510 CRC16 of bytes 0-509
+ *
+ * Pages are numbered consecutively over the whole log, so record n of
+ * page p is record p*(records per page) + n.
+ *
+ * A segment is written as a single ACMD23 + CMD25 burst, header first,
+ * one page at a time as pages fill up, and the transfer is kept open
+ * between calls to sd_log_append(). No other sd_* function may be used
+ * until sd_log_sync() has ended it. sd_log_sync() also writes out a
+ * partly filled page, which is written again as it fills.
+ *
+ * sd_log_mount() reads the header of every segment, picks the newest and
+ * finds its last valid page by bisection, so recovery takes a block read
+ * per segment plus a few more. Once the ring is full the oldest segment
+ * is written over. The region has to lie within the first 4GB of the
+ * card, which is all the driver's 32-bit byte addresses reach.
+ *
+ * tools/sd_log_dump.c reads a log back from a card image on a PC. */
+
+#ifndef _SD_LOG_H
+#define _SD_LOG_H
+
+#include "sd.h"
+
+/* Segment length used when the card doesn't report an AU size */
+#define SD_LOG_SEGMENT_BLOCKS	64
+/* "SDLG" */
+#define SD_LOG_MAGIC		0x474C4453
+
+int sd_log_mount(uint32_t lba, uint32_t nblocks, uint16_t record_len);
+int sd_log_append(const uint8_t *record);
+int sd_log_sync(void);
+uint32_t sd_log_records(void);
+
+#endif
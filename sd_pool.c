@@ -0,0 +1,297 @@
+/* Pre-erased block pool for the SD/SPI driver
+ *
+ * Vanya A. Sergeev - <vsergeev@gmail.com> - copyright 2010
+ * please inform author of possible use, licensing is still being decided
+ *
+ */
+
+#include "sd_pool.h"
+#include "sd_au.h"
+
+/* Extent states */
+#define SD_POOL_UNUSED		0
+#define SD_POOL_DIRTY		1
+#define SD_POOL_ERASING		2
+#define SD_POOL_ERASED		3
+/* Free, but the card refused to erase it, so it isn't tried again */
+#define SD_POOL_UNERASED	4
+
+typedef struct _SD_Pool_Extent {
+	uint8_t state;
+	uint32_t lba;
+	uint32_t nblocks;
+} SD_Pool_Extent;
+
+SD_Pool_Stats sd_pool_stats;
+
+static SD_Pool_Extent sd_pool_extents[SD_POOL_EXTENTS];
+/* Extent being erased, -1 for none */
+static int sd_pool_erasing = -1;
+/* Busy probes left before the erase is given up on */
+static uint32_t sd_pool_probes;
+/* An erase was given up on and the card may still be busy with it */
+static uint8_t sd_pool_busy;
+
+static void sd_pool_account(uint8_t state, uint32_t nblocks, int add) {
+	uint32_t *count;
+
+	if (state == SD_POOL_ERASED)
+		count = &sd_pool_stats.erased_blocks;
+	else
+		count = &sd_pool_stats.dirty_blocks;
+
+	if (add)
+		*count += nblocks;
+	else
+		*count -= nblocks;
+}
+
+/* Joins extent e with the free extents of the same state right before
+ * and after it */
+static void sd_pool_merge(int e) {
+	SD_Pool_Extent *ext, *other;
+	int i;
+
+	ext = &sd_pool_extents[e];
+	for (i = 0; i < SD_POOL_EXTENTS; i++) {
+		other = &sd_pool_extents[i];
+		if (i == e || other->state != ext->state)
+			continue;
+
+		if (other->lba + other->nblocks == ext->lba) {
+			ext->lba = other->lba;
+			ext->nblocks += other->nblocks;
+			other->state = SD_POOL_UNUSED;
+		} else if (ext->lba + ext->nblocks == other->lba) {
+			ext->nblocks += other->nblocks;
+			other->state = SD_POOL_UNUSED;
+		}
+	}
+}
+
+static int sd_pool_slot(void) {
+	int i;
+
+	for (i = 0; i < SD_POOL_EXTENTS; i++) {
+		if (sd_pool_extents[i].state == SD_POOL_UNUSED)
+			return i;
+	}
+
+	return -1;
+}
+
+int sd_pool_free(uint32_t lba, uint32_t nblocks) {
+	SD_Pool_Extent *ext;
+	int e;
+
+	if (nblocks == 0)
+		return 0;
+	/* The erase takes byte addresses, which have to fit in 32 bits */
+	if (lba >= SD_MAX_BLOCKS || nblocks > SD_MAX_BLOCKS - lba)
+		return SD_ERROR_END_ADDR_OUTBOUNDS;
+
+	/* A block freed twice would be handed out twice */
+	for (e = 0; e < SD_POOL_EXTENTS; e++) {
+		ext = &sd_pool_extents[e];
+		if (ext->state != SD_POOL_UNUSED && lba < ext->lba + ext->nblocks && ext->lba < lba + nblocks)
+			return SD_ERROR_POOL_OVERLAP;
+	}
+
+	e = sd_pool_slot();
+	if (e < 0)
+		return SD_ERROR_POOL_FULL;
+
+	sd_pool_extents[e].state = SD_POOL_DIRTY;
+	sd_pool_extents[e].lba = lba;
+	sd_pool_extents[e].nblocks = nblocks;
+	sd_pool_merge(e);
+	sd_pool_account(SD_POOL_DIRTY, nblocks, 1);
+
+	return 0;
+}
+
+/* Moves the extent being erased to its final state */
+static void sd_pool_erased(uint8_t state) {
+	SD_Pool_Extent *ext;
+
+	ext = &sd_pool_extents[sd_pool_erasing];
+	ext->state = state;
+	sd_pool_account(state, ext->nblocks, 1);
+	sd_pool_merge(sd_pool_erasing);
+	sd_pool_erasing = -1;
+}
+
+/* Checks on the erase in progress once. Returns 1 while the card is
+ * still busy, 0 once it's done, or an error. */
+static int sd_pool_check(void) {
+	if (sd_busy_poll()) {
+		if (sd_pool_probes-- != 0)
+			return 1;
+
+		sd_pool_stats.erase_errors++;
+		sd_pool_erased(SD_POOL_UNERASED);
+		sd_pool_busy = 1;
+		return SD_ERROR_ERASE_TIMEOUT;
+	}
+	sd_spi_delay_clocks();
+
+	sd_stats_done(SD_STATS_CMD38);
+	sd_pool_erased(SD_POOL_ERASED);
+	return 0;
+}
+
+/* Splits the next chunk off a dirty extent and starts erasing it */
+static int sd_pool_start(void) {
+	SD_Pool_Extent *ext;
+	uint32_t n, au;
+	int e, chunk, retVal;
+
+	for (e = 0; e < SD_POOL_EXTENTS; e++) {
+		if (sd_pool_extents[e].state == SD_POOL_DIRTY)
+			break;
+	}
+	if (e == SD_POOL_EXTENTS)
+		return 0;
+	ext = &sd_pool_extents[e];
+
+	n = (ext->nblocks < SD_POOL_ERASE_BLOCKS) ? ext->nblocks : SD_POOL_ERASE_BLOCKS;
+	n = sd_au_burst(ext->lba, n);
+
+	/* Without a free slot for the chunk the whole extent goes at once */
+	chunk = e;
+	if (n < ext->nblocks) {
+		chunk = sd_pool_slot();
+		if (chunk < 0) {
+			chunk = e;
+			n = ext->nblocks;
+		}
+	}
+	if (chunk != e) {
+		sd_pool_extents[chunk].lba = ext->lba;
+		sd_pool_extents[chunk].nblocks = n;
+		ext->lba += n;
+		ext->nblocks -= n;
+	}
+	sd_pool_extents[chunk].state = SD_POOL_ERASING;
+	sd_pool_account(SD_POOL_DIRTY, n, 0);
+	sd_pool_erasing = chunk;
+
+	sd_pool_stats.erases++;
+	retVal = sd_erase_blocks_start(sd_pool_extents[chunk].lba*SD_BLOCK_LENGTH, (sd_pool_extents[chunk].lba + n - 1)*SD_BLOCK_LENGTH);
+	if (retVal < 0) {
+		sd_pool_stats.erase_errors++;
+		sd_pool_erased(SD_POOL_UNERASED);
+		return retVal;
+	}
+
+	au = sd_get_au_blocks();
+	sd_pool_probes = (sd_get_speed() / 8000) * sd_get_erase_timeout_ms((au != 0) ? (n + au - 1) / au : 1);
+
+	return 1;
+}
+
+/* Returns non-zero while there is erasing left to do */
+int sd_pool_poll(void) {
+	int retVal;
+
+	if (sd_pool_erasing >= 0) {
+		retVal = sd_pool_check();
+		if (retVal != 0)
+			return retVal;
+	}
+
+	/* No new erase until the card is done with the one that timed out */
+	if (sd_pool_busy) {
+		if (sd_busy_poll())
+			return 1;
+		sd_spi_delay_clocks();
+		sd_pool_busy = 0;
+	}
+
+	return sd_pool_start();
+}
+
+/* Waits for an erase in progress to finish, and for the card to get done
+ * with one that timed out. Returns 0 once the card is idle, or
+ * SD_ERROR_ERASE_TIMEOUT if it is still busy SD_ERASE_TIMEOUT_MS later. */
+int sd_pool_wait(void) {
+	if (sd_pool_erasing >= 0) {
+		while (sd_pool_check() == 1)
+			;
+	}
+
+	if (sd_pool_busy) {
+		if (sd_busy_wait(SD_ERASE_TIMEOUT_MS) < 0)
+			return SD_ERROR_ERASE_TIMEOUT;
+		sd_pool_busy = 0;
+	}
+
+	return 0;
+}
+
+/* Takes up to nblocks free blocks off the pool, from an erased extent if
+ * there is one, and returns how many were taken, starting at *lba, or an
+ * error if the card couldn't be made idle. */
+int sd_pool_alloc(uint32_t nblocks, uint32_t *lba) {
+	SD_Pool_Extent *ext;
+	int i, best, retVal;
+
+	/* The card has to be idle before it can be written */
+	retVal = sd_pool_wait();
+	if (retVal < 0)
+		return retVal;
+
+	/* The first erased extent that fits, or else the largest one;
+	 * extents that aren't erased only if there are no erased ones */
+	best = -1;
+	for (i = 0; i < SD_POOL_EXTENTS; i++) {
+		ext = &sd_pool_extents[i];
+		if (ext->state == SD_POOL_UNUSED)
+			continue;
+		if (best < 0) {
+			best = i;
+			continue;
+		}
+		if ((ext->state == SD_POOL_ERASED) != (sd_pool_extents[best].state == SD_POOL_ERASED)) {
+			if (ext->state == SD_POOL_ERASED)
+				best = i;
+			continue;
+		}
+		if (sd_pool_extents[best].nblocks < nblocks && ext->nblocks > sd_pool_extents[best].nblocks)
+			best = i;
+	}
+	if (best < 0)
+		return 0;
+
+	ext = &sd_pool_extents[best];
+	if (nblocks > ext->nblocks)
+		nblocks = ext->nblocks;
+
+	*lba = ext->lba;
+	ext->lba += nblocks;
+	ext->nblocks -= nblocks;
+	sd_pool_account(ext->state, nblocks, 0);
+	if (ext->state == SD_POOL_ERASED)
+		sd_pool_stats.alloc_erased += nblocks;
+	else
+		sd_pool_stats.alloc_dirty += nblocks;
+
+	if (ext->nblocks == 0)
+		ext->state = SD_POOL_UNUSED;
+
+	return nblocks;
+}
+
+/* Forgets all free blocks, e.g. after a card change */
+void sd_pool_clear(void) {
+	int i;
+
+	sd_pool_wait();
+
+	for (i = 0; i < SD_POOL_EXTENTS; i++)
+		sd_pool_extents[i].state = SD_POOL_UNUSED;
+	sd_pool_busy = 0;
+
+	sd_pool_stats.erased_blocks = 0;
+	sd_pool_stats.dirty_blocks = 0;
+}
@@ -0,0 +1,55 @@
+/* Pre-erased block pool for the SD/SPI driver
+ *
+ * Vanya A. Sergeev - <vsergeev@gmail.com> - copyright 2010
+ * please inform author of possible use, licensing is still being decided
+ *
+ */
+
+/* The application hands blocks it no longer needs to sd_pool_free().
+ * sd_pool_poll(), called from the main loop whenever the card is
+ * otherwise unused, erases them in the background, one CMD38 of at most
+ * SD_POOL_ERASE_BLOCKS blocks (never crossing an AU boundary) at a time,
+ * checking on the card's busy signal once per call instead of waiting it
+ * out. sd_pool_alloc() gives out free extents for writing, erased ones
+ * first, so writers don't have to sit through the erase themselves.
+ *
+ * Block numbers are in units of SD_BLOCK_LENGTH. While sd_pool_poll()
+ * returns non-zero an erase may be in progress and no other sd_* function
+ * may be used; sd_pool_alloc() and sd_pool_wait() finish it first. An
+ * erase that times out is reported by sd_pool_poll() and its blocks are
+ * no longer erased, but sd_pool_poll() doesn't start another one until
+ * the card has stopped being busy, and sd_pool_alloc() and
+ * sd_pool_wait() wait for that too. Blocks already in the pool can't be
+ * freed again. */
+
+#ifndef _SD_POOL_H
+#define _SD_POOL_H
+
+#include "sd.h"
+
+/* Maximum number of separate free extents kept track of */
+#define SD_POOL_EXTENTS		16
+/* Largest number of blocks erased with a single CMD38 */
+#define SD_POOL_ERASE_BLOCKS	8192
+
+typedef struct _SD_Pool_Stats {
+	/* Free blocks on hand, erased and not (yet) erased */
+	uint32_t erased_blocks;
+	uint32_t dirty_blocks;
+	/* Background erases issued and failed */
+	uint32_t erases;
+	uint32_t erase_errors;
+	/* Blocks handed out by sd_pool_alloc(), erased and not erased */
+	uint32_t alloc_erased;
+	uint32_t alloc_dirty;
+} SD_Pool_Stats;
+
+extern SD_Pool_Stats sd_pool_stats;
+
+int sd_pool_free(uint32_t lba, uint32_t nblocks);
+int sd_pool_alloc(uint32_t nblocks, uint32_t *lba);
+int sd_pool_poll(void);
+int sd_pool_wait(void);
+void sd_pool_clear(void);
+
+#endif
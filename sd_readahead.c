@@ -0,0 +1,96 @@
+/* Sequential read-ahead for the SD/SPI driver
+ *
+ * Vanya A. Sergeev - <vsergeev@gmail.com> - copyright 2010
+ * please inform author of possible use, licensing is still being decided
+ *
+ */
+
+#include "sd_readahead.h"
+
+/* Prefetch ring */
+static uint8_t sd_ra_ring[SD_READAHEAD_BLOCKS][SD_BLOCK_LENGTH];
+/* Index of the oldest prefetched block and number of blocks in the ring */
+static int sd_ra_head, sd_ra_count;
+/* Set while a CMD18 transfer is open */
+static int sd_ra_open;
+/* Address of the block at the head of the ring, which is the next block
+ * a sequential reader will ask for */
+static uint32_t sd_ra_next;
+/* Address of the last block requested, for sequential access detection */
+static uint32_t sd_ra_last = 0xFFFFFFFF;
+
+static int sd_ra_fill(void) {
+	int i, retVal;
+
+	/* Pull a ring's worth of blocks out of the open transfer */
+	sd_ra_head = 0;
+	for (i = 0; i < SD_READAHEAD_BLOCKS; i++) {
+		retVal = sd_read_blocks_next(sd_ra_ring[i]);
+		if (retVal < 0) {
+			/* Keep whatever made it, but the transfer is no good anymore */
+			sd_ra_open = 0;
+			sd_read_blocks_stop();
+			return (i == 0) ? retVal : 0;
+		}
+		sd_ra_count++;
+	}
+
+	return 0;
+}
+
+int sd_readahead_stop(void) {
+	int retVal;
+
+	sd_ra_count = 0;
+	if (!sd_ra_open)
+		return 0;
+
+	sd_ra_open = 0;
+	retVal = sd_read_blocks_stop();
+	if (retVal == 0)
+		sd_stats_done(SD_STATS_CMD18);
+
+	return retVal;
+}
+
+int sd_readahead_read_block(uint32_t address, uint8_t *data) {
+	uint8_t *block;
+	int i, retVal;
+
+	if (!(sd_ra_count > 0 || sd_ra_open) || address != sd_ra_next) {
+		/* The access pattern broke, drop the prefetched blocks */
+		sd_readahead_stop();
+
+		if (address != sd_ra_last + SD_BLOCK_LENGTH) {
+			/* Not sequential (yet), a single block read will do */
+			sd_ra_last = address;
+			return sd_read_block(address, data);
+		}
+
+		/* Sequential access: open a transfer from here on */
+		retVal = sd_read_blocks_start(address);
+		if (retVal < 0)
+			return retVal;
+		sd_ra_open = 1;
+		sd_ra_next = address;
+	}
+
+	/* Refill the ring from the open transfer once it runs dry */
+	if (sd_ra_count == 0) {
+		retVal = sd_ra_fill();
+		if (retVal < 0)
+			return retVal;
+	}
+
+	/* Hand out the block at the head of the ring */
+	block = sd_ra_ring[sd_ra_head];
+	for (i = 0; i < SD_BLOCK_LENGTH; i++)
+		data[i] = block[i];
+
+	sd_ra_head++;
+	sd_ra_count--;
+	sd_ra_next += SD_BLOCK_LENGTH;
+	sd_ra_last = address;
+
+	return 0;
+}
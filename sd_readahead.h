@@ -0,0 +1,28 @@
+/* Sequential read-ahead for the SD/SPI driver
+ *
+ * Vanya A. Sergeev - <vsergeev@gmail.com> - copyright 2010
+ * please inform author of possible use, licensing is still being decided
+ *
+ */
+
+/* Drop-in replacement for sd_read_block() for callers that read block by
+ * block. Once two consecutive requests are for adjacent blocks, a CMD18
+ * transfer is opened and kept open, and SD_READAHEAD_BLOCKS blocks at a
+ * time are prefetched from it into a ring of buffers. The transfer is
+ * stopped with CMD12 only when the access pattern breaks.
+ *
+ * While a transfer is open the card can't take any other command: call
+ * sd_readahead_stop() before using any other sd_* function. */
+
+#ifndef _SD_READAHEAD_H
+#define _SD_READAHEAD_H
+
+#include "sd.h"
+
+/* Number of SD_BLOCK_LENGTH byte buffers in the prefetch ring */
+#define SD_READAHEAD_BLOCKS	4
+
+int sd_readahead_read_block(uint32_t address, uint8_t *data);
+int sd_readahead_stop(void);
+
+#endif
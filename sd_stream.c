@@ -0,0 +1,55 @@
+/* Double-buffered streaming reads for the SD/SPI driver
+ *
+ * Vanya A. Sergeev - <vsergeev@gmail.com> - copyright 2010
+ * please inform author of possible use, licensing is still being decided
+ *
+ */
+
+#include "sd_stream.h"
+
+/* Ping-pong buffers */
+static uint8_t sd_stream_buffer[2][SD_BLOCK_LENGTH];
+
+int sd_read_stream(uint32_t lba, uint32_t nblocks, SD_Stream_Callback cb, void *ctx) {
+	uint8_t *block;
+	uint32_t i;
+	int retVal, stopVal;
+
+	if (nblocks == 0)
+		return 0;
+	/* The byte address of the last block has to fit in 32 bits */
+	if (lba >= SD_MAX_BLOCKS || nblocks > SD_MAX_BLOCKS - lba)
+		return SD_ERROR_READ_ADDR_OUTBOUNDS;
+
+	/* A single block doesn't need an open transfer */
+	if (nblocks == 1) {
+		retVal = sd_read_block(lba*SD_BLOCK_LENGTH, sd_stream_buffer[0]);
+		if (retVal < 0)
+			return retVal;
+		return cb(ctx, lba, sd_stream_buffer[0]);
+	}
+
+	retVal = sd_read_blocks_start(lba*SD_BLOCK_LENGTH);
+	if (retVal < 0)
+		return retVal;
+
+	for (i = 0; i < nblocks; i++) {
+		/* Fill the buffer the callback before last was given */
+		block = sd_stream_buffer[i & 1];
+		retVal = sd_read_blocks_next(block);
+		if (retVal < 0)
+			break;
+
+		retVal = cb(ctx, lba + i, block);
+		if (retVal != 0)
+			break;
+	}
+
+	stopVal = sd_read_blocks_stop();
+	if (retVal == 0)
+		retVal = stopVal;
+	if (retVal == 0)
+		sd_stats_done(SD_STATS_CMD18);
+
+	return retVal;
+}
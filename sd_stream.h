@@ -0,0 +1,28 @@
+/* Double-buffered streaming reads for the SD/SPI driver
+ *
+ * Vanya A. Sergeev - <vsergeev@gmail.com> - copyright 2010
+ * please inform author of possible use, licensing is still being decided
+ *
+ */
+
+/* sd_read_stream() reads any number of blocks over a single CMD18
+ * transfer using two block buffers, handing each block to a callback as
+ * it arrives. A block passed to the callback stays untouched until the
+ * callback for the block after it has returned, so the consumer may keep
+ * working on it (from an interrupt, say) while the next one is read in.
+ *
+ * The card waits on the SPI clock, so a slow callback only slows the
+ * stream down, it never loses data. A non-zero return from the callback
+ * ends the stream early. Block numbers are in units of SD_BLOCK_LENGTH,
+ * streams reaching past SD_MAX_BLOCKS are refused. */
+
+#ifndef _SD_STREAM_H
+#define _SD_STREAM_H
+
+#include "sd.h"
+
+typedef int (*SD_Stream_Callback)(void *ctx, uint32_t lba, const uint8_t *data);
+
+int sd_read_stream(uint32_t lba, uint32_t nblocks, SD_Stream_Callback cb, void *ctx);
+
+#endif
@@ -0,0 +1,173 @@
+/* Block striping over several cards for the SD/SPI driver
+ *
+ * Vanya A. Sergeev - <vsergeev@gmail.com> - copyright 2010
+ * please inform author of possible use, licensing is still being decided
+ *
+ */
+
+#include "sd_stripe.h"
+
+/* Card a block of the striped set lives on, and its block number there */
+static int sd_stripe_card(uint32_t lba) {
+	return (lba / SD_STRIPE_BLOCKS) % SD_NUM_CARDS;
+}
+
+static uint32_t sd_stripe_block(uint32_t lba) {
+	return (lba / SD_STRIPE_BLOCKS / SD_NUM_CARDS)*SD_STRIPE_BLOCKS + (lba % SD_STRIPE_BLOCKS);
+}
+
+/* First block and number of blocks of a range on every card. The blocks
+ * a range has on one card are contiguous there. Returns non-zero if the
+ * range reaches past SD_MAX_BLOCKS on a card. */
+static int sd_stripe_split(uint32_t lba, uint32_t nblocks, uint32_t *first, uint32_t *count) {
+	uint32_t i;
+	int card;
+
+	if (nblocks > 0xFFFFFFFF - lba)
+		return 1;
+
+	for (card = 0; card < SD_NUM_CARDS; card++)
+		count[card] = 0;
+
+	for (i = 0; i < nblocks; i++) {
+		card = sd_stripe_card(lba + i);
+		if (count[card]++ == 0)
+			first[card] = sd_stripe_block(lba + i);
+	}
+
+	/* The byte address of a card's last block has to fit in 32 bits */
+	for (card = 0; card < SD_NUM_CARDS; card++) {
+		if (count[card] > 0 && (first[card] >= SD_MAX_BLOCKS || count[card] > SD_MAX_BLOCKS - first[card]))
+			return 1;
+	}
+
+	return 0;
+}
+
+int sd_stripe_init(void) {
+	int card, selected, retVal;
+
+	selected = sd_get_card();
+
+	retVal = 0;
+	for (card = 0; card < SD_NUM_CARDS && retVal == 0; card++) {
+		sd_select_card(card);
+		retVal = sd_init();
+	}
+
+	sd_select_card(selected);
+
+	return retVal;
+}
+
+int sd_stripe_write(uint32_t lba, const uint8_t *data, uint32_t nblocks) {
+	uint32_t first[SD_NUM_CARDS], count[SD_NUM_CARDS], sent[SD_NUM_CARDS];
+	uint8_t open[SD_NUM_CARDS];
+	uint32_t i;
+	int card, selected, retVal, stopVal;
+
+	if (sd_stripe_split(lba, nblocks, first, count))
+		return SD_ERROR_WRITE_ADDR_OUTBOUNDS;
+	selected = sd_get_card();
+
+	/* Open a burst on every card the range touches */
+	retVal = 0;
+	for (card = 0; card < SD_NUM_CARDS; card++) {
+		open[card] = 0;
+		sent[card] = 0;
+		if (count[card] == 0 || retVal < 0)
+			continue;
+
+		sd_select_card(card);
+		if (!sd_is_mmc())
+			retVal = sd_pre_erase(count[card]);
+		if (retVal == 0)
+			retVal = sd_write_blocks_start(first[card]*SD_BLOCK_LENGTH);
+		if (retVal == 0)
+			open[card] = 1;
+	}
+
+	/* Send the blocks in order. A card is only waited on right before
+	 * its next block, so it programs the last one while the other cards
+	 * are sent theirs. */
+	for (i = 0; i < nblocks && retVal == 0; i++) {
+		card = sd_stripe_card(lba + i);
+		sd_select_card(card);
+
+		if (sent[card] > 0) {
+			if (sd_busy_wait(SD_WRITE_TIMEOUT_MS) < 0) {
+				retVal = SD_ERROR_WRITE_TIMEOUT;
+				break;
+			}
+			sd_spi_delay_clocks();
+		}
+
+		retVal = sd_write_blocks_next(data + i*SD_BLOCK_LENGTH);
+		sent[card]++;
+	}
+
+	/* End every open burst, also after an error */
+	for (card = 0; card < SD_NUM_CARDS; card++) {
+		if (!open[card])
+			continue;
+		sd_select_card(card);
+
+		stopVal = 0;
+		if (sent[card] > 0) {
+			if (sd_busy_wait(SD_WRITE_TIMEOUT_MS) < 0)
+				stopVal = SD_ERROR_WRITE_TIMEOUT;
+			sd_spi_delay_clocks();
+		}
+
+		sd_write_blocks_stop();
+		if (sd_busy_wait(SD_WRITE_TIMEOUT_MS) < 0)
+			stopVal = SD_ERROR_WRITE_TIMEOUT;
+		sd_spi_delay_clocks();
+
+		if (retVal == 0)
+			retVal = stopVal;
+		/* Each card's CMD25 sample ends once that card is done */
+		if (retVal == 0)
+			sd_stats_done(SD_STATS_CMD25);
+	}
+
+	sd_select_card(selected);
+
+	return retVal;
+}
+
+int sd_stripe_read(uint32_t lba, uint8_t *data, uint32_t nblocks) {
+	uint32_t first[SD_NUM_CARDS], count[SD_NUM_CARDS], i;
+	int card, selected, retVal, stopVal;
+
+	if (sd_stripe_split(lba, nblocks, first, count))
+		return SD_ERROR_READ_ADDR_OUTBOUNDS;
+	selected = sd_get_card();
+
+	/* One burst per card, its blocks land in stripe order in the buffer */
+	retVal = 0;
+	for (card = 0; card < SD_NUM_CARDS && retVal == 0; card++) {
+		if (count[card] == 0)
+			continue;
+		sd_select_card(card);
+
+		retVal = sd_read_blocks_start(first[card]*SD_BLOCK_LENGTH);
+		if (retVal < 0)
+			break;
+
+		for (i = 0; i < nblocks && retVal == 0; i++) {
+			if (sd_stripe_card(lba + i) == card)
+				retVal = sd_read_blocks_next(data + i*SD_BLOCK_LENGTH);
+		}
+
+		stopVal = sd_read_blocks_stop();
+		if (retVal == 0)
+			retVal = stopVal;
+		if (retVal == 0)
+			sd_stats_done(SD_STATS_CMD18);
+	}
+
+	sd_select_card(selected);
+
+	return retVal;
+}
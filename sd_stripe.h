@@ -0,0 +1,37 @@
+/* Block striping over several cards for the SD/SPI driver
+ *
+ * Vanya A. Sergeev - <vsergeev@gmail.com> - copyright 2010
+ * please inform author of possible use, licensing is still being decided
+ *
+ */
+
+/* sd_stripe spreads one block address space over the SD_NUM_CARDS cards
+ * on the bus (RAID-0): stripe unit n of SD_STRIPE_BLOCKS blocks goes to
+ * card n % SD_NUM_CARDS. Set SD_NUM_CARDS to 2 in sd.h to use it.
+ *
+ * The cards share the SPI bus, so only one transfers at a time. What is
+ * gained is the programming time: sd_stripe_write() opens a pre-erased
+ * ACMD23 + CMD25 burst on every card and sends the blocks in stripe
+ * order, waiting for a card's busy only right before its next block, so
+ * each card programs while the others are sent theirs. Reads come from
+ * one CMD18 burst per card.
+ *
+ * sd_stripe_init() runs sd_init() on every card. A card that loses its
+ * data loses every SD_NUM_CARDS'th stripe unit of the whole set, there
+ * is no redundancy. Both functions leave the card that was selected
+ * before selected again. Block numbers are in units of SD_BLOCK_LENGTH,
+ * ranges reaching past SD_MAX_BLOCKS on a card are refused. */
+
+#ifndef _SD_STRIPE_H
+#define _SD_STRIPE_H
+
+#include "sd.h"
+
+/* Stripe unit, in blocks */
+#define SD_STRIPE_BLOCKS	1
+
+int sd_stripe_init(void);
+int sd_stripe_write(uint32_t lba, const uint8_t *data, uint32_t nblocks);
+int sd_stripe_read(uint32_t lba, uint8_t *data, uint32_t nblocks);
+
+#endif
@@ -0,0 +1,150 @@
+/* Verify-after-write for the SD/SPI driver
+ *
+ * Vanya A. Sergeev - <vsergeev@gmail.com> - copyright 2010
+ * please inform author of possible use, licensing is still being decided
+ *
+ */
+
+#include "sd_verify.h"
+
+/* Remembered blocks and their CRC16, sorted by block number */
+static uint32_t sd_verify_lba[SD_VERIFY_BLOCKS];
+static uint16_t sd_verify_crc16[SD_VERIFY_BLOCKS];
+static uint32_t sd_verify_count;
+
+static void (*sd_verify_callback)(uint32_t lba, int error);
+
+void sd_verify_set_callback(void (*callback)(uint32_t lba, int error)) {
+	sd_verify_callback = callback;
+}
+
+static void sd_verify_report(uint32_t lba, int error) {
+	if (sd_verify_callback != 0)
+		sd_verify_callback(lba, error);
+}
+
+/* Index of the first remembered block at or after lba */
+static uint32_t sd_verify_find(uint32_t lba) {
+	uint32_t low, high, mid;
+
+	low = 0;
+	high = sd_verify_count;
+	while (low < high) {
+		mid = low + (high - low) / 2;
+		if (sd_verify_lba[mid] < lba)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	return low;
+}
+
+/* Non-zero if the byte address of a block in the range doesn't fit in
+ * 32 bits */
+static int sd_verify_outbounds(uint32_t lba, uint32_t nblocks) {
+	return lba >= SD_MAX_BLOCKS || nblocks > SD_MAX_BLOCKS - lba;
+}
+
+int sd_verify_add(uint32_t lba, const uint8_t *data, uint32_t nblocks) {
+	uint32_t i, j;
+
+	/* They couldn't be read back */
+	if (sd_verify_outbounds(lba, nblocks))
+		return SD_ERROR_READ_ADDR_OUTBOUNDS;
+
+	/* Verify what we have first if this might not fit. Doing it half way
+	 * through would check the older digests of blocks just written. */
+	if (sd_verify_count + nblocks > SD_VERIFY_BLOCKS)
+		sd_verify_run();
+
+	for (; nblocks > 0; nblocks--, lba++, data += SD_BLOCK_LENGTH) {
+		i = sd_verify_find(lba);
+
+		if (i == sd_verify_count || sd_verify_lba[i] != lba) {
+			/* A new block, verify what we have if the table is full
+			 * (only for adds larger than the table). Failures there
+			 * have gone to the callback already. */
+			if (sd_verify_count == SD_VERIFY_BLOCKS) {
+				sd_verify_run();
+				i = 0;
+			}
+
+			for (j = sd_verify_count; j > i; j--) {
+				sd_verify_lba[j] = sd_verify_lba[j-1];
+				sd_verify_crc16[j] = sd_verify_crc16[j-1];
+			}
+			sd_verify_lba[i] = lba;
+			sd_verify_count++;
+		}
+
+		sd_verify_crc16[i] = sd_crc16_data(data, SD_BLOCK_LENGTH);
+	}
+
+	return 0;
+}
+
+int sd_verify_write(uint32_t lba, const uint8_t *data, uint32_t nblocks) {
+	int retVal;
+
+	if (sd_verify_outbounds(lba, nblocks))
+		return SD_ERROR_WRITE_ADDR_OUTBOUNDS;
+
+	retVal = sd_write_blocks(lba*SD_BLOCK_LENGTH, data, nblocks*SD_BLOCK_LENGTH);
+	if (retVal < 0)
+		return retVal;
+
+	return sd_verify_add(lba, data, nblocks);
+}
+
+/* Reads all remembered blocks back and forgets them. Returns the number
+ * of blocks that failed, each of which has been passed to the callback. */
+int sd_verify_run(void) {
+	uint32_t i, j;
+	uint16_t crc16;
+	int failed, retVal;
+
+	failed = 0;
+	i = 0;
+	while (i < sd_verify_count) {
+		/* Last block of this run of consecutive ones */
+		for (j = i; j + 1 < sd_verify_count; j++) {
+			if (sd_verify_lba[j+1] != sd_verify_lba[j] + 1)
+				break;
+		}
+
+		retVal = sd_read_blocks_start(sd_verify_lba[i]*SD_BLOCK_LENGTH);
+		if (retVal < 0) {
+			sd_verify_report(sd_verify_lba[i], retVal);
+			failed++;
+			i++;
+			continue;
+		}
+
+		/* On a read error start over after the block */
+		for (; i <= j; i++) {
+			retVal = sd_read_blocks_next_crc16(&crc16);
+			if (retVal < 0) {
+				sd_verify_report(sd_verify_lba[i], retVal);
+				failed++;
+				i++;
+				break;
+			}
+			if (crc16 != sd_verify_crc16[i]) {
+				sd_verify_report(sd_verify_lba[i], SD_ERROR_VERIFY);
+				failed++;
+			}
+		}
+
+		if (sd_read_blocks_stop() == 0 && retVal == 0)
+			sd_stats_done(SD_STATS_CMD18);
+	}
+
+	sd_verify_count = 0;
+
+	return failed;
+}
+
+uint32_t sd_verify_pending(void) {
+	return sd_verify_count;
+}
@@ -0,0 +1,43 @@
+/* Verify-after-write for the SD/SPI driver
+ *
+ * Vanya A. Sergeev - <vsergeev@gmail.com> - copyright 2010
+ * please inform author of possible use, licensing is still being decided
+ *
+ */
+
+/* sd_verify checks that written blocks really made it onto the card
+ * without keeping a copy of them or reading them back into a buffer.
+ * sd_verify_write() writes blocks with sd_write_blocks() and remembers
+ * only the CRC16 of each, sd_verify_add() does the same for blocks
+ * written some other way. sd_verify_run() later reads the remembered
+ * blocks back and compares.
+ *
+ * The readback streams: blocks are visited in address order, every run
+ * of consecutive ones comes from a single CMD18 burst however many writes
+ * it took to put them there, and sd_read_blocks_next_crc16() only hands
+ * over the CRC16 of each block. The card sends a CRC16 with every data
+ * block whether CRC checking is on or not, so with it off the comparison
+ * costs nothing beyond the transfer itself.
+ *
+ * Every block that doesn't match, or can't be read, is reported to the
+ * callback set with sd_verify_set_callback() with SD_ERROR_VERIFY or the
+ * read error. Up to SD_VERIFY_BLOCKS blocks are remembered, a full table
+ * is verified before more are added. Writing a block again replaces its
+ * digest. Block numbers are in units of SD_BLOCK_LENGTH, ranges reaching
+ * past SD_MAX_BLOCKS are refused. */
+
+#ifndef _SD_VERIFY_H
+#define _SD_VERIFY_H
+
+#include "sd.h"
+
+/* Blocks remembered for verification */
+#define SD_VERIFY_BLOCKS	128
+
+void sd_verify_set_callback(void (*callback)(uint32_t lba, int error));
+int sd_verify_add(uint32_t lba, const uint8_t *data, uint32_t nblocks);
+int sd_verify_write(uint32_t lba, const uint8_t *data, uint32_t nblocks);
+int sd_verify_run(void);
+uint32_t sd_verify_pending(void);
+
+#endif
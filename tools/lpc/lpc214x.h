@@ -0,0 +1,13 @@
+/* Stand-in for lpc214x.h on a PC, see ../sd_spi_sim.h
+ *
+ * Vanya A. Sergeev - <vsergeev@gmail.com> - copyright 2010
+ * please inform author of possible use, licensing is still being decided
+ *
+ */
+
+#ifndef _LPC214X_H
+#define _LPC214X_H
+
+#include "../sd_spi_sim.h"
+
+#endif
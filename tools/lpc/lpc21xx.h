@@ -0,0 +1,13 @@
+/* Stand-in for lpc21xx.h on a PC, see ../sd_spi_sim.h
+ *
+ * Vanya A. Sergeev - <vsergeev@gmail.com> - copyright 2010
+ * please inform author of possible use, licensing is still being decided
+ *
+ */
+
+#ifndef _LPC21XX_H
+#define _LPC21XX_H
+
+#include "../sd_spi_sim.h"
+
+#endif
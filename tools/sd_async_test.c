@@ -0,0 +1,213 @@
+/* Ordering and completion tests of sd_async against the card model
+ *
+ * Vanya A. Sergeev - <vsergeev@gmail.com> - copyright 2010
+ * please inform author of possible use, licensing is still being decided
+ *
+ * Builds on a PC with:
+ *	cc -O2 -I.. -DSD_SPI_BUS=SD_SPI_BUS_PORT -o sd_async_test sd_async_test.c sd_card_sim.c ../sd_async.c ../sd.c
+ *
+ * Usage: sd_async_test
+ *
+ * Prints one line per check and exits non-zero if any failed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sd_card_sim.h"
+#include "sd_async.h"
+
+#define CARD_BLOCKS	16384
+#define MAX_COMPLETIONS	16
+
+typedef struct {
+	uint8_t op;
+	uint32_t lba;
+	int result;
+	/* The card was still busy when the callback fired */
+	int busy;
+} Completion;
+
+static Completion completions[MAX_COMPLETIONS];
+static int num_completions;
+static int failures;
+
+static uint8_t buffers[8][4 * SD_BLOCK_LENGTH];
+
+static void completed(uint8_t op, uint32_t lba, uint8_t *buf, int result) {
+	Completion *c;
+
+	if (num_completions == MAX_COMPLETIONS)
+		return;
+	c = &completions[num_completions++];
+	c->op = op;
+	c->lba = lba;
+	c->result = result;
+	c->busy = (sd_sim_card.time_ps < sd_sim_card.busy_ps);
+}
+
+static void check(const char *what, int ok) {
+	printf("%-60s %s\n", what, ok ? "ok" : "FAIL");
+	if (!ok)
+		failures++;
+}
+
+static void fill(uint8_t *buf, int nblocks, int seed) {
+	int i;
+
+	for (i = 0; i < nblocks * SD_BLOCK_LENGTH; i++)
+		buf[i] = i * 7 + seed;
+}
+
+static int card_matches(uint32_t lba, const uint8_t *buf, int nblocks) {
+	return memcmp(sd_sim_card.data + lba * SD_BLOCK_LENGTH, buf, nblocks * SD_BLOCK_LENGTH) == 0;
+}
+
+static void reset(void) {
+	num_completions = 0;
+	memset(completions, 0, sizeof(completions));
+	sd_sim_clear_counters();
+}
+
+/* Reads overtake older writes to other blocks, contiguous requests of the
+ * same kind merge, and a read of blocks being written waits for the write */
+static void test_ordering(void) {
+	static const uint32_t order[] = { 300, 301, 100, 100, 200 };
+	int i, ok;
+
+	reset();
+	fill(buffers[0], 4, 1);
+	fill(buffers[1], 2, 2);
+	memset(buffers[3], 0, sizeof(buffers[3]));
+	sd_submit(SD_ASYNC_WRITE, 100, buffers[0], 4, completed);
+	sd_submit(SD_ASYNC_WRITE, 200, buffers[1], 2, completed);
+	sd_submit(SD_ASYNC_READ, 300, buffers[2], 1, completed);
+	sd_submit(SD_ASYNC_READ, 100, buffers[3], 1, completed);
+	sd_submit(SD_ASYNC_READ, 301, buffers[2] + SD_BLOCK_LENGTH, 1, completed);
+	sd_async_flush();
+
+	ok = (num_completions == 5);
+	for (i = 0; ok && i < 5; i++)
+		ok = (completions[i].lba == order[i] && completions[i].result == 0);
+	check("reads first, read after write to the same block waits", ok);
+	check("read returns the data of the older write", memcmp(buffers[3], buffers[0], SD_BLOCK_LENGTH) == 0);
+	check("contiguous reads merged into one CMD18", sd_sim_card.commands[18] == 2);
+	check("writes carried out with one CMD25 each", sd_sim_card.commands[25] == 2);
+	check("written blocks on the card", card_matches(100, buffers[0], 4) && card_matches(200, buffers[1], 2));
+}
+
+/* Contiguous writes share one CMD25, complete once each and in order, and
+ * the last one only after the card is done with the stop */
+static void test_merged_writes(void) {
+	int ok;
+
+	reset();
+	fill(buffers[4], 1, 3);
+	fill(buffers[5], 1, 4);
+	fill(buffers[6], 2, 5);
+	sd_submit(SD_ASYNC_WRITE, 1000, buffers[4], 1, completed);
+	sd_submit(SD_ASYNC_WRITE, 1002, buffers[6], 2, completed);
+	sd_submit(SD_ASYNC_WRITE, 1001, buffers[5], 1, completed);
+	sd_async_flush();
+
+	ok = (num_completions == 3 && completions[0].lba == 1000 &&
+	      completions[1].lba == 1001 && completions[2].lba == 1002);
+	check("contiguous writes complete once each, in block order", ok);
+	check("contiguous writes merged into one CMD25", sd_sim_card.commands[25] == 1);
+	check("last write completes after the stop busy", num_completions == 3 && !completions[2].busy);
+	check("merged blocks on the card", card_matches(1000, buffers[4], 1) &&
+		card_matches(1001, buffers[5], 1) && card_matches(1002, buffers[6], 2));
+}
+
+/* A block that doesn't finish programming in SD_WRITE_TIMEOUT_MS fails its
+ * request, the transfer is stopped and the card is usable afterwards */
+static void test_write_timeout(void) {
+	uint32_t write_ns, erased_write_ns;
+
+	reset();
+	write_ns = sd_sim_card.write_ns;
+	sd_sim_card.write_ns = (SD_WRITE_TIMEOUT_MS + 100) * 1000000;
+	fill(buffers[7], 1, 6);
+	sd_submit(SD_ASYNC_WRITE, 2000, buffers[7], 1, completed);
+	sd_async_flush();
+	sd_sim_card.write_ns = write_ns;
+
+	check("programming timeout reported", num_completions == 1 &&
+		completions[0].result == SD_ERROR_WRITE_TIMEOUT);
+	check("transfer stopped after a programming timeout", sd_busy_wait(SD_WRITE_TIMEOUT_MS) == 0 &&
+		sd_read_block(2000 * SD_BLOCK_LENGTH, buffers[0]) == 0);
+
+	/* The rest of a run is retried on its own */
+	reset();
+	/* The run goes out pre-erased, which the card programs at the
+	 * erased block speed */
+	erased_write_ns = sd_sim_card.erased_write_ns;
+	sd_sim_card.erased_write_ns = (SD_WRITE_TIMEOUT_MS + 100) * 1000000;
+	sd_submit(SD_ASYNC_WRITE, 2010, buffers[7], 1, completed);
+	sd_submit(SD_ASYNC_WRITE, 2011, buffers[6], 1, completed);
+	while (sd_async_poll() > 0 && num_completions == 0)
+		;
+	sd_sim_card.erased_write_ns = erased_write_ns;
+	sd_async_flush();
+
+	check("rest of the run retried after a timeout", num_completions == 2 &&
+		completions[0].result == SD_ERROR_WRITE_TIMEOUT && completions[1].result == 0 &&
+		card_matches(2011, buffers[6], 1));
+}
+
+/* A stop the card doesn't finish in time fails the last request of an
+ * otherwise successful transfer */
+static void test_stop_timeout(void) {
+	uint32_t stop_ns;
+
+	reset();
+	stop_ns = sd_sim_card.stop_ns;
+	sd_sim_card.stop_ns = (SD_WRITE_TIMEOUT_MS + 100) * 1000000;
+	sd_submit(SD_ASYNC_WRITE, 3000, buffers[4], 1, completed);
+	sd_submit(SD_ASYNC_WRITE, 3001, buffers[5], 1, completed);
+	sd_async_flush();
+	sd_sim_card.stop_ns = stop_ns;
+
+	check("stop timeout reported to the last request", num_completions == 2 &&
+		completions[0].result == 0 && completions[1].result == SD_ERROR_WRITE_TIMEOUT);
+	sd_busy_wait(SD_WRITE_TIMEOUT_MS);
+}
+
+/* Requests whose byte addresses don't fit in 32 bits are refused up front
+ * instead of wrapping to the start of the card */
+static void test_range(void) {
+	int write, read;
+
+	reset();
+	write = sd_submit(SD_ASYNC_WRITE, SD_MAX_BLOCKS - 1, buffers[0], 2, completed);
+	read = sd_submit(SD_ASYNC_READ, SD_MAX_BLOCKS, buffers[0], 1, completed);
+	sd_async_flush();
+
+	check("requests past SD_MAX_BLOCKS refused", write == SD_ERROR_WRITE_ADDR_OUTBOUNDS &&
+		read == SD_ERROR_READ_ADDR_OUTBOUNDS && num_completions == 0 &&
+		sd_sim_card.commands[24] + sd_sim_card.commands[25] + sd_sim_card.commands[17] == 0);
+}
+
+int main(void) {
+	uint8_t *data;
+	int retVal;
+
+	data = calloc(CARD_BLOCKS, SD_BLOCK_LENGTH);
+	if (data == 0)
+		return 1;
+	sd_sim_init(data, CARD_BLOCKS, 1);
+
+	retVal = sd_init();
+	check("sd_init", retVal == 0);
+	if (retVal < 0)
+		return 1;
+
+	test_ordering();
+	test_merged_writes();
+	test_write_timeout();
+	test_stop_timeout();
+	test_range();
+	check("queue empty", sd_async_pending() == 0);
+
+	return (failures == 0) ? 0 : 1;
+}
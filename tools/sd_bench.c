@@ -0,0 +1,297 @@
+/* Throughput benchmark of the SD/SPI driver against the card model
+ *
+ * Vanya A. Sergeev - <vsergeev@gmail.com> - copyright 2010
+ * please inform author of possible use, licensing is still being decided
+ *
+ * Builds on a PC with:
+ *	cc -O2 -I.. -DSD_SPI_BUS=SD_SPI_BUS_PORT -o sd_bench sd_bench.c sd_card_sim.c ../sd_gather.c ../sd.c
+ *
+ * Usage: sd_bench [-s] [card image]
+ *
+ * Runs read and write patterns through the driver and prints, for each,
+ * the commands issued, the chip select changes, the bytes clocked on the
+ * bus, the modeled time (see sd_card_sim.h) and the throughput that time
+ * gives. Nothing here depends on the speed of the PC, so the numbers can
+ * be compared before and after a driver change, except for the CPU time
+ * of the CRC on and off and the CRC16 pass runs at the end. The gather
+ * runs compare sd_gather's ACMD23 + CMD25 bursts with a CMD24 per block
+ * by the time the card spends busy programming. The sd_resume rows
+ * follow the cold sd_init one: a warm restart of the same card, and one
+ * where the CID differs and it falls back to sd_init(). -s models an
+ * SDSC card instead of SDHC.
+ * Without an image the card is a 64MB RAM buffer; an image is modified.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "sd_card_sim.h"
+#include "sd.h"
+#include "sd_gather.h"
+
+/* Blocks moved by each pattern, and per sd_read_blocks()/sd_write_blocks() */
+#define BENCH_BLOCKS		2048
+#define BENCH_BURST		64
+#define BENCH_CARD_BLOCKS	131072
+
+static uint8_t buffer[BENCH_BURST * SD_BLOCK_LENGTH];
+/* Keeps the compiler from dropping the timed CRCs */
+static volatile uint16_t sink;
+static uint32_t random_state = 1;
+
+static uint32_t bench_random(uint32_t range) {
+	random_state = random_state * 1103515245 + 12345;
+	return (random_state >> 8) % range;
+}
+
+/* Prints the counters since the last sd_sim_clear_counters(), the
+ * throughput for blocks moved in that time if there were any */
+static void bench_report(const char *name, int retVal, int blocks) {
+	uint32_t commands;
+	uint64_t ns;
+	int i;
+
+	commands = 0;
+	for (i = 0; i < 64; i++)
+		commands += sd_sim_card.commands[i] + sd_sim_card.app_commands[i];
+	ns = sd_sim_time_ns();
+
+	printf("%-28s %8u %8u %10llu %10.2f", name, commands, sd_sim_card.cs_toggles,
+		(unsigned long long)sd_sim_card.bus_bytes, ns / 1e6);
+	if (blocks > 0 && ns != 0)
+		printf(" %8.0f", (blocks * (double)SD_BLOCK_LENGTH / 1024.0) / (ns / 1e9));
+	if (retVal < 0)
+		printf("  error %d", retVal);
+	printf("\n");
+}
+
+/* Runs one pattern: single block or BENCH_BURST block transfers,
+ * sequential from the middle of the card or at random block addresses */
+static int bench_pattern(int write, int burst, int sequential) {
+	uint32_t lba, start;
+	int i, n, retVal;
+
+	n = burst ? BENCH_BURST : 1;
+	start = sd_sim_card.blocks / 2;
+	retVal = 0;
+
+	sd_sim_clear_counters();
+	for (i = 0; i < BENCH_BLOCKS && retVal >= 0; i += n) {
+		if (sequential)
+			lba = start + i;
+		else
+			lba = bench_random(sd_sim_card.blocks / n) * n;
+
+		if (write && burst)
+			retVal = sd_write_blocks(lba * SD_BLOCK_LENGTH, buffer, n * SD_BLOCK_LENGTH);
+		else if (write)
+			retVal = sd_write_block(lba * SD_BLOCK_LENGTH, buffer);
+		else if (burst)
+			retVal = sd_read_blocks(lba * SD_BLOCK_LENGTH, buffer, n * SD_BLOCK_LENGTH);
+		else
+			retVal = sd_read_block(lba * SD_BLOCK_LENGTH, buffer);
+	}
+
+	return retVal;
+}
+
+/* Sequential single block writes over blocks holding data, each sent
+ * as a CMD24 or gathered into sd_gather bursts. The card programs
+ * pre-erased blocks of a burst faster (see sd_card_sim.h). */
+static void bench_gather(void) {
+	static const char *names[2] = { "write, CMD24 per block", "write, gathered" };
+	uint32_t start, commands;
+	int gathered, i, retVal;
+
+	printf("\n%-28s %8s %10s %10s %8s\n", "gather", "commands", "busy ms", "time ms", "KB/s");
+	start = sd_sim_card.blocks / 4;
+	for (gathered = 0; gathered < 2; gathered++) {
+		sd_sim_clear_counters();
+		retVal = 0;
+		for (i = 0; i < BENCH_BLOCKS && retVal >= 0; i++) {
+			if (gathered)
+				retVal = sd_gather_write_block((start + i) * SD_BLOCK_LENGTH, buffer);
+			else
+				retVal = sd_write_block((start + i) * SD_BLOCK_LENGTH, buffer);
+		}
+		if (retVal >= 0)
+			retVal = sd_gather_flush();
+
+		commands = 0;
+		for (i = 0; i < 64; i++)
+			commands += sd_sim_card.commands[i] + sd_sim_card.app_commands[i];
+		printf("%-28s %8u %10.2f %10.2f %8.0f", names[gathered], commands, sd_sim_card.busy_ns / 1e6,
+			sd_sim_time_ns() / 1e6, (BENCH_BLOCKS * (double)SD_BLOCK_LENGTH / 1024.0) / (sd_sim_time_ns() / 1e9));
+		if (retVal < 0)
+			printf("  error %d", retVal);
+		printf("\n");
+	}
+}
+
+/* Sequential multiple block reads and writes with CRC checking on and
+ * off. The CRC bytes are clocked either way, so the modeled time is the
+ * same; what off saves is the CRC16 work, which shows in the CPU time
+ * the driver (and the model) took on this PC. The model's own work per
+ * byte is most of that CPU time, so expect a small difference. */
+static void bench_crc(void) {
+	static const char *names[2][2] = {
+		{ "read, CRC off", "write, CRC off" },
+		{ "read, CRC on", "write, CRC on" },
+	};
+	clock_t start;
+	double cpu[2][2];
+	int crc, write, retVal, i;
+
+	printf("\n%-28s %8s %8s %10s %10s %8s\n", "CRC", "commands", "CS", "bus bytes", "time ms", "KB/s");
+	for (crc = 1; crc >= 0; crc--) {
+		retVal = sd_set_crc(crc);
+		for (write = 0; write < 2; write++) {
+			/* Best of a few runs, the PC isn't idle */
+			cpu[crc][write] = 0;
+			for (i = 0; i < 20 && retVal >= 0; i++) {
+				start = clock();
+				retVal = bench_pattern(write, 1, 1);
+				if (i == 0 || (double)(clock() - start) < cpu[crc][write])
+					cpu[crc][write] = clock() - start;
+			}
+			cpu[crc][write] *= 1000.0 / CLOCKS_PER_SEC;
+			bench_report(names[crc][write], retVal, BENCH_BLOCKS);
+		}
+	}
+	sd_set_crc(1);
+
+	for (write = 0; write < 2; write++) {
+		printf("%-28s %.2f ms CPU with CRC on, %.2f ms off\n",
+			write ? "write" : "read", cpu[1][write], cpu[0][write]);
+	}
+}
+
+/* The data block CRC16 computed in the transfer loop, as the driver does
+ * it, against a separate pass over the block after (receive) or before
+ * (send) the transfer. The card is deselected, so only the bus time and
+ * the work per byte count. The port backend exchanges bytes one at a
+ * time, so the fused loop can't overlap the shift like it does on SPI0
+ * and the SSP; what shows here is the second pass it saves. */
+static void bench_fused(void) {
+	static const char *names[2][2] = {
+		{ "receive, separate pass", "receive, fused" },
+		{ "send, separate pass", "send, fused" },
+	};
+	clock_t start, best;
+	int send, fused, i, j;
+
+	printf("\n%-28s %10s %10s %12s\n", "CRC16 pass", "bus bytes", "time ms", "CPU ns/block");
+	sd_port_deselect();
+	for (send = 0; send < 2; send++) {
+		for (fused = 0; fused < 2; fused++) {
+			/* Best of a few runs, the PC isn't idle */
+			best = 0;
+			for (j = 0; j < 20; j++) {
+				sd_sim_clear_counters();
+				start = clock();
+				for (i = 0; i < BENCH_BLOCKS; i++) {
+					if (send && fused) {
+						sink = sd_spi_send_block_crc16(0, buffer, SD_BLOCK_LENGTH);
+					} else if (send) {
+						sink = sd_crc16_data(buffer, SD_BLOCK_LENGTH);
+						sd_spi_send_block(buffer, SD_BLOCK_LENGTH);
+					} else if (fused) {
+						sink = sd_spi_receive_block_crc16(0, buffer, SD_BLOCK_LENGTH);
+					} else {
+						sd_spi_receive_block(buffer, SD_BLOCK_LENGTH);
+						sink = sd_crc16_data(buffer, SD_BLOCK_LENGTH);
+					}
+				}
+				if (j == 0 || clock() - start < best)
+					best = clock() - start;
+			}
+			printf("%-28s %10llu %10.2f %12.0f\n", names[send][fused],
+				(unsigned long long)sd_sim_card.bus_bytes, sd_sim_time_ns() / 1e6,
+				(double)best * 1e9 / CLOCKS_PER_SEC / BENCH_BLOCKS);
+		}
+	}
+}
+
+int main(int argc, char *argv[]) {
+	uint8_t *data;
+	uint32_t blocks;
+	int high_capacity, retVal, i;
+	char *image;
+
+	high_capacity = 1;
+	image = 0;
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-s") == 0)
+			high_capacity = 0;
+		else
+			image = argv[i];
+	}
+
+	if (image != 0) {
+		data = sd_sim_load(image, &blocks);
+		if (data == 0) {
+			fprintf(stderr, "Error reading %s\n", image);
+			return 1;
+		}
+	} else {
+		blocks = BENCH_CARD_BLOCKS;
+		data = malloc(blocks * SD_BLOCK_LENGTH);
+		if (data == 0)
+			return 1;
+		memset(data, 0, blocks * SD_BLOCK_LENGTH);
+	}
+	if (blocks < 4 * BENCH_BLOCKS) {
+		fprintf(stderr, "Card image too small, need %d blocks\n", 4 * BENCH_BLOCKS);
+		return 1;
+	}
+
+	sd_sim_init(data, blocks, high_capacity);
+	for (i = 0; i < (int)sizeof(buffer); i++)
+		buffer[i] = i * 7 + 3;
+
+	printf("%-28s %8s %8s %10s %10s %8s\n", "pattern", "commands", "CS", "bus bytes", "time ms", "KB/s");
+
+	sd_sim_clear_counters();
+	retVal = sd_init();
+	bench_report("sd_init", retVal, 0);
+	if (retVal < 0)
+		return 1;
+
+	/* Warm restart of the card sd_init() just set up, then of one that
+	 * answers with another CID and has to be set up again */
+	sd_sim_clear_counters();
+	bench_report("sd_resume, same card", sd_resume(), 0);
+	sd_sim_set_serial(0x87654321);
+	sd_sim_clear_counters();
+	bench_report("sd_resume, CID changed", sd_resume(), 0);
+
+	printf("SPI clock %u Hz, %u blocks, %s\n\n", sd_get_speed(), blocks,
+		high_capacity ? "SDHC" : "SDSC");
+
+	bench_report("read, single, sequential", bench_pattern(0, 0, 1), BENCH_BLOCKS);
+	bench_report("read, single, random", bench_pattern(0, 0, 0), BENCH_BLOCKS);
+	bench_report("read, multiple, sequential", bench_pattern(0, 1, 1), BENCH_BLOCKS);
+	bench_report("read, multiple, random", bench_pattern(0, 1, 0), BENCH_BLOCKS);
+	bench_report("write, single, sequential", bench_pattern(1, 0, 1), BENCH_BLOCKS);
+	bench_report("write, single, random", bench_pattern(1, 0, 0), BENCH_BLOCKS);
+	bench_report("write, multiple, sequential", bench_pattern(1, 1, 1), BENCH_BLOCKS);
+	bench_report("write, multiple, random", bench_pattern(1, 1, 0), BENCH_BLOCKS);
+
+	/* Same sequential writes into blocks erased beforehand */
+	retVal = sd_erase_blocks((blocks / 2) * SD_BLOCK_LENGTH, (blocks / 2 + BENCH_BLOCKS - 1) * SD_BLOCK_LENGTH);
+	if (retVal >= 0)
+		retVal = bench_pattern(1, 1, 1);
+	bench_report("write, multiple, erased", retVal, BENCH_BLOCKS);
+
+	bench_gather();
+	bench_crc();
+	bench_fused();
+
+	if (image != 0 && sd_sim_save(image) < 0) {
+		fprintf(stderr, "Error writing %s\n", image);
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,219 @@
+/* Trace replay benchmark of sd_cache against the card model
+ *
+ * Vanya A. Sergeev - <vsergeev@gmail.com> - copyright 2010
+ * please inform author of possible use, licensing is still being decided
+ *
+ * Builds on a PC with:
+ *	cc -O2 -I.. -DSD_SPI_BUS=SD_SPI_BUS_PORT -o sd_cache_trace sd_cache_trace.c sd_card_sim.c ../sd_cache.c ../sd.c
+ * Add -DSD_CACHE_LINES=<n> to try other cache sizes.
+ *
+ * Usage: sd_cache_trace [trace file]
+ *
+ * A trace has one block access per line, "r <block>" or "w <block>",
+ * lines starting with # are skipped. Without a file the trace is built
+ * in: a file appended a block at a time with its FAT sector and
+ * directory entry updated as it grows, the way sd_fat does it, with
+ * another file read now and then.
+ *
+ * The trace is replayed twice on fresh cards, once straight through
+ * sd_read_block()/sd_write_block() and once through the cache followed
+ * by sd_cache_flush(). Prints the cache statistics, the hit ratio, the
+ * bytes clocked on the bus and the modeled time (see sd_card_sim.h) of
+ * both runs, and exits non-zero if the two cards don't end up the same.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sd_card_sim.h"
+#include "sd_cache.h"
+
+#define CARD_BLOCKS		65536
+
+/* Layout of the built in trace */
+#define TRACE_FAT		1
+#define TRACE_DIR		500
+#define TRACE_DATA		1000
+#define TRACE_OTHER		40000
+#define TRACE_APPENDS		4096
+#define TRACE_CLUSTER		4
+
+typedef struct _Trace_Access {
+	uint32_t block;
+	int write;
+} Trace_Access;
+
+static Trace_Access *trace;
+static int trace_len, trace_size;
+static uint8_t buffer[SD_BLOCK_LENGTH];
+
+static int trace_add(uint32_t block, int write) {
+	Trace_Access *grown;
+
+	if (block >= CARD_BLOCKS) {
+		fprintf(stderr, "Block %u past the %u block card\n", block, CARD_BLOCKS);
+		return -1;
+	}
+	if (trace_len == trace_size) {
+		trace_size = (trace_size == 0) ? 1024 : trace_size * 2;
+		grown = realloc(trace, trace_size * sizeof(Trace_Access));
+		if (grown == 0)
+			return -1;
+		trace = grown;
+	}
+	trace[trace_len].block = block;
+	trace[trace_len].write = write;
+	trace_len++;
+
+	return 0;
+}
+
+static int trace_load(const char *path) {
+	FILE *fp;
+	char line[128], op;
+	unsigned long block;
+	int retVal;
+
+	fp = fopen(path, "r");
+	if (fp == 0)
+		return -1;
+
+	retVal = 0;
+	while (retVal == 0 && fgets(line, sizeof(line), fp) != 0) {
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+		if (sscanf(line, " %c %lu", &op, &block) != 2 || (op != 'r' && op != 'w')) {
+			fprintf(stderr, "Bad trace line: %s", line);
+			retVal = -1;
+		} else {
+			retVal = trace_add(block, op == 'w');
+		}
+	}
+	fclose(fp);
+
+	return retVal;
+}
+
+static int trace_build(void) {
+	uint32_t i, j;
+	int retVal;
+
+	retVal = 0;
+	for (i = 0; i < TRACE_APPENDS && retVal == 0; i++) {
+		/* New cluster: chain it in the FAT */
+		if ((i % TRACE_CLUSTER) == 0) {
+			retVal |= trace_add(TRACE_FAT + (i / TRACE_CLUSTER) / (SD_BLOCK_LENGTH / 2), 0);
+			retVal |= trace_add(TRACE_FAT + (i / TRACE_CLUSTER) / (SD_BLOCK_LENGTH / 2), 1);
+		}
+		retVal |= trace_add(TRACE_DATA + i, 1);
+		/* File size in the directory entry */
+		if ((i % 16) == 15) {
+			retVal |= trace_add(TRACE_DIR, 0);
+			retVal |= trace_add(TRACE_DIR, 1);
+		}
+		/* Another file opened and read */
+		if ((i % 256) == 128) {
+			retVal |= trace_add(TRACE_DIR, 0);
+			retVal |= trace_add(TRACE_FAT + 100, 0);
+			for (j = 0; j < 8; j++)
+				retVal |= trace_add(TRACE_OTHER + (i / 256) * 8 + j, 0);
+		}
+	}
+
+	return retVal;
+}
+
+/* Replays the trace on a fresh card, returns 0 on success */
+static int replay(uint8_t *data, int cached) {
+	int i, retVal;
+
+	memset(data, 0, CARD_BLOCKS * SD_BLOCK_LENGTH);
+	sd_sim_init(data, CARD_BLOCKS, 1);
+	retVal = sd_init();
+	if (retVal < 0)
+		return retVal;
+	sd_cache_invalidate();
+	sd_cache_clear_stats();
+	sd_sim_clear_counters();
+
+	for (i = 0; i < trace_len; i++) {
+		if (trace[i].write) {
+			/* Contents tell the writes apart, so a lost one shows */
+			memset(buffer, i & 0xFF, sizeof(buffer));
+			memcpy(buffer, &i, sizeof(i));
+			if (cached)
+				retVal = sd_cache_write_block(trace[i].block * SD_BLOCK_LENGTH, buffer);
+			else
+				retVal = sd_write_block(trace[i].block * SD_BLOCK_LENGTH, buffer);
+		} else {
+			if (cached)
+				retVal = sd_cache_read_block(trace[i].block * SD_BLOCK_LENGTH, buffer);
+			else
+				retVal = sd_read_block(trace[i].block * SD_BLOCK_LENGTH, buffer);
+		}
+		if (retVal < 0)
+			return retVal;
+	}
+	if (cached)
+		return sd_cache_flush();
+
+	return 0;
+}
+
+int main(int argc, char *argv[]) {
+	uint8_t *direct, *cached;
+	uint64_t direct_bytes, direct_ns;
+	uint32_t accesses;
+	int retVal;
+
+	if (argc > 2) {
+		fprintf(stderr, "Usage: %s [trace file]\n", argv[0]);
+		return 1;
+	}
+	if (argc == 2) {
+		if (trace_load(argv[1]) < 0) {
+			fprintf(stderr, "Error reading %s\n", argv[1]);
+			return 1;
+		}
+	} else if (trace_build() < 0) {
+		return 1;
+	}
+
+	direct = malloc(CARD_BLOCKS * SD_BLOCK_LENGTH);
+	cached = malloc(CARD_BLOCKS * SD_BLOCK_LENGTH);
+	if (direct == 0 || cached == 0)
+		return 1;
+
+	retVal = replay(direct, 0);
+	if (retVal < 0) {
+		fprintf(stderr, "Direct replay failed: %d\n", retVal);
+		return 1;
+	}
+	direct_bytes = sd_sim_card.bus_bytes;
+	direct_ns = sd_sim_time_ns();
+
+	retVal = replay(cached, 1);
+	if (retVal < 0) {
+		fprintf(stderr, "Cached replay failed: %d\n", retVal);
+		return 1;
+	}
+
+	accesses = sd_cache_stats.hits + sd_cache_stats.misses;
+	printf("%d accesses, %d cache lines\n", trace_len, SD_CACHE_LINES);
+	printf("hits %u, misses %u, writebacks %u, hit ratio %.1f%%, block bytes saved %u\n\n",
+		sd_cache_stats.hits, sd_cache_stats.misses, sd_cache_stats.writebacks,
+		(accesses > 0) ? 100.0 * sd_cache_stats.hits / accesses : 0.0, sd_cache_stats.bytes_saved);
+
+	printf("%-12s %12s %10s\n", "replay", "bus bytes", "time ms");
+	printf("%-12s %12llu %10.2f\n", "direct", (unsigned long long)direct_bytes, direct_ns / 1e6);
+	printf("%-12s %12llu %10.2f\n", "cached", (unsigned long long)sd_sim_card.bus_bytes, sd_sim_time_ns() / 1e6);
+	printf("SPI bytes saved %lld (%.1f%%)\n", (long long)direct_bytes - (long long)sd_sim_card.bus_bytes,
+		100.0 * ((double)direct_bytes - sd_sim_card.bus_bytes) / direct_bytes);
+
+	if (memcmp(direct, cached, CARD_BLOCKS * SD_BLOCK_LENGTH) != 0) {
+		printf("Card contents differ between the replays\n");
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,594 @@
+/* Software SD card behind the SD_SPI_BUS_PORT backend, for host tests
+ *
+ * Vanya A. Sergeev - <vsergeev@gmail.com> - copyright 2010
+ * please inform author of possible use, licensing is still being decided
+ *
+ * See sd_card_sim.h.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sd_card_sim.h"
+#include "sd.h"
+
+SD_Sim_Card sd_sim_cards[SD_SIM_CARDS];
+SD_Sim_Card *sd_sim_current = &sd_sim_cards[0];
+
+/* Protocol states */
+enum {
+	SD_SIM_COMMAND,
+	SD_SIM_READ,
+	SD_SIM_WRITE_TOKEN,
+	SD_SIM_WRITE_DATA,
+};
+
+/* R1 bits */
+#define SD_SIM_R1_IDLE		0x01
+#define SD_SIM_R1_ILLEGAL	0x04
+#define SD_SIM_R1_COM_CRC	0x08
+#define SD_SIM_R1_ERASE_SEQ	0x10
+#define SD_SIM_R1_ADDRESS	0x20
+#define SD_SIM_R1_PARAMETER	0x40
+
+/* Data response tokens */
+#define SD_SIM_DATA_ACCEPTED	0x05
+#define SD_SIM_DATA_CRC		0x0B
+#define SD_SIM_DATA_WRITE_ERROR	0x0D
+
+static uint8_t sd_sim_crc7(const uint8_t *data, int len) {
+	uint8_t crc = 0, byte;
+	int i, j;
+
+	for (i = 0; i < len; i++) {
+		byte = data[i];
+		for (j = 0; j < 8; j++) {
+			crc <<= 1;
+			if ((byte ^ crc) & 0x80)
+				crc ^= 0x09;
+			byte <<= 1;
+		}
+	}
+
+	return crc & 0x7F;
+}
+
+static uint16_t sd_sim_crc16(const uint8_t *data, int len) {
+	uint16_t crc = 0;
+	int i, j;
+
+	for (i = 0; i < len; i++) {
+		crc ^= data[i] << 8;
+		for (j = 0; j < 8; j++)
+			crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+	}
+
+	return crc;
+}
+
+static void sd_sim_push(uint8_t byte) {
+	sd_sim_card.out[sd_sim_card.out_len++] = byte;
+}
+
+/* Queues a data block: start token, data and CRC16 */
+static void sd_sim_push_block(const uint8_t *data, int len) {
+	uint16_t crc;
+	int i;
+
+	crc = sd_sim_crc16(data, len);
+	if (sd_sim_card.corrupt_reads > 0) {
+		sd_sim_card.corrupt_reads--;
+		crc ^= 1;
+	}
+
+	sd_sim_push(0xFE);
+	for (i = 0; i < len; i++)
+		sd_sim_push(data[i]);
+	sd_sim_push(crc >> 8);
+	sd_sim_push(crc & 0xFF);
+}
+
+/* Holds DO low for ns from now */
+static void sd_sim_busy(uint64_t ns) {
+	sd_sim_card.busy_ps = sd_sim_card.time_ps + ns * 1000ULL;
+	sd_sim_card.busy_ns += ns;
+}
+
+/* Converts a command argument to a block number, -1 if it is not one */
+static int64_t sd_sim_block(uint32_t argument) {
+	if (!sd_sim_card.high_capacity) {
+		if (argument % SD_SIM_BLOCK_LENGTH != 0)
+			return -1;
+		argument /= SD_SIM_BLOCK_LENGTH;
+	}
+	if (argument >= sd_sim_card.blocks)
+		return -1;
+
+	return argument;
+}
+
+static void sd_sim_command(void) {
+	SD_Sim_Card *card = &sd_sim_card;
+	uint8_t command, r1;
+	uint32_t argument, n;
+	int64_t block;
+	int app;
+
+	command = card->frame[0] & 0x3F;
+	argument = ((uint32_t)card->frame[1] << 24) | (card->frame[2] << 16) | (card->frame[3] << 8) | card->frame[4];
+	app = card->app;
+	card->app = 0;
+
+	/* Whatever was still queued, e.g. a block of a CMD18, is dropped */
+	card->out_head = card->out_len = 0;
+	/* Ncr */
+	sd_sim_push(0xFF);
+
+	/* CMD0 and CMD8 are always checked */
+	if ((card->crc || command == 0 || command == 8) &&
+	    ((sd_sim_crc7(card->frame, 5) << 1) | 1) != card->frame[5]) {
+		card->crc_errors++;
+		sd_sim_push(SD_SIM_R1_COM_CRC | card->idle);
+		return;
+	}
+
+	r1 = card->idle;
+
+	if (app) {
+		card->app_commands[command]++;
+		switch (command) {
+			case 13:
+				sd_sim_push(r1);
+				sd_sim_push(0x00);
+				sd_sim_push_block(card->ssr, sizeof(card->ssr));
+				return;
+			case 23:
+				/* Applies to the next command if it is a CMD25 */
+				card->pre_erase = argument & 0x7FFFFF;
+				sd_sim_push(r1);
+				return;
+			case 41:
+				if (card->polls++ >= card->init_polls)
+					card->idle = 0;
+				sd_sim_push(card->idle);
+				return;
+			case 51:
+				sd_sim_push(r1);
+				sd_sim_push_block(card->scr, sizeof(card->scr));
+				return;
+		}
+	}
+	card->commands[command]++;
+
+	switch (command) {
+		case 0:
+			card->idle = SD_SIM_R1_IDLE;
+			card->crc = 0;
+			card->polls = 0;
+			card->state = SD_SIM_COMMAND;
+			sd_sim_push(SD_SIM_R1_IDLE);
+			return;
+		case 8:
+			sd_sim_push(r1);
+			sd_sim_push(0x00);
+			sd_sim_push(0x00);
+			sd_sim_push(card->frame[3] & 0x0F);
+			sd_sim_push(card->frame[4]);
+			return;
+		case 55:
+			card->app = 1;
+			sd_sim_push(r1);
+			return;
+		case 58:
+			/* OCR: power up done and CCS, 2.7-3.6V */
+			sd_sim_push(r1);
+			sd_sim_push(card->idle ? 0x00 : (0x80 | (card->high_capacity ? 0x40 : 0x00)));
+			sd_sim_push(0xFF);
+			sd_sim_push(0x80);
+			sd_sim_push(0x00);
+			return;
+		case 59:
+			card->crc = argument & 1;
+			sd_sim_push(r1);
+			return;
+	}
+
+	if (card->idle) {
+		sd_sim_push(SD_SIM_R1_ILLEGAL | r1);
+		return;
+	}
+
+	switch (command) {
+		case 9:
+			sd_sim_push(r1);
+			sd_sim_push_block(card->csd, sizeof(card->csd));
+			break;
+		case 10:
+			sd_sim_push(r1);
+			sd_sim_push_block(card->cid, sizeof(card->cid));
+			break;
+		case 12:
+			/* Stuff byte (the Ncr above), R1, then busy */
+			card->state = SD_SIM_COMMAND;
+			sd_sim_push(r1);
+			sd_sim_busy(card->stop_ns);
+			break;
+		case 13:
+			sd_sim_push(r1);
+			sd_sim_push(0x00);
+			break;
+		case 16:
+			sd_sim_push((argument == SD_SIM_BLOCK_LENGTH) ? r1 : SD_SIM_R1_PARAMETER);
+			break;
+		case 17:
+		case 18:
+		case 24:
+		case 25:
+			block = sd_sim_block(argument);
+			if (block < 0) {
+				sd_sim_push(SD_SIM_R1_ADDRESS);
+				break;
+			}
+			sd_sim_push(r1);
+			card->block = block;
+			card->multiple = (command == 18 || command == 25);
+			/* Blocks the card erases up front after an ACMD23 */
+			card->pre_erased = (command == 25) ? card->pre_erase : 0;
+			card->pre_erase = 0;
+			if (command == 17 || command == 18) {
+				card->state = SD_SIM_READ;
+				card->ready_ps = card->time_ps + card->read_ns * 1000ULL;
+			} else {
+				card->state = SD_SIM_WRITE_TOKEN;
+			}
+			break;
+		case 32:
+		case 33:
+			block = sd_sim_block(argument);
+			if (block < 0) {
+				sd_sim_push(SD_SIM_R1_ADDRESS);
+				break;
+			}
+			if (command == 32)
+				card->erase_start = block;
+			else
+				card->erase_end = block;
+			sd_sim_push(r1);
+			break;
+		case 38:
+			if (card->erase_start > card->erase_end) {
+				sd_sim_push(SD_SIM_R1_ERASE_SEQ);
+				break;
+			}
+			n = card->erase_end - card->erase_start + 1;
+			memset(card->data + (uint64_t)card->erase_start * SD_SIM_BLOCK_LENGTH, 0xFF, (uint64_t)n * SD_SIM_BLOCK_LENGTH);
+			card->blocks_erased += n;
+			sd_sim_push(r1);
+			sd_sim_busy(card->erase_ns + (uint64_t)n * card->erase_block_ns);
+			break;
+		default:
+			sd_sim_push(SD_SIM_R1_ILLEGAL);
+			break;
+	}
+}
+
+/* Takes a complete data block of a CMD24/CMD25 */
+static void sd_sim_write_data(void) {
+	SD_Sim_Card *card = &sd_sim_card;
+	uint8_t *dest;
+	uint16_t crc;
+	int erased, i;
+
+	card->state = card->multiple ? SD_SIM_WRITE_TOKEN : SD_SIM_COMMAND;
+
+	/* Computed with CRC off as well, so the model's own CPU time doesn't
+	 * depend on it */
+	crc = (card->in[SD_SIM_BLOCK_LENGTH] << 8) | card->in[SD_SIM_BLOCK_LENGTH+1];
+	if (crc != sd_sim_crc16(card->in, SD_SIM_BLOCK_LENGTH) && card->crc) {
+		card->crc_errors++;
+		sd_sim_push(SD_SIM_DATA_CRC);
+		return;
+	}
+	if (card->block >= card->blocks) {
+		sd_sim_push(SD_SIM_DATA_WRITE_ERROR);
+		return;
+	}
+
+	dest = card->data + (uint64_t)card->block * SD_SIM_BLOCK_LENGTH;
+	erased = 1;
+	if (card->pre_erased > 0) {
+		card->pre_erased--;
+	} else {
+		for (i = 0; i < SD_SIM_BLOCK_LENGTH; i++) {
+			if (dest[i] != 0xFF) {
+				erased = 0;
+				break;
+			}
+		}
+	}
+	memcpy(dest, card->in, SD_SIM_BLOCK_LENGTH);
+	card->block++;
+	card->blocks_written++;
+	card->erased_writes += erased;
+
+	sd_sim_push(SD_SIM_DATA_ACCEPTED);
+	sd_sim_busy(erased ? card->erased_write_ns : card->write_ns);
+}
+
+/* What the card drives on DO for the next byte */
+static uint8_t sd_sim_output(void) {
+	SD_Sim_Card *card = &sd_sim_card;
+
+	if (card->out_head < card->out_len)
+		return card->out[card->out_head++];
+	card->out_head = card->out_len = 0;
+
+	if (card->time_ps < card->busy_ps)
+		return 0x00;
+
+	if (card->state == SD_SIM_READ && card->time_ps >= card->ready_ps) {
+		/* Past the end the card stops sending, the host times out */
+		if (card->block >= card->blocks)
+			return 0xFF;
+		sd_sim_push_block(card->data + (uint64_t)card->block * SD_SIM_BLOCK_LENGTH, SD_SIM_BLOCK_LENGTH);
+		card->block++;
+		card->blocks_read++;
+		if (card->multiple)
+			card->ready_ps = card->time_ps + card->read_ns * 1000ULL;
+		else
+			card->state = SD_SIM_COMMAND;
+		return card->out[card->out_head++];
+	}
+
+	return 0xFF;
+}
+
+/* What the card does with the byte on DI */
+static void sd_sim_input(uint8_t data) {
+	SD_Sim_Card *card = &sd_sim_card;
+
+	switch (card->state) {
+		case SD_SIM_WRITE_TOKEN:
+			if (data == 0xFD && card->multiple) {
+				/* Nbr, then busy. A stop while the last block is still
+				 * programming is taken and adds to the busy time. */
+				card->state = SD_SIM_COMMAND;
+				sd_sim_push(0xFF);
+				if (card->busy_ps < card->time_ps)
+					card->busy_ps = card->time_ps;
+				card->busy_ps += card->stop_ns * 1000ULL;
+				card->busy_ns += card->stop_ns;
+			} else if (card->time_ps >= card->busy_ps && data == (card->multiple ? 0xFC : 0xFE)) {
+				card->state = SD_SIM_WRITE_DATA;
+				card->in_len = 0;
+			}
+			break;
+		case SD_SIM_WRITE_DATA:
+			card->in[card->in_len++] = data;
+			if (card->in_len == SD_SIM_BLOCK_LENGTH + 2)
+				sd_sim_write_data();
+			break;
+		default:
+			/* Commands start with 01 */
+			if (card->frame_len == 0 && (data & 0xC0) != 0x40)
+				break;
+			card->frame[card->frame_len++] = data;
+			if (card->frame_len == 6) {
+				card->frame_len = 0;
+				sd_sim_command();
+			}
+			break;
+	}
+}
+
+static void sd_sim_registers(void) {
+	SD_Sim_Card *card = &sd_sim_card;
+	uint32_t c_size;
+
+	memset(card->csd, 0, sizeof(card->csd));
+	if (card->high_capacity) {
+		/* CSD 2.0: capacity = (C_SIZE+1) * 512KB */
+		c_size = card->blocks / 1024 - 1;
+		card->csd[0] = 0x40;
+		card->csd[1] = 0x0E;
+		card->csd[5] = 0x59;
+		card->csd[7] = (c_size >> 16) & 0x3F;
+		card->csd[8] = c_size >> 8;
+		card->csd[9] = c_size;
+	} else {
+		/* CSD 1.0 with READ_BL_LEN 9 and C_SIZE_MULT 7: capacity =
+		 * (C_SIZE+1) * 512 blocks */
+		c_size = card->blocks / 512 - 1;
+		card->csd[0] = 0x00;
+		card->csd[1] = 0x26;
+		card->csd[5] = 0x59;
+		card->csd[6] = 0x80 | ((c_size >> 10) & 0x03);
+		card->csd[7] = c_size >> 2;
+		card->csd[8] = ((c_size & 0x03) << 6) | 0x2D;
+		card->csd[9] = 0xB3;
+		card->csd[10] = 0x80;
+	}
+	/* 25MHz, command classes, erase by block, 512 byte writes */
+	card->csd[3] = 0x32;
+	card->csd[4] = 0x5B;
+	card->csd[10] |= 0x7F;
+	card->csd[11] = 0x80;
+	card->csd[12] = 0x0A;
+	card->csd[13] = 0x40;
+	card->csd[15] = (sd_sim_crc7(card->csd, 15) << 1) | 1;
+
+	memset(card->cid, 0, sizeof(card->cid));
+	memcpy(card->cid, "\x03SDSIM01\x10\x12\x34\x56\x78\x00\xA9", 15);
+	card->cid[15] = (sd_sim_crc7(card->cid, 15) << 1) | 1;
+
+	/* SD 2.0, 1 and 4 bit bus */
+	memset(card->scr, 0, sizeof(card->scr));
+	card->scr[0] = 0x02;
+	card->scr[1] = 0x35;
+
+	/* Class 4, 1MB AU, 16 AUs erase in 1s plus 1s */
+	memset(card->ssr, 0, sizeof(card->ssr));
+	card->ssr[8] = 0x02;
+	card->ssr[10] = 0x70;
+	card->ssr[12] = 16;
+	card->ssr[13] = (1 << 2) | 1;
+}
+
+void sd_sim_init(uint8_t *data, uint32_t blocks, int high_capacity) {
+	memset(&sd_sim_card, 0, sizeof(sd_sim_card));
+	sd_sim_card.data = data;
+	sd_sim_card.blocks = blocks;
+	sd_sim_card.high_capacity = high_capacity;
+
+	/* The driver gives the data token SD_SPI_DATA_READ_ATTEMPTS bytes,
+	 * 32us at 25MHz, so reads have to be quicker than that */
+	sd_sim_card.read_ns = 20000;
+	sd_sim_card.write_ns = 700000;
+	sd_sim_card.erased_write_ns = 250000;
+	sd_sim_card.erase_ns = 2000000;
+	sd_sim_card.erase_block_ns = 100;
+	sd_sim_card.stop_ns = 100000;
+	sd_sim_card.init_polls = 3;
+
+	sd_sim_card.clock = SD_SPI_INIT_CLOCK;
+	sd_sim_card.idle = SD_SIM_R1_IDLE;
+	sd_sim_registers();
+}
+
+void sd_sim_select(int card) {
+	if (&sd_sim_cards[card] == sd_sim_current)
+		return;
+
+	/* The time and the clock belong to the bus */
+	sd_sim_cards[card].time_ps = sd_sim_card.time_ps;
+	sd_sim_cards[card].clock = sd_sim_card.clock;
+	sd_sim_current = &sd_sim_cards[card];
+}
+
+void sd_sim_set_serial(uint32_t serial) {
+	/* PSN, CID bits 56-24 */
+	sd_sim_card.cid[9] = serial >> 24;
+	sd_sim_card.cid[10] = serial >> 16;
+	sd_sim_card.cid[11] = serial >> 8;
+	sd_sim_card.cid[12] = serial;
+	sd_sim_card.cid[15] = (sd_sim_crc7(sd_sim_card.cid, 15) << 1) | 1;
+}
+
+void sd_sim_clear_counters(void) {
+	SD_Sim_Card *card;
+	uint64_t now;
+	int i;
+
+	now = sd_sim_card.time_ps;
+	for (i = 0; i < SD_SIM_CARDS; i++) {
+		card = &sd_sim_cards[i];
+
+		/* Pending card activity is kept relative to the new time base */
+		card->busy_ps = (card->busy_ps > now) ? card->busy_ps - now : 0;
+		card->ready_ps = (card->ready_ps > now) ? card->ready_ps - now : 0;
+		card->time_ps = 0;
+		card->bus_bytes = 0;
+		card->cs_toggles = 0;
+		memset(card->commands, 0, sizeof(card->commands));
+		memset(card->app_commands, 0, sizeof(card->app_commands));
+		card->blocks_read = 0;
+		card->blocks_written = 0;
+		card->erased_writes = 0;
+		card->blocks_erased = 0;
+		card->crc_errors = 0;
+		card->busy_ns = 0;
+	}
+}
+
+uint64_t sd_sim_time_ns(void) {
+	return sd_sim_card.time_ps / 1000;
+}
+
+uint8_t *sd_sim_load(const char *path, uint32_t *blocks) {
+	FILE *fp;
+	uint8_t *data;
+	long size;
+
+	fp = fopen(path, "rb");
+	if (fp == NULL)
+		return 0;
+	fseek(fp, 0, SEEK_END);
+	size = ftell(fp) / SD_SIM_BLOCK_LENGTH;
+	fseek(fp, 0, SEEK_SET);
+
+	data = malloc(size * SD_SIM_BLOCK_LENGTH);
+	if (data == NULL || fread(data, SD_SIM_BLOCK_LENGTH, size, fp) != (size_t)size) {
+		free(data);
+		fclose(fp);
+		return 0;
+	}
+	fclose(fp);
+
+	*blocks = size;
+	return data;
+}
+
+int sd_sim_save(const char *path) {
+	FILE *fp;
+	size_t n;
+
+	fp = fopen(path, "wb");
+	if (fp == NULL)
+		return -1;
+	n = fwrite(sd_sim_card.data, SD_SIM_BLOCK_LENGTH, sd_sim_card.blocks, fp);
+	fclose(fp);
+
+	return (n == sd_sim_card.blocks) ? 0 : -1;
+}
+
+/******************************************************************************
+ *** sd_port_*() for the driver                                             ***
+ ******************************************************************************/
+
+void sd_port_init(void) {
+	sd_sim_card.selected = 0;
+}
+
+uint32_t sd_port_set_clock(uint32_t hz) {
+	if (hz > SD_SIM_MAX_CLOCK)
+		hz = SD_SIM_MAX_CLOCK;
+	sd_sim_card.clock = hz;
+	return hz;
+}
+
+uint8_t sd_port_exchange(uint8_t data) {
+	SD_Sim_Card *card = &sd_sim_card;
+	uint8_t out = 0xFF;
+
+	if (card->selected)
+		out = sd_sim_output();
+
+	card->time_ps += 8000000000000ULL / card->clock;
+	card->bus_bytes++;
+
+	if (card->selected)
+		sd_sim_input(data);
+
+	return out;
+}
+
+void sd_port_select(void) {
+	sd_sim_select(sd_get_card());
+	if (!sd_sim_card.selected)
+		sd_sim_card.cs_toggles++;
+	sd_sim_card.selected = 1;
+}
+
+void sd_port_deselect(void) {
+	if (sd_sim_card.selected)
+		sd_sim_card.cs_toggles++;
+	sd_sim_card.selected = 0;
+}
+
+uint8_t sd_port_card_detect(void) {
+	return sd_sim_card.data != 0;
+}
+
+uint8_t sd_port_write_protect(void) {
+	return 0;
+}
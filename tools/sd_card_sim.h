@@ -0,0 +1,128 @@
+/* Software SD card behind the SD_SPI_BUS_PORT backend, for host tests
+ *
+ * Vanya A. Sergeev - <vsergeev@gmail.com> - copyright 2010
+ * please inform author of possible use, licensing is still being decided
+ *
+ * Implements the sd_port_*() functions of sd.h on top of a card model,
+ * so the unmodified driver and its modules run on a PC. Build them with
+ * -DSD_SPI_BUS=SD_SPI_BUS_PORT and link this file in.
+ *
+ * The model speaks the SPI mode protocol the driver uses: CMD0/8/9/10/
+ * 12/13/16/17/18/24/25/32/33/38/55/58/59, ACMD13/23/41/51, CRC7 on
+ * commands and CRC16 on data blocks when CRC is on. Time is modeled,
+ * not measured: every byte on the bus advances it by 8 clocks at the
+ * current SPI clock, read access, programming, erase and stop take the
+ * configured times, and the card holds DO low (busy) until the time
+ * runs out, selected or not.
+ *
+ * There are SD_SIM_CARDS cards. sd_port_select() switches to the one
+ * sd_get_card() names, so a driver built with SD_NUM_CARDS 2 talks to
+ * both. They share the bus time and clock, and a card keeps programming
+ * while the driver talks to the other.
+ */
+
+#ifndef _SD_CARD_SIM_H
+#define _SD_CARD_SIM_H
+
+#include <stdint.h>
+
+/* Fastest SPI clock the model accepts, in Hz */
+#define SD_SIM_MAX_CLOCK	25000000
+#define SD_SIM_BLOCK_LENGTH	512
+#define SD_SIM_CARDS		2
+
+typedef struct _SD_Sim_Card {
+	/* Card contents, blocks * SD_SIM_BLOCK_LENGTH bytes */
+	uint8_t *data;
+	uint32_t blocks;
+	/* SDHC (block addressed) or SDSC (byte addressed) */
+	int high_capacity;
+
+	/* Timing, in ns: first data byte of a read, programming a block,
+	 * programming a block that was erased (all 0xFF) beforehand or
+	 * pre-erased by an ACMD23 ahead of its CMD25, an erase plus its per
+	 * block part, and the busy after a CMD25 stop */
+	uint32_t read_ns;
+	uint32_t write_ns;
+	uint32_t erased_write_ns;
+	uint32_t erase_ns;
+	uint32_t erase_block_ns;
+	uint32_t stop_ns;
+	/* ACMD41 polls answered idle before the card is ready */
+	int init_polls;
+	/* Number of upcoming data blocks sent with a bad CRC16 */
+	int corrupt_reads;
+
+	/* Registers, filled in by sd_sim_init() */
+	uint8_t cid[16];
+	uint8_t csd[16];
+	uint8_t scr[8];
+	uint8_t ssr[64];
+
+	/* Counters, see sd_sim_clear_counters() */
+	uint64_t time_ps;
+	uint64_t bus_bytes;
+	/* Chip select changes, a select and a deselect count one each */
+	uint32_t cs_toggles;
+	uint32_t commands[64];
+	uint32_t app_commands[64];
+	uint32_t blocks_read;
+	uint32_t blocks_written;
+	uint32_t erased_writes;
+	uint32_t blocks_erased;
+	uint32_t crc_errors;
+	/* Busy the card asked for after writes, erases and stops, in ns */
+	uint64_t busy_ns;
+
+	/* Protocol state */
+	uint32_t clock;
+	int selected;
+	int idle;
+	int app;
+	int crc;
+	int polls;
+	int state;
+	int multiple;
+	uint8_t frame[6];
+	int frame_len;
+	uint8_t out[SD_SIM_BLOCK_LENGTH + 8];
+	int out_head;
+	int out_len;
+	uint32_t block;
+	uint32_t erase_start;
+	uint32_t erase_end;
+	/* Blocks of the last ACMD23, and those left of the CMD25 it applies to */
+	uint32_t pre_erase;
+	uint32_t pre_erased;
+	uint8_t in[SD_SIM_BLOCK_LENGTH + 2];
+	int in_len;
+	uint64_t ready_ps;
+	uint64_t busy_ps;
+} SD_Sim_Card;
+
+extern SD_Sim_Card sd_sim_cards[SD_SIM_CARDS];
+extern SD_Sim_Card *sd_sim_current;
+/* The card the driver talks to, card 0 until it selects another */
+#define sd_sim_card		(*sd_sim_current)
+
+/* Sets up the current card powered-off over data with default timing.
+ * data must hold blocks * SD_SIM_BLOCK_LENGTH bytes. */
+void sd_sim_init(uint8_t *data, uint32_t blocks, int high_capacity);
+/* Makes another card the current one, for sd_sim_init() and the
+ * counters. Set the cards up before the driver uses them. */
+void sd_sim_select(int card);
+/* Gives the current card another serial number in its CID, as if a card
+ * of the same kind had been swapped in and left in transfer state */
+void sd_sim_set_serial(uint32_t serial);
+/* Zeroes the time and the counters of all cards */
+void sd_sim_clear_counters(void);
+/* Modeled time since the last sd_sim_clear_counters(), in ns */
+uint64_t sd_sim_time_ns(void);
+
+/* Reads a card image into a new buffer and returns it, 0 on failure.
+ * The size is rounded down to whole blocks. */
+uint8_t *sd_sim_load(const char *path, uint32_t *blocks);
+/* Writes the card contents to an image, 0 on success */
+int sd_sim_save(const char *path);
+
+#endif
@@ -0,0 +1,372 @@
+#!/usr/bin/env python3
+# Builds and checks FAT16/FAT32 card images for sd_fat_test
+#
+# Vanya A. Sergeev - <vsergeev@gmail.com> - copyright 2010
+# please inform author of possible use, licensing is still being decided
+#
+# Usage: sd_fat_image.py make 16|32 <image>
+#        sd_fat_image.py check [--test] <image>
+#
+# make writes a small formatted card: FAT16 on the whole card, or FAT32
+# in the first partition of an MBR, holding HELLO.TXT, a fragmented
+# DATA.BIN and LOGS/OLD.LOG. check looks the image over the way fsck
+# would (FAT copies agree, chains end, no cross-linked or lost clusters,
+# chain lengths match file sizes) and lists the files; --test also
+# compares the files against what sd_fat_test leaves behind. Exits
+# non-zero on any problem.
+
+import struct
+import sys
+
+SECTOR = 512
+DIR_ENTRY = 32
+ATTR_VOLUME_ID = 0x08
+ATTR_DIRECTORY = 0x10
+ATTR_ARCHIVE = 0x20
+ATTR_LONG_NAME = 0x0F
+
+
+def pattern(length, seed):
+    """Test data, byte i is i*7 + seed, the same as in sd_fat_test.c"""
+    return bytes((i * 7 + seed) & 0xFF for i in range(length))
+
+
+class Volume:
+    def __init__(self, image, start, reserved, copies, fat_sectors,
+                 root_entries, cluster_sectors, total_sectors):
+        self.image = image
+        self.start = start
+        self.copies = copies
+        self.fat_sectors = fat_sectors
+        self.cluster_sectors = cluster_sectors
+        self.fat_start = start + reserved
+        self.root_start = self.fat_start + copies * fat_sectors
+        self.root_sectors = (root_entries * DIR_ENTRY + SECTOR - 1) // SECTOR
+        self.data_start = self.root_start + self.root_sectors
+        self.clusters = (total_sectors - (self.data_start - start)) // cluster_sectors
+        self.fat32 = self.clusters >= 65525
+
+    @staticmethod
+    def load(image):
+        """Finds the volume the way sd_fat_mount() does"""
+        start = 0
+        if image[0] not in (0xEB, 0xE9):
+            for i in range(4):
+                if image[446 + i * 16 + 4] != 0:
+                    start = struct.unpack_from('<I', image, 446 + i * 16 + 8)[0]
+                    break
+        boot = start * SECTOR
+        cluster_sectors = image[boot + 13]
+        reserved, copies, root_entries, total16, _, fat16 = \
+            struct.unpack_from('<HBHHBH', image, boot + 14)
+        total_sectors = total16 or struct.unpack_from('<I', image, boot + 32)[0]
+        fat_sectors = fat16 or struct.unpack_from('<I', image, boot + 36)[0]
+        return Volume(image, start, reserved, copies, fat_sectors,
+                      root_entries, cluster_sectors, total_sectors)
+
+    # FAT
+
+    def end_of_chain(self):
+        return 0x0FFFFFFF if self.fat32 else 0xFFFF
+
+    def is_end(self, value):
+        return value >= (0x0FFFFFF8 if self.fat32 else 0xFFF8)
+
+    def get_fat(self, cluster, copy=0):
+        offset = (self.fat_start + copy * self.fat_sectors) * SECTOR
+        if self.fat32:
+            return struct.unpack_from('<I', self.image, offset + cluster * 4)[0] & 0x0FFFFFFF
+        return struct.unpack_from('<H', self.image, offset + cluster * 2)[0]
+
+    def set_fat(self, cluster, value):
+        for copy in range(self.copies):
+            offset = (self.fat_start + copy * self.fat_sectors) * SECTOR
+            if self.fat32:
+                struct.pack_into('<I', self.image, offset + cluster * 4, value)
+            else:
+                struct.pack_into('<H', self.image, offset + cluster * 2, value)
+
+    def chain(self, cluster):
+        clusters = []
+        while 2 <= cluster < self.clusters + 2:
+            clusters.append(cluster)
+            if len(clusters) > self.clusters:
+                raise ValueError('cluster chain loops')
+            cluster = self.get_fat(cluster)
+        return clusters
+
+    def allocate(self, count, fragment):
+        """Chains count free clusters, skipping one after every third if
+        fragment is set"""
+        free = [c for c in range(2, self.clusters + 2) if self.get_fat(c) == 0]
+        clusters = []
+        i = 0
+        while len(clusters) < count:
+            clusters.append(free[i])
+            i += 2 if fragment and len(clusters) % 3 == 0 else 1
+        for this, following in zip(clusters, clusters[1:]):
+            self.set_fat(this, following)
+        self.set_fat(clusters[-1], self.end_of_chain())
+        return clusters
+
+    # Directories
+
+    def root_cluster(self):
+        return 2 if self.fat32 else 0
+
+    def cluster_sector(self, cluster):
+        return self.data_start + (cluster - 2) * self.cluster_sectors
+
+    def directory_sectors(self, cluster):
+        if cluster == 0:
+            return range(self.root_start, self.root_start + self.root_sectors)
+        return [self.cluster_sector(c) + i for c in self.chain(cluster)
+                for i in range(self.cluster_sectors)]
+
+    def entries(self, directory):
+        """Yields (name, attributes, first cluster, size) of the used
+        short name entries, volume labels excluded"""
+        for sector in self.directory_sectors(directory):
+            for offset in range(sector * SECTOR, (sector + 1) * SECTOR, DIR_ENTRY):
+                entry = self.image[offset:offset + DIR_ENTRY]
+                if entry[0] == 0x00:
+                    return
+                if entry[0] == 0xE5 or entry[11] == ATTR_LONG_NAME or entry[11] & ATTR_VOLUME_ID:
+                    continue
+                cluster = struct.unpack_from('<H', entry, 26)[0]
+                if self.fat32:
+                    cluster |= struct.unpack_from('<H', entry, 20)[0] << 16
+                yield (entry[0:11].decode('ascii', 'replace'), entry[11], cluster,
+                       struct.unpack_from('<I', entry, 28)[0])
+
+    def add(self, directory, name, data=b'', is_directory=False, fragment=False):
+        """Adds a file or an empty directory, name is in 8.3 directory
+        entry form, e.g. 'HELLO   TXT'. Returns its first cluster."""
+        cluster_bytes = self.cluster_sectors * SECTOR
+        count = 1 if is_directory else (len(data) + cluster_bytes - 1) // cluster_bytes
+        clusters = self.allocate(count, fragment) if count else []
+        first = clusters[0] if clusters else 0
+
+        for i, cluster in enumerate(clusters):
+            offset = self.cluster_sector(cluster) * SECTOR
+            chunk = bytes(cluster_bytes) if is_directory else data[i * cluster_bytes:(i + 1) * cluster_bytes]
+            self.image[offset:offset + len(chunk)] = chunk
+
+        if is_directory:
+            parent = 0 if directory == self.root_cluster() else directory
+            offset = self.cluster_sector(first) * SECTOR
+            self.image[offset:offset + DIR_ENTRY] = self.entry('.          ', ATTR_DIRECTORY, first, 0)
+            self.image[offset + DIR_ENTRY:offset + 2 * DIR_ENTRY] = self.entry('..         ', ATTR_DIRECTORY, parent, 0)
+
+        for sector in self.directory_sectors(directory):
+            for offset in range(sector * SECTOR, (sector + 1) * SECTOR, DIR_ENTRY):
+                if self.image[offset] in (0x00, 0xE5):
+                    self.image[offset:offset + DIR_ENTRY] = self.entry(
+                        name, ATTR_DIRECTORY if is_directory else ATTR_ARCHIVE,
+                        first, 0 if is_directory else len(data))
+                    return first
+        raise ValueError('directory full')
+
+    @staticmethod
+    def entry(name, attributes, cluster, size):
+        entry = bytearray(DIR_ENTRY)
+        entry[0:11] = name.encode('ascii')
+        entry[11] = attributes
+        struct.pack_into('<H', entry, 20, cluster >> 16)
+        struct.pack_into('<H', entry, 26, cluster & 0xFFFF)
+        struct.pack_into('<I', entry, 28, size)
+        return entry
+
+    # Files
+
+    def read(self, cluster, size):
+        data = bytearray()
+        for c in self.chain(cluster):
+            offset = self.cluster_sector(c) * SECTOR
+            data += self.image[offset:offset + self.cluster_sectors * SECTOR]
+        return bytes(data[:size])
+
+    def files(self, directory=None, prefix=''):
+        """Returns {path: contents} of every file below directory"""
+        if directory is None:
+            directory = self.root_cluster()
+        found = {}
+        for name, attributes, cluster, size in self.entries(directory):
+            if name.startswith('.'):
+                continue
+            path = prefix + name[0:8].rstrip()
+            if name[8:].rstrip():
+                path += '.' + name[8:].rstrip()
+            if attributes & ATTR_DIRECTORY:
+                found.update(self.files(cluster, path + '/'))
+            else:
+                found[path] = self.read(cluster, size)
+        return found
+
+    def check(self):
+        """Returns a list of the problems found"""
+        problems = []
+        for cluster in range(self.clusters + 2):
+            if any(self.get_fat(cluster, copy) != self.get_fat(cluster) for copy in range(1, self.copies)):
+                problems.append('FAT copies differ at cluster %d' % cluster)
+                break
+
+        used = set()
+
+        def claim(clusters, what):
+            for cluster in clusters:
+                if cluster in used:
+                    problems.append('%s: cluster %d cross-linked' % (what, cluster))
+                used.add(cluster)
+
+        def walk(directory, path):
+            if directory != 0:
+                claim(self.chain(directory), path or '/')
+            for name, attributes, cluster, size in self.entries(directory):
+                if name.startswith('.'):
+                    continue
+                what = path + '/' + name
+                if attributes & ATTR_DIRECTORY:
+                    walk(cluster, what)
+                    continue
+                clusters = self.chain(cluster) if cluster else []
+                if clusters and not self.is_end(self.get_fat(clusters[-1])):
+                    problems.append('%s: chain runs off the volume' % what)
+                needed = (size + self.cluster_sectors * SECTOR - 1) // (self.cluster_sectors * SECTOR)
+                if len(clusters) != needed:
+                    problems.append('%s: %d clusters for %d bytes' % (what, len(clusters), size))
+                claim(clusters, what)
+
+        walk(self.root_cluster(), '')
+        lost = [c for c in range(2, self.clusters + 2) if self.get_fat(c) != 0 and c not in used]
+        if lost:
+            problems.append('%d lost clusters' % len(lost))
+        return problems
+
+
+def make(fat_type, path):
+    """Formats a card image the way a PC would and fills it in"""
+    fat32 = (fat_type == '32')
+    total = 80000 if fat32 else 40000
+    cluster_sectors = 1 if fat32 else 4
+    start = 2048 if fat32 else 0
+    sectors = total - start
+    reserved = 32 if fat32 else 1
+    copies = 2
+    root_entries = 0 if fat32 else 512
+    root_sectors = (root_entries * DIR_ENTRY + SECTOR - 1) // SECTOR
+    entry_size = 4 if fat32 else 2
+
+    # Smallest FAT that covers the clusters left next to it
+    fat_sectors = 1
+    while True:
+        clusters = (sectors - reserved - copies * fat_sectors - root_sectors) // cluster_sectors
+        if (clusters + 2) * entry_size <= fat_sectors * SECTOR:
+            break
+        fat_sectors += 1
+
+    image = bytearray(total * SECTOR)
+    boot = bytearray(SECTOR)
+    boot[0:11] = b'\xEB\x58\x90MKFSPY  '
+    struct.pack_into('<HBHBHHBHHHII', boot, 11, SECTOR, cluster_sectors, reserved,
+                     copies, root_entries, 0 if fat32 or sectors >= 65536 else sectors,
+                     0xF8, 0 if fat32 else fat_sectors, 63, 255, start,
+                     sectors if fat32 or sectors >= 65536 else 0)
+    if fat32:
+        # FAT size, flags, version, root cluster, FSInfo and backup boot sector
+        struct.pack_into('<IHHIHH', boot, 36, fat_sectors, 0, 0, 2, 1, 6)
+        boot[64] = 0x80
+        boot[66] = 0x29
+        boot[71:90] = b'NO NAME    FAT32   '
+    else:
+        boot[36] = 0x80
+        boot[38] = 0x29
+        boot[43:62] = b'NO NAME    FAT16   '
+    boot[510:512] = b'\x55\xAA'
+    image[start * SECTOR:(start + 1) * SECTOR] = boot
+
+    if fat32:
+        fsinfo = bytearray(SECTOR)
+        struct.pack_into('<I', fsinfo, 0, 0x41615252)
+        struct.pack_into('<III', fsinfo, 484, 0x61417272, 0xFFFFFFFF, 0xFFFFFFFF)
+        fsinfo[510:512] = b'\x55\xAA'
+        image[(start + 1) * SECTOR:(start + 2) * SECTOR] = fsinfo
+        image[(start + 6) * SECTOR:(start + 7) * SECTOR] = boot
+
+        # MBR with one FAT32 LBA partition
+        mbr = bytearray(SECTOR)
+        struct.pack_into('<BBBBBBBBII', mbr, 446, 0, 0, 0, 0, 0x0C, 0, 0, 0, start, sectors)
+        mbr[510:512] = b'\x55\xAA'
+        image[0:SECTOR] = mbr
+
+    volume = Volume(image, start, reserved, copies, fat_sectors, root_entries,
+                    cluster_sectors, sectors)
+    volume.set_fat(0, 0x0FFFFFF8 if fat32 else 0xFFF8)
+    volume.set_fat(1, volume.end_of_chain())
+    if fat32:
+        volume.set_fat(2, volume.end_of_chain())
+
+    root = volume.root_cluster()
+    volume.add(root, 'HELLO   TXT', b'hello, world\n')
+    volume.add(root, 'DATA    BIN', pattern(100000, 1), fragment=True)
+    logs = volume.add(root, 'LOGS       ', is_directory=True)
+    volume.add(logs, 'OLD     LOG', pattern(5000, 2))
+
+    problems = volume.check()
+    if problems:
+        raise ValueError(problems)
+    with open(path, 'wb') as f:
+        f.write(image)
+    print('FAT%s, %d clusters of %d sectors' % (fat_type, volume.clusters, cluster_sectors))
+
+
+def expected_after_test():
+    """Files as sd_fat_test leaves them"""
+    files = {
+        'HELLO.TXT': b'hello, world\n',
+        'DATA.BIN': pattern(100000, 1),
+        'LOGS/OLD.LOG': pattern(3000, 9),
+        'LOGS/NEW.LOG': pattern(200000, 3) + pattern(70001, 4),
+    }
+    for i in range(40):
+        files['LOGS/F%d.DAT' % i] = pattern(i * 37, i)
+    return files
+
+
+def check(path, test):
+    with open(path, 'rb') as f:
+        volume = Volume.load(bytearray(f.read()))
+    problems = volume.check()
+    files = volume.files()
+
+    print('FAT%d, %d clusters, %d files' % (32 if volume.fat32 else 16, volume.clusters, len(files)))
+    for name in sorted(files):
+        print('  %-16s %8d' % (name, len(files[name])))
+
+    if test:
+        expected = expected_after_test()
+        for name in sorted(expected):
+            if files.get(name) != expected[name]:
+                problems.append('%s: contents differ' % name)
+        for name in sorted(files):
+            if name not in expected:
+                problems.append('%s: unexpected file' % name)
+
+    for problem in problems:
+        print(problem)
+    print('clean' if not problems else '%d problems' % len(problems))
+    return 1 if problems else 0
+
+
+def main(argv):
+    if len(argv) == 4 and argv[1] == 'make' and argv[2] in ('16', '32'):
+        make(argv[2], argv[3])
+        return 0
+    if len(argv) in (3, 4) and argv[1] == 'check' and (len(argv) == 3 or argv[2] == '--test'):
+        return check(argv[-1], len(argv) == 4)
+    sys.stderr.write('Usage: %s make 16|32 <image>\n       %s check [--test] <image>\n' % (argv[0], argv[0]))
+    return 2
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
@@ -0,0 +1,209 @@
+/* Tests of sd_fat against the card model
+ *
+ * Vanya A. Sergeev - <vsergeev@gmail.com> - copyright 2010
+ * please inform author of possible use, licensing is still being decided
+ *
+ * Builds on a PC with:
+ *	cc -O2 -I.. -DSD_SPI_BUS=SD_SPI_BUS_PORT -o sd_fat_test sd_fat_test.c sd_card_sim.c ../sd_fat.c ../sd.c
+ *
+ * Usage: sd_fat_test <card image> <result image>
+ *
+ * The card image comes from sd_fat_image.py make 16 or make 32. The test
+ * reads the files on it, creates, appends to and truncates files through
+ * sd_fat, and writes the card out to the result image, which
+ * sd_fat_image.py check --test then looks over independently. Prints one
+ * line per check and exits non-zero if any failed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sd_card_sim.h"
+#include "sd_fat.h"
+
+#define NEW_LOG_LENGTH		200000
+#define APPEND_LENGTH		70001
+
+static uint8_t buffer[NEW_LOG_LENGTH + APPEND_LENGTH];
+static int failures;
+
+static void check(const char *what, int ok) {
+	printf("%-60s %s\n", what, ok ? "ok" : "FAIL");
+	if (!ok)
+		failures++;
+}
+
+/* Test data, byte i is i*7 + seed, the same as in sd_fat_image.py */
+static uint8_t pattern(uint32_t i, int seed) {
+	return (i * 7 + seed) & 0xFF;
+}
+
+static int matches(const uint8_t *data, uint32_t pos, int len, int seed) {
+	int i;
+
+	for (i = 0; i < len; i++) {
+		if (data[i] != pattern(pos + i, seed))
+			return 0;
+	}
+
+	return 1;
+}
+
+/* Reads the files the image was made with, in odd sized pieces and at
+ * random positions */
+static void test_read(void) {
+	SD_FAT_File file;
+	uint32_t pos, commands;
+	int i, n, retVal;
+
+	retVal = sd_fat_open(&file, "hello.txt", SD_FAT_READ);
+	n = sd_fat_read(&file, buffer, 100);
+	check("read HELLO.TXT", retVal == 0 && n == 13 && memcmp(buffer, "hello, world\n", 13) == 0);
+
+	retVal = sd_fat_open(&file, "/DATA.BIN", SD_FAT_READ);
+	commands = sd_sim_card.commands[17] + sd_sim_card.commands[18];
+	for (i = 0, n = 1; i < 100000 && n > 0; i += n)
+		n = sd_fat_read(&file, buffer + i, (i % 3 == 0) ? 777 : 4096);
+	check("read the fragmented DATA.BIN", retVal == 0 && i == 100000 && matches(buffer, 0, 100000, 1));
+	printf("  %u read commands, %d extents\n", sd_sim_card.commands[17] + sd_sim_card.commands[18] - commands, file.num_extents);
+
+	retVal = 0;
+	for (i = 0; i < 50; i++) {
+		pos = (i * 7919) % 99000;
+		sd_fat_seek(&file, pos);
+		n = sd_fat_read(&file, buffer, 1000);
+		if (n != 1000 || !matches(buffer, pos, n, 1))
+			retVal = -1;
+	}
+	check("seek and read DATA.BIN", retVal == 0);
+
+	check("missing file", sd_fat_open(&file, "NOPE.TXT", SD_FAT_READ) == SD_ERROR_FAT_NOT_FOUND);
+	check("long name refused", sd_fat_open(&file, "waytoolongname.txt", SD_FAT_READ) == SD_ERROR_FAT_BAD_NAME);
+}
+
+/* Creates, appends to and truncates files in a subdirectory */
+static void test_write(void) {
+	SD_FAT_File file;
+	uint32_t commands;
+	int i, j, n, retVal;
+
+	for (i = 0; i < NEW_LOG_LENGTH; i++)
+		buffer[i] = pattern(i, 3);
+	for (i = 0; i < APPEND_LENGTH; i++)
+		buffer[NEW_LOG_LENGTH + i] = pattern(i, 4);
+
+	retVal = sd_fat_open(&file, "logs/new.log", SD_FAT_WRITE | SD_FAT_CREATE);
+	commands = sd_sim_card.commands[24] + sd_sim_card.commands[25];
+	for (i = 0, n = 1; i < NEW_LOG_LENGTH && n > 0; i += n) {
+		j = (i < NEW_LOG_LENGTH / 2) ? 1000 : 16384;
+		if (j > NEW_LOG_LENGTH - i)
+			j = NEW_LOG_LENGTH - i;
+		n = sd_fat_write(&file, buffer + i, j);
+	}
+	retVal |= sd_fat_close(&file);
+	check("create LOGS/NEW.LOG", retVal == 0 && i == NEW_LOG_LENGTH);
+	printf("  %u write commands, %d extents\n", sd_sim_card.commands[24] + sd_sim_card.commands[25] - commands, file.num_extents);
+
+	retVal = sd_fat_open(&file, "LOGS/NEW.LOG", SD_FAT_WRITE | SD_FAT_READ);
+	retVal |= sd_fat_seek(&file, sd_fat_size(&file));
+	n = sd_fat_write(&file, buffer + NEW_LOG_LENGTH, APPEND_LENGTH);
+	retVal |= sd_fat_close(&file);
+	check("append to LOGS/NEW.LOG", retVal == 0 && n == APPEND_LENGTH);
+
+	for (i = 0; i < 3000; i++)
+		buffer[i] = pattern(i, 9);
+	retVal = sd_fat_open(&file, "LOGS/OLD.LOG", SD_FAT_WRITE | SD_FAT_TRUNCATE);
+	n = sd_fat_write(&file, buffer, 3000);
+	retVal |= sd_fat_close(&file);
+	check("truncate and rewrite LOGS/OLD.LOG", retVal == 0 && n == 3000);
+
+	/* Enough small files to take the directory past its first cluster */
+	retVal = 0;
+	for (i = 0; i < 40; i++) {
+		char name[16];
+
+		sprintf(name, "LOGS/F%d.DAT", i);
+		retVal |= sd_fat_open(&file, name, SD_FAT_WRITE | SD_FAT_CREATE);
+		for (j = 0; j < i * 37; j++)
+			buffer[j] = pattern(j, i);
+		if (sd_fat_write(&file, buffer, i * 37) != i * 37)
+			retVal = -1;
+		retVal |= sd_fat_close(&file);
+	}
+	check("create 40 small files", retVal == 0);
+
+	retVal = sd_fat_open(&file, "LOGS/NEW.LOG", SD_FAT_READ);
+	n = sd_fat_read(&file, buffer, sizeof(buffer));
+	check("read back LOGS/NEW.LOG", retVal == 0 && n == NEW_LOG_LENGTH + APPEND_LENGTH &&
+		matches(buffer, 0, NEW_LOG_LENGTH, 3) && matches(buffer + NEW_LOG_LENGTH, 0, APPEND_LENGTH, 4));
+}
+
+/* Volumes that reach past the 32-bit byte addresses of the driver are
+ * refused rather than wrapped around */
+static void test_limit(void) {
+	uint8_t *boot, saved[8];
+	uint32_t volume, total;
+
+	/* Boot sector and its total sector fields, behind an MBR or not */
+	volume = 0;
+	if (sd_sim_card.data[0] != 0xEB && sd_sim_card.data[0] != 0xE9)
+		volume = sd_sim_card.data[454] | (sd_sim_card.data[455] << 8) |
+			(sd_sim_card.data[456] << 16) | ((uint32_t)sd_sim_card.data[457] << 24);
+	boot = sd_sim_card.data + volume * SD_BLOCK_LENGTH;
+	memcpy(saved, boot + 19, 2);
+	memcpy(saved + 2, boot + 32, 4);
+
+	total = 0x800000 - volume + 1;
+	boot[19] = boot[20] = 0;
+	boot[32] = total;
+	boot[33] = total >> 8;
+	boot[34] = total >> 16;
+	boot[35] = total >> 24;
+	check("volume past 4GB refused", sd_fat_mount() == SD_ERROR_FAT_UNSUPPORTED);
+
+	total--;
+	boot[32] = total;
+	check("volume up to 4GB accepted", sd_fat_mount() != SD_ERROR_FAT_UNSUPPORTED);
+
+	memcpy(boot + 19, saved, 2);
+	memcpy(boot + 32, saved + 2, 4);
+}
+
+int main(int argc, char *argv[]) {
+	uint8_t *data;
+	uint32_t blocks;
+	int retVal;
+
+	if (argc != 3) {
+		fprintf(stderr, "Usage: %s <card image> <result image>\n", argv[0]);
+		return 2;
+	}
+	data = sd_sim_load(argv[1], &blocks);
+	if (data == 0) {
+		fprintf(stderr, "Error reading %s\n", argv[1]);
+		return 1;
+	}
+	sd_sim_init(data, blocks, 1);
+
+	retVal = sd_init();
+	check("sd_init", retVal == 0);
+	if (retVal < 0)
+		return 1;
+
+	test_limit();
+	retVal = sd_fat_mount();
+	check("sd_fat_mount", retVal == 0);
+	if (retVal < 0)
+		return 1;
+
+	test_read();
+	test_write();
+	check("sd_fat_unmount", sd_fat_unmount() == 0);
+
+	if (sd_sim_save(argv[2]) < 0) {
+		fprintf(stderr, "Error writing %s\n", argv[2]);
+		return 1;
+	}
+
+	return (failures == 0) ? 0 : 1;
+}
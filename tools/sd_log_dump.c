@@ -0,0 +1,194 @@
+/* Dumps the records of an sd_log record log from a card image
+ *
+ * Vanya A. Sergeev - <vsergeev@gmail.com> - copyright 2010
+ * please inform author of possible use, licensing is still being decided
+ *
+ * Builds on a PC with: cc -O2 -o sd_log_dump sd_log_dump.c
+ *
+ * Usage: sd_log_dump [-q] <card image> [start block [number of blocks]]
+ *
+ * The image is a raw dump of the card (e.g. dd if=/dev/sdX of=card.img).
+ * start block and number of blocks are the ones given to sd_log_mount();
+ * the whole image is assumed without them. Records are printed oldest
+ * first as "<record number>: <hex bytes>", -q only prints the totals.
+ * See sd_log.h for the layout.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define BLOCK_LENGTH	512
+#define CRC_OFFSET	(BLOCK_LENGTH - 2)
+#define PAGE_HEADER	8
+#define LOG_MAGIC	0x474C4453
+
+static uint16_t crc16_table[256];
+
+/* CRC16-CCITT (x^16 + x^12 + x^5 + 1), as used by the card and sd_log */
+static void crc16_init(void) {
+	uint16_t crc;
+	int i, j;
+
+	for (i = 0; i < 256; i++) {
+		crc = i << 8;
+		for (j = 0; j < 8; j++)
+			crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+		crc16_table[i] = crc;
+	}
+}
+
+static int sealed(const uint8_t *block) {
+	uint16_t crc;
+	int i;
+
+	crc = 0;
+	for (i = 0; i < CRC_OFFSET; i++)
+		crc = (crc << 8) ^ crc16_table[(crc >> 8) ^ block[i]];
+
+	return (crc == ((block[CRC_OFFSET] << 8) | block[CRC_OFFSET+1]));
+}
+
+static uint32_t get32(const uint8_t *p) {
+	return p[0] | (p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint16_t get16(const uint8_t *p) {
+	return p[0] | (p[1] << 8);
+}
+
+typedef struct {
+	uint32_t segment;
+	uint32_t seq;
+} Segment;
+
+static int compare_segments(const void *a, const void *b) {
+	int32_t d;
+
+	d = ((const Segment *)a)->seq - ((const Segment *)b)->seq;
+	return (d > 0) - (d < 0);
+}
+
+int main(int argc, char *argv[]) {
+	const uint8_t *image, *header, *page, *record;
+	uint32_t start, nblocks, image_blocks, segment_blocks, segments;
+	uint32_t i, j, k, block, first_page, count, record_len, per_page;
+	uint64_t records, pages;
+	Segment *order;
+	uint32_t num_order;
+	struct stat st;
+	int fd, quiet, arg;
+
+	quiet = 0;
+	arg = 1;
+	if (arg < argc && argv[arg][0] == '-' && argv[arg][1] == 'q') {
+		quiet = 1;
+		arg++;
+	}
+	if (arg >= argc) {
+		fprintf(stderr, "usage: %s [-q] <card image> [start block [number of blocks]]\n", argv[0]);
+		return 1;
+	}
+
+	fd = open(argv[arg], O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		perror(argv[arg]);
+		return 1;
+	}
+	image = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (image == MAP_FAILED) {
+		perror("mmap");
+		return 1;
+	}
+	image_blocks = st.st_size / BLOCK_LENGTH;
+
+	start = (arg + 1 < argc) ? strtoul(argv[arg+1], 0, 0) : 0;
+	nblocks = (arg + 2 < argc) ? strtoul(argv[arg+2], 0, 0) : image_blocks - start;
+	if (start >= image_blocks || nblocks > image_blocks - start) {
+		fprintf(stderr, "log region is outside the image\n");
+		return 1;
+	}
+
+	crc16_init();
+
+	/* The segment length comes from the first header found */
+	segment_blocks = 0;
+	record_len = 0;
+	for (block = start; block < start + nblocks; block++) {
+		header = image + (uint64_t)block*BLOCK_LENGTH;
+		if (sealed(header) && get32(header) == LOG_MAGIC) {
+			segment_blocks = get32(header + 14);
+			record_len = get16(header + 12);
+			break;
+		}
+	}
+	if (segment_blocks == 0 || record_len == 0 || record_len > CRC_OFFSET - PAGE_HEADER) {
+		fprintf(stderr, "no log found\n");
+		return 1;
+	}
+	per_page = (CRC_OFFSET - PAGE_HEADER) / record_len;
+
+	/* Same alignment as sd_log_mount() */
+	if (start % segment_blocks != 0) {
+		if (nblocks < segment_blocks - (start % segment_blocks)) {
+			fprintf(stderr, "log region is too small\n");
+			return 1;
+		}
+		nblocks -= segment_blocks - (start % segment_blocks);
+		start += segment_blocks - (start % segment_blocks);
+	}
+	segments = nblocks / segment_blocks;
+
+	order = malloc(segments * sizeof(Segment));
+	num_order = 0;
+	for (i = 0; i < segments; i++) {
+		header = image + ((uint64_t)start + (uint64_t)i*segment_blocks)*BLOCK_LENGTH;
+		if (!sealed(header) || get32(header) != LOG_MAGIC ||
+		    get16(header + 12) != record_len || get32(header + 14) != segment_blocks)
+			continue;
+		order[num_order].segment = i;
+		order[num_order].seq = get32(header + 4);
+		num_order++;
+	}
+	qsort(order, num_order, sizeof(Segment), compare_segments);
+
+	records = 0;
+	pages = 0;
+	for (i = 0; i < num_order; i++) {
+		header = image + ((uint64_t)start + (uint64_t)order[i].segment*segment_blocks)*BLOCK_LENGTH;
+		first_page = get32(header + 8);
+
+		for (block = 1; block < segment_blocks; block++) {
+			page = header + (uint64_t)block*BLOCK_LENGTH;
+			count = get16(page + 4);
+			if (!sealed(page) || get32(page) != first_page + block - 1 ||
+			    get16(page + 6) != record_len || count == 0 || count > per_page)
+				break;
+
+			if (!quiet) {
+				for (j = 0; j < count; j++) {
+					record = page + PAGE_HEADER + j*record_len;
+					printf("%llu:", (unsigned long long)get32(page)*per_page + j);
+					for (k = 0; k < record_len; k++)
+						printf(" %02X", record[k]);
+					printf("\n");
+				}
+			}
+			records += count;
+			pages++;
+		}
+	}
+
+	fprintf(quiet ? stdout : stderr, "%u segments, %llu pages, %llu records of %u bytes\n",
+		num_order, (unsigned long long)pages, (unsigned long long)records, record_len);
+
+	free(order);
+	munmap((void *)image, st.st_size);
+	close(fd);
+
+	return 0;
+}
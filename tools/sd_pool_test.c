@@ -0,0 +1,185 @@
+/* Tests of sd_pool against the card model
+ *
+ * Vanya A. Sergeev - <vsergeev@gmail.com> - copyright 2010
+ * please inform author of possible use, licensing is still being decided
+ *
+ * Builds on a PC with:
+ *	cc -O2 -I.. -DSD_SPI_BUS=SD_SPI_BUS_PORT -o sd_pool_test sd_pool_test.c sd_card_sim.c ../sd_pool.c ../sd_au.c ../sd.c
+ *
+ * Usage: sd_pool_test
+ *
+ * The card model programs erased blocks faster than ones holding data
+ * (see sd_card_sim.h). The test erases blocks in the background, writes
+ * into erased and not erased blocks and compares the modeled times, then
+ * checks the statistics, an erase that times out with writes right after
+ * it, and frees of blocks already in the pool. Prints one line per check
+ * and exits non-zero if any failed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sd_card_sim.h"
+#include "sd_pool.h"
+
+#define CARD_BLOCKS	32768
+#define WRITE_BLOCKS	1024
+
+static uint8_t buffer[64 * SD_BLOCK_LENGTH];
+static int failures;
+
+static void check(const char *what, int ok) {
+	printf("%-60s %s\n", what, ok ? "ok" : "FAIL");
+	if (!ok)
+		failures++;
+}
+
+/* Writes nblocks taken off the pool in bursts of up to 64 blocks and
+ * returns the modeled time it took in ns, 0 on failure */
+static uint64_t write_from_pool(uint32_t nblocks) {
+	uint32_t lba;
+	uint64_t start;
+	int n;
+
+	start = sd_sim_time_ns();
+	while (nblocks > 0) {
+		n = sd_pool_alloc((nblocks < 64) ? nblocks : 64, &lba);
+		if (n <= 0 || sd_write_blocks(lba*SD_BLOCK_LENGTH, buffer, n*SD_BLOCK_LENGTH) < 0)
+			return 0;
+		nblocks -= n;
+	}
+
+	return sd_sim_time_ns() - start;
+}
+
+static void test_erase_vs_program(void) {
+	uint64_t start, erase_ns, erased_ns, dirty_ns;
+	uint32_t polls, erases;
+	int retVal;
+
+	/* Not erased: blocks still holding data are handed out as they are */
+	memset(sd_sim_card.data, 0, CARD_BLOCKS * SD_BLOCK_LENGTH);
+	sd_pool_free(8192, WRITE_BLOCKS);
+	check("freed blocks counted as not erased", sd_pool_stats.dirty_blocks == WRITE_BLOCKS &&
+		sd_pool_stats.erased_blocks == 0);
+	dirty_ns = write_from_pool(WRITE_BLOCKS);
+	check("not erased blocks handed out", dirty_ns != 0 && sd_pool_stats.alloc_dirty == WRITE_BLOCKS &&
+		sd_pool_stats.dirty_blocks == 0);
+
+	/* Erased in the background: several AUs, one CMD38 per AU */
+	sd_pool_free(16384, 3 * sd_get_au_blocks() + 100);
+	erases = sd_sim_card.commands[38];
+	start = sd_sim_time_ns();
+	for (polls = 0; (retVal = sd_pool_poll()) > 0; polls++)
+		;
+	erase_ns = sd_sim_time_ns() - start;
+	check("background erase finished", retVal == 0 && sd_pool_stats.erase_errors == 0);
+	check("one CMD38 per AU", sd_sim_card.commands[38] - erases == 4 && sd_pool_stats.erases == 4);
+	check("erased blocks counted", sd_pool_stats.erased_blocks == 3 * sd_get_au_blocks() + 100 &&
+		sd_pool_stats.dirty_blocks == 0);
+	check("blocks erased on the card", sd_sim_card.data[16384 * SD_BLOCK_LENGTH] == 0xFF);
+
+	erased_ns = write_from_pool(WRITE_BLOCKS);
+	check("erased blocks handed out first", erased_ns != 0 && sd_pool_stats.alloc_erased == WRITE_BLOCKS);
+	check("writes into erased blocks are faster", erased_ns < dirty_ns);
+
+	printf("  %d blocks: %.1f ms into erased blocks, %.1f ms into blocks with data\n",
+		WRITE_BLOCKS, erased_ns / 1e6, dirty_ns / 1e6);
+	printf("  background erase of %u blocks: %.1f ms over %u polls\n",
+		3 * sd_get_au_blocks() + 100, erase_ns / 1e6, polls);
+}
+
+/* An erase that doesn't finish in time is reported, its blocks aren't
+ * counted as erased, and no other erase starts until the card is idle */
+static void test_erase_timeout(void) {
+	uint32_t erase_ns, erase_block_ns, erases, lba;
+	int retVal, n, busy;
+
+	sd_pool_clear();
+	memset(&sd_pool_stats, 0, sizeof(sd_pool_stats));
+
+	erase_ns = sd_sim_card.erase_ns;
+	sd_sim_card.erase_ns = (sd_get_erase_timeout_ms(1) + 200) * 1000000;
+	sd_pool_free(0, 100);
+	sd_pool_free(4096, 100);
+
+	while ((retVal = sd_pool_poll()) == 1)
+		;
+	check("erase timeout reported", retVal == SD_ERROR_ERASE_TIMEOUT && sd_pool_stats.erase_errors == 1);
+	check("timed out blocks not counted as erased", sd_pool_stats.erased_blocks == 0 &&
+		sd_pool_stats.dirty_blocks == 200);
+
+	sd_sim_card.erase_ns = erase_ns;
+	erases = sd_sim_card.commands[38];
+	while (sd_sim_card.time_ps < sd_sim_card.busy_ps) {
+		if (sd_pool_poll() != 1 || sd_sim_card.commands[38] != erases)
+			break;
+	}
+	check("no erase started while the card is busy", sd_sim_card.commands[38] == erases);
+
+	while ((retVal = sd_pool_poll()) == 1)
+		;
+	check("next erase once the card is idle", retVal == 0 && sd_sim_card.commands[38] == erases + 1 &&
+		sd_pool_stats.erased_blocks == 100);
+
+	/* Writing right after the timeout waits for the card first */
+	sd_pool_clear();
+	sd_sim_card.erase_ns = (sd_get_erase_timeout_ms(1) + 200) * 1000000;
+	sd_pool_free(0, 100);
+	while ((retVal = sd_pool_poll()) == 1)
+		;
+	sd_sim_card.erase_ns = erase_ns;
+	n = sd_pool_alloc(16, &lba);
+	busy = (sd_sim_card.time_ps < sd_sim_card.busy_ps);
+	check("alloc after a timeout waits for the card", retVal == SD_ERROR_ERASE_TIMEOUT && n == 16 && !busy);
+	check("write after a timeout", sd_write_blocks(lba*SD_BLOCK_LENGTH, buffer, 16*SD_BLOCK_LENGTH) == 0);
+
+	/* A card that stays busy past SD_ERASE_TIMEOUT_MS fails the alloc.
+	 * The time is spread over the blocks, it doesn't fit erase_ns. */
+	sd_pool_clear();
+	erase_block_ns = sd_sim_card.erase_block_ns;
+	sd_sim_card.erase_block_ns = (sd_get_erase_timeout_ms(1) + SD_ERASE_TIMEOUT_MS + 200) * 10000;
+	sd_pool_free(0, 100);
+	while ((retVal = sd_pool_poll()) == 1)
+		;
+	sd_sim_card.erase_block_ns = erase_block_ns;
+	n = sd_pool_alloc(16, &lba);
+	check("alloc fails while the card stays busy", n == SD_ERROR_ERASE_TIMEOUT);
+	check("alloc once the card is idle", sd_pool_alloc(16, &lba) == 16);
+}
+
+/* Blocks already in the pool can't be freed again */
+static void test_double_free(void) {
+	sd_pool_clear();
+	memset(&sd_pool_stats, 0, sizeof(sd_pool_stats));
+
+	check("free", sd_pool_free(1000, 100) == 0);
+	check("overlapping free refused", sd_pool_free(1050, 100) == SD_ERROR_POOL_OVERLAP &&
+		sd_pool_free(950, 51) == SD_ERROR_POOL_OVERLAP);
+	check("double free refused", sd_pool_free(1000, 100) == SD_ERROR_POOL_OVERLAP);
+	check("adjacent free joined", sd_pool_free(1100, 50) == 0 && sd_pool_free(950, 50) == 0 &&
+		sd_pool_stats.dirty_blocks == 200);
+	check("free past SD_MAX_BLOCKS refused", sd_pool_free(SD_MAX_BLOCKS - 1, 2) == SD_ERROR_END_ADDR_OUTBOUNDS);
+	sd_pool_clear();
+}
+
+int main(void) {
+	uint8_t *data;
+	int retVal;
+
+	data = calloc(CARD_BLOCKS, SD_BLOCK_LENGTH);
+	if (data == 0)
+		return 1;
+	sd_sim_init(data, CARD_BLOCKS, 1);
+
+	retVal = sd_init();
+	check("sd_init", retVal == 0);
+	if (retVal < 0)
+		return 1;
+
+	test_erase_vs_program();
+	test_erase_timeout();
+	test_double_free();
+
+	return (failures == 0) ? 0 : 1;
+}
@@ -0,0 +1,232 @@
+/* Register level model of the LPC21xx SPI0 and LPC214x SSP, for host tests
+ *
+ * Vanya A. Sergeev - <vsergeev@gmail.com> - copyright 2010
+ * please inform author of possible use, licensing is still being decided
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sd_spi_sim.h"
+#include "sd_card_sim.h"
+#include "sd.h"
+
+/* Card model port, see sd_card_sim.c */
+uint8_t sd_port_exchange(uint8_t data);
+void sd_port_select(void);
+void sd_port_deselect(void);
+
+/* What a data register read hands out: the frame, or nothing */
+#define SD_SPI_SIM_DATA		0x100
+#define SD_SPI_SIM_EMPTY	0x200
+/* Status reads in a row with nothing in flight before giving up */
+#define SD_SPI_SIM_STALL	100000
+
+SD_SPI_Sim sd_spi_sim;
+
+/* PCLK cycles per frame at the current divider settings */
+static uint32_t sd_spi_sim_frame_cycles(int ssp) {
+	volatile uint32_t *regs = sd_spi_sim.regs;
+	uint32_t divider;
+
+	if (ssp)
+		divider = ((regs[SD_SPI_SIM_SSPCPSR] < 2) ? 2 : regs[SD_SPI_SIM_SSPCPSR]) *
+			(((regs[SD_SPI_SIM_SSPCR0] >> 8) & 0xFF) + 1);
+	else
+		divider = (regs[SD_SPI_SIM_S0SPCCR] < 8) ? 8 : regs[SD_SPI_SIM_S0SPCCR];
+
+	return divider * 8;
+}
+
+/* One frame on the wire to and from the card */
+static uint8_t sd_spi_sim_shift(uint8_t data, uint32_t frame_cycles) {
+	sd_sim_card.clock = SD_PCLK / (frame_cycles / 8);
+	sd_spi_sim.frames++;
+	sd_spi_sim.shift_cycles += frame_cycles;
+
+	return sd_port_exchange(data);
+}
+
+static void sd_spi_sim_ssp_start(uint64_t now) {
+	SD_SPI_Sim *sim = &sd_spi_sim;
+
+	if (sim->ssp_shifting || sim->tx_count == 0)
+		return;
+	sim->ssp_frame = sim->tx_fifo[sim->tx_head];
+	sim->tx_head = (sim->tx_head + 1) % SD_SPI_SIM_FIFO_DEPTH;
+	sim->tx_count--;
+	sim->ssp_shifting = 1;
+	sim->ssp_end = now + sd_spi_sim_frame_cycles(1);
+}
+
+/* Runs the shift registers up to now */
+static void sd_spi_sim_advance(uint64_t now) {
+	SD_SPI_Sim *sim = &sd_spi_sim;
+	uint64_t end;
+	uint8_t rx;
+
+	if (sim->spi0_shifting && sim->spi0_end <= now) {
+		sim->spi0_rx = sd_spi_sim_shift(sim->spi0_tx, sd_spi_sim_frame_cycles(0));
+		sim->spi0_shifting = 0;
+		sim->spi0_spif = 1;
+	}
+
+	while (sim->ssp_shifting && sim->ssp_end <= now) {
+		rx = sd_spi_sim_shift(sim->ssp_frame, sd_spi_sim_frame_cycles(1));
+		if (sim->rx_count == SD_SPI_SIM_FIFO_DEPTH) {
+			sim->overruns++;
+		} else {
+			sim->rx_fifo[(sim->rx_head + sim->rx_count) % SD_SPI_SIM_FIFO_DEPTH] = rx;
+			sim->rx_count++;
+		}
+		/* The next frame follows straight on if there is one */
+		end = sim->ssp_end;
+		sim->ssp_shifting = 0;
+		sd_spi_sim_ssp_start(end);
+	}
+}
+
+static void sd_spi_sim_pins(uint32_t pins) {
+	if ((pins ^ sd_spi_sim.pins) & SD_CS_PIN) {
+		if (pins & SD_CS_PIN)
+			sd_port_deselect();
+		else
+			sd_port_select();
+	}
+	sd_spi_sim.pins = pins;
+}
+
+/* Acts on the access handed out last, now that the driver is done with
+ * the cell */
+static void sd_spi_sim_resolve(void) {
+	SD_SPI_Sim *sim = &sd_spi_sim;
+	uint32_t value;
+
+	if (sim->pending < 0)
+		return;
+	value = sim->regs[sim->pending];
+
+	switch (sim->pending) {
+		case SD_SPI_SIM_S0SPDR:
+			if (value < SD_SPI_SIM_DATA) {
+				if (sim->spi0_shifting) {
+					sim->collisions++;
+				} else {
+					sim->spi0_tx = value;
+					sim->spi0_shifting = 1;
+					sim->spi0_end = sim->pending_cycles + sd_spi_sim_frame_cycles(0);
+				}
+			} else if (sim->spi0_shifting) {
+				sim->early_reads++;
+			}
+			sim->spi0_spif = 0;
+			break;
+
+		case SD_SPI_SIM_SSPDR:
+			if (value < SD_SPI_SIM_DATA) {
+				if (sim->tx_count == SD_SPI_SIM_FIFO_DEPTH) {
+					sim->tx_overflows++;
+				} else {
+					sim->tx_fifo[(sim->tx_head + sim->tx_count) % SD_SPI_SIM_FIFO_DEPTH] = value;
+					sim->tx_count++;
+					sd_spi_sim_ssp_start(sim->pending_cycles);
+				}
+			} else if (value == SD_SPI_SIM_EMPTY) {
+				sim->empty_reads++;
+			} else {
+				sim->rx_head = (sim->rx_head + 1) % SD_SPI_SIM_FIFO_DEPTH;
+				sim->rx_count--;
+			}
+			break;
+
+		case SD_SPI_SIM_FIO0SET:
+			sd_spi_sim_pins(sim->pins | value);
+			break;
+
+		case SD_SPI_SIM_FIO0CLR:
+			sd_spi_sim_pins(sim->pins & ~value);
+			break;
+	}
+	sim->pending = -1;
+}
+
+void sd_spi_sim_sync(void) {
+	sd_spi_sim_resolve();
+	sd_spi_sim_advance(sd_spi_sim.cycles);
+}
+
+volatile uint32_t *sd_spi_sim_reg(int reg) {
+	SD_SPI_Sim *sim = &sd_spi_sim;
+	volatile uint32_t *cell = &sim->regs[reg];
+
+	sim->cycles += sim->access_cycles;
+	sd_spi_sim_sync();
+
+	/* A driver polling a status that can't change any more (frames
+	 * lost to a collision or an overrun) would spin forever */
+	if ((reg == SD_SPI_SIM_S0SPSR && !sim->spi0_shifting && !sim->spi0_spif) ||
+	    (reg == SD_SPI_SIM_SSPSR && !sim->ssp_shifting && sim->tx_count == 0 && sim->rx_count == 0)) {
+		if (++sim->stalled_polls == SD_SPI_SIM_STALL) {
+			fprintf(stderr, "sd_spi_sim: stalled, collisions %u, early reads %u, full FIFO writes %u, "
+				"empty FIFO reads %u, overruns %u\n", sim->collisions, sim->early_reads,
+				sim->tx_overflows, sim->empty_reads, sim->overruns);
+			exit(1);
+		}
+	} else {
+		sim->stalled_polls = 0;
+	}
+
+	switch (reg) {
+		case SD_SPI_SIM_S0SPSR:
+			*cell = sim->spi0_spif ? (1<<7) : 0;
+			break;
+		case SD_SPI_SIM_S0SPDR:
+			*cell = SD_SPI_SIM_DATA | sim->spi0_rx;
+			break;
+		case SD_SPI_SIM_SSPSR:
+			/* TFE, TNF, RNE, RFF, BSY */
+			*cell = ((sim->tx_count == 0) ? (1<<0) : 0) |
+				((sim->tx_count < SD_SPI_SIM_FIFO_DEPTH) ? (1<<1) : 0) |
+				((sim->rx_count > 0) ? (1<<2) : 0) |
+				((sim->rx_count == SD_SPI_SIM_FIFO_DEPTH) ? (1<<3) : 0) |
+				((sim->ssp_shifting || sim->tx_count > 0) ? (1<<4) : 0);
+			break;
+		case SD_SPI_SIM_SSPDR:
+			*cell = (sim->rx_count > 0) ? (SD_SPI_SIM_DATA | sim->rx_fifo[sim->rx_head]) : SD_SPI_SIM_EMPTY;
+			break;
+		case SD_SPI_SIM_FIO0SET:
+		case SD_SPI_SIM_FIO0CLR:
+			*cell = 0;
+			break;
+		case SD_SPI_SIM_FIO0PIN:
+			*cell = sim->pins;
+			break;
+		default:
+			return cell;
+	}
+
+	sim->pending = reg;
+	sim->pending_cycles = sim->cycles;
+
+	return cell;
+}
+
+void sd_spi_sim_init(uint32_t access_cycles) {
+	memset(&sd_spi_sim, 0, sizeof(sd_spi_sim));
+	sd_spi_sim.access_cycles = access_cycles;
+	sd_spi_sim.pending = -1;
+	/* Chip selects high, card present, not write protected */
+	sd_spi_sim.pins = SD_CS_PIN | SD_CS1_PIN | SD_CD_PIN;
+}
+
+void sd_spi_sim_clear(void) {
+	sd_spi_sim_sync();
+	sd_spi_sim.frames = 0;
+	sd_spi_sim.shift_cycles = 0;
+	sd_spi_sim.collisions = 0;
+	sd_spi_sim.early_reads = 0;
+	sd_spi_sim.tx_overflows = 0;
+	sd_spi_sim.empty_reads = 0;
+	sd_spi_sim.overruns = 0;
+}
@@ -0,0 +1,111 @@
+/* Register level model of the LPC21xx SPI0 and LPC214x SSP, for host tests
+ *
+ * Vanya A. Sergeev - <vsergeev@gmail.com> - copyright 2010
+ * please inform author of possible use, licensing is still being decided
+ *
+ * Stands in for the peripheral registers sd.c uses with SD_SPI_BUS_SPI0
+ * and SD_SPI_BUS_SSP, so the real backends run on a PC in front of the
+ * card model (sd_card_sim.h). Build with -Ilpc, where lpc21xx.h and
+ * lpc214x.h include this header, and link sd_card_sim.c in.
+ *
+ * Every register access costs access_cycles PCLK cycles; nothing else
+ * advances time. The SPI0 shifts one frame per S0SPCCR*8 cycles, the SSP
+ * shifts frames from an 8 frame transmit FIFO into an 8 frame receive
+ * FIFO at CPSDVSR*(SCR+1)*8 cycles each, back to back while the transmit
+ * FIFO has data. Misuse is counted rather than crashing: SPI0 writes
+ * during a transfer (WCOL) and reads before it completes, SSP writes to
+ * a full transmit FIFO, reads of an empty receive FIFO and frames lost
+ * to a full one (receive overrun). A driver left polling a status that
+ * can't change any more stops the program with the counters.
+ *
+ * A register the driver writes is only seen by the model at the next
+ * register access, the way C lets it catch the store: data and GPIO
+ * set/clear registers are handed out with a marker that a store
+ * overwrites. The test calls sd_spi_sim_sync() before looking at the
+ * counters.
+ */
+
+#ifndef _SD_SPI_SIM_H
+#define _SD_SPI_SIM_H
+
+#include <stdint.h>
+
+/* Registers, indexes into SD_SPI_Sim.regs */
+enum {
+	SD_SPI_SIM_PINSEL0, SD_SPI_SIM_PINSEL1,
+	SD_SPI_SIM_FIO0DIR, SD_SPI_SIM_FIO0SET, SD_SPI_SIM_FIO0CLR, SD_SPI_SIM_FIO0PIN,
+	SD_SPI_SIM_S0SPCR, SD_SPI_SIM_S0SPSR, SD_SPI_SIM_S0SPDR, SD_SPI_SIM_S0SPCCR,
+	SD_SPI_SIM_SSPCR0, SD_SPI_SIM_SSPCR1, SD_SPI_SIM_SSPDR, SD_SPI_SIM_SSPSR,
+	SD_SPI_SIM_SSPCPSR, SD_SPI_SIM_SSPIMSC,
+	SD_SPI_SIM_REGS
+};
+
+#define SD_SPI_SIM_FIFO_DEPTH	8
+
+typedef struct _SD_SPI_Sim {
+	/* PCLK cycles per register access */
+	uint32_t access_cycles;
+
+	/* Counters, see sd_spi_sim_clear() */
+	uint64_t cycles;
+	uint64_t frames;
+	uint64_t shift_cycles;
+	uint32_t collisions;
+	uint32_t early_reads;
+	uint32_t tx_overflows;
+	uint32_t empty_reads;
+	uint32_t overruns;
+
+	/* Register cells, and the access the model hasn't looked at yet */
+	volatile uint32_t regs[SD_SPI_SIM_REGS];
+	int pending;
+	uint64_t pending_cycles;
+	uint32_t stalled_polls;
+	uint32_t pins;
+
+	/* SPI0 shift register */
+	int spi0_shifting;
+	uint64_t spi0_end;
+	uint8_t spi0_tx;
+	uint8_t spi0_rx;
+	int spi0_spif;
+
+	/* SSP FIFOs and shift register */
+	uint8_t tx_fifo[SD_SPI_SIM_FIFO_DEPTH];
+	int tx_head, tx_count;
+	uint8_t rx_fifo[SD_SPI_SIM_FIFO_DEPTH];
+	int rx_head, rx_count;
+	int ssp_shifting;
+	uint64_t ssp_end;
+	uint8_t ssp_frame;
+} SD_SPI_Sim;
+
+extern SD_SPI_Sim sd_spi_sim;
+
+/* Register access, the cell to load or store */
+volatile uint32_t *sd_spi_sim_reg(int reg);
+/* Resets the peripheral and the counters */
+void sd_spi_sim_init(uint32_t access_cycles);
+/* Zeroes the counters, the time keeps running */
+void sd_spi_sim_clear(void);
+/* Lets the model see the last access */
+void sd_spi_sim_sync(void);
+
+#define PINSEL0		(*sd_spi_sim_reg(SD_SPI_SIM_PINSEL0))
+#define PINSEL1		(*sd_spi_sim_reg(SD_SPI_SIM_PINSEL1))
+#define FIO0DIR		(*sd_spi_sim_reg(SD_SPI_SIM_FIO0DIR))
+#define FIO0SET		(*sd_spi_sim_reg(SD_SPI_SIM_FIO0SET))
+#define FIO0CLR		(*sd_spi_sim_reg(SD_SPI_SIM_FIO0CLR))
+#define FIO0PIN		(*sd_spi_sim_reg(SD_SPI_SIM_FIO0PIN))
+#define S0SPCR		(*sd_spi_sim_reg(SD_SPI_SIM_S0SPCR))
+#define S0SPSR		(*sd_spi_sim_reg(SD_SPI_SIM_S0SPSR))
+#define S0SPDR		(*sd_spi_sim_reg(SD_SPI_SIM_S0SPDR))
+#define S0SPCCR		(*sd_spi_sim_reg(SD_SPI_SIM_S0SPCCR))
+#define SSPCR0		(*sd_spi_sim_reg(SD_SPI_SIM_SSPCR0))
+#define SSPCR1		(*sd_spi_sim_reg(SD_SPI_SIM_SSPCR1))
+#define SSPDR		(*sd_spi_sim_reg(SD_SPI_SIM_SSPDR))
+#define SSPSR		(*sd_spi_sim_reg(SD_SPI_SIM_SSPSR))
+#define SSPCPSR		(*sd_spi_sim_reg(SD_SPI_SIM_SSPCPSR))
+#define SSPIMSC		(*sd_spi_sim_reg(SD_SPI_SIM_SSPIMSC))
+
+#endif
@@ -0,0 +1,142 @@
+/* Tests of the SPI0 and SSP backends against the register level model
+ *
+ * Vanya A. Sergeev - <vsergeev@gmail.com> - copyright 2010
+ * please inform author of possible use, licensing is still being decided
+ *
+ * Builds on a PC, once per backend, with:
+ *	cc -O2 -Ilpc -I.. -DSD_SPI_BUS=SD_SPI_BUS_SPI0 -o sd_spi_test_spi0 sd_spi_test.c sd_spi_sim.c sd_card_sim.c ../sd.c
+ *	cc -O2 -Ilpc -I.. -DSD_SPI_BUS=SD_SPI_BUS_SSP -DSD_CD_PIN='(1<<21)' -DSD_WP_PIN='(1<<22)' \
+ *		-o sd_spi_test_ssp sd_spi_test.c sd_spi_sim.c sd_card_sim.c ../sd.c
+ *
+ * Usage: sd_spi_test
+ *
+ * Runs the driver over the real backend code with the CPU taking 1, 4, 16
+ * and 64 PCLK cycles per register access (see sd_spi_sim.h). At each
+ * speed it writes and reads blocks with CRC on and off and checks the
+ * data and that the peripheral was never misused: no SPI0 write
+ * collisions or early reads, no SSP writes to a full transmit FIFO,
+ * reads of an empty receive FIFO or receive overruns. It then times the
+ * block loops alone and prints how busy they keep SCK. Prints one line
+ * per check and exits non-zero if any failed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sd_spi_sim.h"
+#include "sd_card_sim.h"
+#include "sd.h"
+
+#define CARD_BLOCKS	16384
+#define TEST_BLOCKS	8
+
+static uint8_t out[TEST_BLOCKS * SD_BLOCK_LENGTH];
+static uint8_t in[TEST_BLOCKS * SD_BLOCK_LENGTH];
+static int failures;
+
+static void check(const char *what, int ok) {
+	printf("%-60s %s\n", what, ok ? "ok" : "FAIL");
+	if (!ok)
+		failures++;
+}
+
+static int misused(void) {
+	sd_spi_sim_sync();
+	return sd_spi_sim.collisions + sd_spi_sim.early_reads + sd_spi_sim.tx_overflows +
+		sd_spi_sim.empty_reads + sd_spi_sim.overruns;
+}
+
+static void report_misuse(void) {
+	printf("  collisions %u, early reads %u, full FIFO writes %u, empty FIFO reads %u, overruns %u\n",
+		sd_spi_sim.collisions, sd_spi_sim.early_reads, sd_spi_sim.tx_overflows,
+		sd_spi_sim.empty_reads, sd_spi_sim.overruns);
+}
+
+/* Writes and reads back single and multiple blocks */
+static int transfer(uint32_t lba, int seed) {
+	int i, retVal;
+
+	for (i = 0; i < (int)sizeof(out); i++)
+		out[i] = i * 13 + seed;
+	memset(in, 0, sizeof(in));
+
+	retVal = sd_write_blocks(lba * SD_BLOCK_LENGTH, out, sizeof(out));
+	if (retVal == 0)
+		retVal = sd_write_block((lba + TEST_BLOCKS) * SD_BLOCK_LENGTH, out);
+	if (retVal == 0)
+		retVal = sd_read_blocks(lba * SD_BLOCK_LENGTH, in, sizeof(in));
+	if (retVal == 0 && memcmp(in, out, sizeof(out)) != 0)
+		retVal = -1;
+	if (retVal == 0)
+		retVal = sd_read_block((lba + TEST_BLOCKS) * SD_BLOCK_LENGTH, in);
+	if (retVal == 0 && memcmp(in, out, SD_BLOCK_LENGTH) != 0)
+		retVal = -1;
+
+	return retVal;
+}
+
+/* Share of the time one block loop keeps SCK shifting, in percent */
+static double sck_busy(int send, int crc) {
+	volatile uint16_t crc16;
+	uint64_t start;
+
+	sd_spi_deselect();
+	sd_spi_sim_clear();
+	start = sd_spi_sim.cycles;
+	if (send && crc)
+		crc16 = sd_spi_send_block_crc16(0, out, SD_BLOCK_LENGTH);
+	else if (send)
+		sd_spi_send_block(out, SD_BLOCK_LENGTH);
+	else if (crc)
+		crc16 = sd_spi_receive_block_crc16(0, in, SD_BLOCK_LENGTH);
+	else
+		sd_spi_receive_block(in, SD_BLOCK_LENGTH);
+	sd_spi_sim_sync();
+	(void)crc16;
+
+	return 100.0 * sd_spi_sim.shift_cycles / (sd_spi_sim.cycles - start);
+}
+
+int main(void) {
+	static const uint32_t speeds[] = { 1, 4, 16, 64 };
+	char what[64];
+	uint8_t *data;
+	int i, retVal;
+
+	data = calloc(CARD_BLOCKS, SD_BLOCK_LENGTH);
+	if (data == 0)
+		return 1;
+
+	printf("%s backend\n", (SD_SPI_BUS == SD_SPI_BUS_SSP) ? "SSP" : "SPI0");
+	for (i = 0; i < (int)(sizeof(speeds) / sizeof(speeds[0])); i++) {
+		sd_spi_sim_init(speeds[i]);
+		sd_sim_init(data, CARD_BLOCKS, 1);
+
+		retVal = sd_init();
+		sprintf(what, "%u cycles per access: sd_init", speeds[i]);
+		check(what, retVal == 0);
+		if (retVal < 0)
+			return 1;
+
+		retVal = transfer(100, i);
+		sprintf(what, "%u cycles per access: blocks with CRC on", speeds[i]);
+		check(what, retVal == 0);
+		sd_set_crc(0);
+		retVal = transfer(200, i + 1);
+		sd_set_crc(1);
+		sprintf(what, "%u cycles per access: blocks with CRC off", speeds[i]);
+		check(what, retVal == 0);
+
+		sprintf(what, "%u cycles per access: peripheral used correctly", speeds[i]);
+		check(what, misused() == 0);
+		if (misused() != 0)
+			report_misuse();
+
+		printf("  SCK %u Hz, busy %.0f%% receiving, %.0f%% with CRC16, %.0f%% sending, %.0f%% with CRC16\n",
+			sd_get_speed(), sck_busy(0, 0), sck_busy(0, 1), sck_busy(1, 0), sck_busy(1, 1));
+		sprintf(what, "%u cycles per access: block loops used it correctly", speeds[i]);
+		check(what, misused() == 0);
+	}
+
+	return (failures == 0) ? 0 : 1;
+}
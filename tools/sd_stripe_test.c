@@ -0,0 +1,150 @@
+/* Tests of sd_stripe against two card models
+ *
+ * Vanya A. Sergeev - <vsergeev@gmail.com> - copyright 2010
+ * please inform author of possible use, licensing is still being decided
+ *
+ * Builds on a PC with:
+ *	cc -O2 -I.. -DSD_SPI_BUS=SD_SPI_BUS_PORT -DSD_NUM_CARDS=2 -o sd_stripe_test sd_stripe_test.c sd_card_sim.c ../sd_stripe.c ../sd.c
+ *
+ * Usage: sd_stripe_test
+ *
+ * The card model switches cards on sd_get_card() (see sd_card_sim.h).
+ * The test initializes both cards, checks where striped writes land on
+ * each and reads them back, then writes the same run striped and to one
+ * card and compares the modeled times: the cards program side by side,
+ * so the striped run should hide most of the busy time the single card
+ * one waits out. Ranges past the cards' 32-bit byte addresses must be
+ * refused. Prints one line per check and exits non-zero if any failed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sd_card_sim.h"
+#include "sd_stripe.h"
+
+#if SD_NUM_CARDS != 2
+#error "Build with -DSD_NUM_CARDS=2."
+#endif
+
+#define CARD_BLOCKS	16384
+#define TEST_BLOCKS	64
+
+static uint8_t out[TEST_BLOCKS * SD_BLOCK_LENGTH];
+static uint8_t in[TEST_BLOCKS * SD_BLOCK_LENGTH];
+static int failures;
+
+static void check(const char *what, int ok) {
+	printf("%-60s %s\n", what, ok ? "ok" : "FAIL");
+	if (!ok)
+		failures++;
+}
+
+static void fill(int seed) {
+	int i;
+
+	for (i = 0; i < (int)sizeof(out); i++)
+		out[i] = i * 13 + seed;
+}
+
+/* Block i of a striped range starting at lba is where sd_stripe.h says */
+static int placed(uint32_t lba) {
+	uint32_t i, n, unit;
+	int card;
+
+	for (i = 0; i < TEST_BLOCKS; i++) {
+		unit = (lba + i) / SD_STRIPE_BLOCKS;
+		card = unit % SD_NUM_CARDS;
+		n = (unit / SD_NUM_CARDS) * SD_STRIPE_BLOCKS + (lba + i) % SD_STRIPE_BLOCKS;
+		if (memcmp(sd_sim_cards[card].data + n * SD_BLOCK_LENGTH, out + i * SD_BLOCK_LENGTH, SD_BLOCK_LENGTH) != 0)
+			return 0;
+	}
+
+	return 1;
+}
+
+static uint32_t commands(int command) {
+	return sd_sim_cards[0].commands[command] + sd_sim_cards[1].commands[command];
+}
+
+static void test_placement(void) {
+	int retVal;
+
+	fill(1);
+	retVal = sd_stripe_write(101, out, TEST_BLOCKS);
+	check("striped write", retVal == 0);
+	check("blocks placed alternately on the two cards", placed(101));
+	check("one CMD25 per card", sd_sim_cards[0].commands[25] == 1 && sd_sim_cards[1].commands[25] == 1);
+
+	memset(in, 0, sizeof(in));
+	retVal = sd_stripe_read(101, in, TEST_BLOCKS);
+	check("striped read back", retVal == 0 && memcmp(in, out, sizeof(out)) == 0);
+	check("selected card restored", sd_get_card() == 0);
+}
+
+/* The same pre-erased run striped over both cards and on card 0 alone */
+static void test_overlap(void) {
+	uint64_t striped_ns, single_ns, busy_ns;
+	int retVal;
+
+	fill(2);
+	sd_sim_clear_counters();
+	retVal = sd_stripe_write(1000, out, TEST_BLOCKS);
+	striped_ns = sd_sim_time_ns();
+	busy_ns = sd_sim_cards[0].busy_ns + sd_sim_cards[1].busy_ns;
+
+	sd_sim_clear_counters();
+	if (retVal == 0)
+		retVal = sd_pre_erase(TEST_BLOCKS);
+	if (retVal == 0)
+		retVal = sd_write_blocks(4000 * SD_BLOCK_LENGTH, out, sizeof(out));
+	single_ns = sd_sim_time_ns();
+
+	check("striped and single card runs written", retVal == 0);
+	/* Both runs move the same bytes, what the striped one saves is card
+	 * busy it didn't have to wait out */
+	printf("  striped %.2f ms with %.2f ms of card busy, one card %.2f ms, %.0f%% of the busy hidden\n",
+		striped_ns / 1e6, busy_ns / 1e6, single_ns / 1e6,
+		(single_ns > striped_ns) ? 100.0 * (single_ns - striped_ns) / busy_ns : 0.0);
+	check("cards program side by side", single_ns > striped_ns && (single_ns - striped_ns) > busy_ns / 2);
+}
+
+static void test_range(void) {
+	int write, read;
+
+	sd_sim_clear_counters();
+	fill(3);
+	/* Block 2*SD_MAX_BLOCKS is block SD_MAX_BLOCKS on card 0 */
+	write = sd_stripe_write(2 * SD_MAX_BLOCKS - 1, out, 2);
+	read = sd_stripe_read(2 * SD_MAX_BLOCKS, in, 1);
+	check("ranges past SD_MAX_BLOCKS on a card refused", write == SD_ERROR_WRITE_ADDR_OUTBOUNDS &&
+		read == SD_ERROR_READ_ADDR_OUTBOUNDS);
+	check("nothing sent for them", commands(25) + commands(18) + commands(24) + commands(17) == 0);
+}
+
+int main(void) {
+	uint8_t *data[SD_NUM_CARDS];
+	int card, retVal;
+
+	for (card = 0; card < SD_NUM_CARDS; card++) {
+		data[card] = calloc(CARD_BLOCKS, SD_BLOCK_LENGTH);
+		if (data[card] == 0)
+			return 1;
+		sd_sim_select(card);
+		sd_sim_init(data[card], CARD_BLOCKS, 1);
+	}
+	sd_sim_select(0);
+
+	retVal = sd_stripe_init();
+	check("sd_stripe_init", retVal == 0);
+	check("both cards initialized", sd_sim_cards[0].commands[0] > 0 && sd_sim_cards[1].commands[0] > 0);
+	if (retVal < 0)
+		return 1;
+	sd_sim_clear_counters();
+
+	test_placement();
+	test_overlap();
+	test_range();
+
+	return (failures == 0) ? 0 : 1;
+}
@@ -0,0 +1,128 @@
+/* Tests of sd_verify against the card model
+ *
+ * Vanya A. Sergeev - <vsergeev@gmail.com> - copyright 2010
+ * please inform author of possible use, licensing is still being decided
+ *
+ * Builds on a PC with:
+ *	cc -O2 -I.. -DSD_SPI_BUS=SD_SPI_BUS_PORT -o sd_verify_test sd_verify_test.c sd_card_sim.c ../sd_verify.c ../sd.c
+ *
+ * Usage: sd_verify_test
+ *
+ * Writes blocks through sd_verify with CRC checking on and off, corrupts
+ * some of them behind the driver's back in the card model and checks
+ * that the callback is given exactly those, that each run of consecutive
+ * blocks is read back in one CMD18 and that ranges past the 32-bit byte
+ * addresses are refused. Prints one line per check and exits non-zero
+ * if any failed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sd_card_sim.h"
+#include "sd_verify.h"
+
+#define CARD_BLOCKS	16384
+#define MAX_REPORTS	16
+
+static uint8_t buffer[16 * SD_BLOCK_LENGTH];
+static uint32_t reported_lba[MAX_REPORTS];
+static int reported_error[MAX_REPORTS];
+static int num_reports;
+static int failures;
+
+static void check(const char *what, int ok) {
+	printf("%-60s %s\n", what, ok ? "ok" : "FAIL");
+	if (!ok)
+		failures++;
+}
+
+static void reported(uint32_t lba, int error) {
+	if (num_reports == MAX_REPORTS)
+		return;
+	reported_lba[num_reports] = lba;
+	reported_error[num_reports] = error;
+	num_reports++;
+}
+
+/* Flips a bit of a block on the card, the driver doesn't see it */
+static void corrupt(uint32_t lba) {
+	sd_sim_card.data[lba * SD_BLOCK_LENGTH + 100] ^= 0x10;
+}
+
+/* Two runs of blocks, 100-115 and 300-303 */
+static int write_runs(int seed) {
+	int i, retVal;
+
+	for (i = 0; i < (int)sizeof(buffer); i++)
+		buffer[i] = i * 7 + seed;
+
+	num_reports = 0;
+	retVal = sd_verify_write(100, buffer, 8);
+	if (retVal == 0)
+		retVal = sd_verify_write(108, buffer + 8 * SD_BLOCK_LENGTH, 8);
+	if (retVal == 0)
+		retVal = sd_verify_write(300, buffer, 4);
+
+	return retVal;
+}
+
+static void test_verify(int crc) {
+	char what[64];
+	int retVal, failed;
+
+	sd_set_crc(crc);
+
+	retVal = write_runs(crc);
+	sd_sim_clear_counters();
+	failed = sd_verify_run();
+	sprintf(what, "CRC %s: intact blocks pass", crc ? "on" : "off");
+	check(what, retVal == 0 && failed == 0 && num_reports == 0);
+	sprintf(what, "CRC %s: one CMD18 per run of blocks", crc ? "on" : "off");
+	check(what, sd_sim_card.commands[18] == 2 && sd_sim_card.commands[17] == 0);
+
+	retVal = write_runs(crc + 2);
+	corrupt(103);
+	corrupt(302);
+	failed = sd_verify_run();
+	sprintf(what, "CRC %s: corrupted blocks reported", crc ? "on" : "off");
+	check(what, retVal == 0 && failed == 2 && num_reports == 2 &&
+		reported_lba[0] == 103 && reported_error[0] == SD_ERROR_VERIFY &&
+		reported_lba[1] == 302 && reported_error[1] == SD_ERROR_VERIFY);
+	check("nothing left to verify", sd_verify_pending() == 0);
+
+	sd_set_crc(1);
+}
+
+static void test_range(void) {
+	int write, add;
+
+	sd_sim_clear_counters();
+	write = sd_verify_write(SD_MAX_BLOCKS - 1, buffer, 2);
+	add = sd_verify_add(SD_MAX_BLOCKS, buffer, 1);
+	check("ranges past SD_MAX_BLOCKS refused", write == SD_ERROR_WRITE_ADDR_OUTBOUNDS &&
+		add == SD_ERROR_READ_ADDR_OUTBOUNDS && sd_verify_pending() == 0 &&
+		sd_sim_card.commands[25] + sd_sim_card.commands[24] == 0);
+}
+
+int main(void) {
+	uint8_t *data;
+	int retVal;
+
+	data = calloc(CARD_BLOCKS, SD_BLOCK_LENGTH);
+	if (data == 0)
+		return 1;
+	sd_sim_init(data, CARD_BLOCKS, 1);
+
+	retVal = sd_init();
+	check("sd_init", retVal == 0);
+	if (retVal < 0)
+		return 1;
+	sd_verify_set_callback(reported);
+
+	test_verify(1);
+	test_verify(0);
+	test_range();
+
+	return (failures == 0) ? 0 : 1;
+}